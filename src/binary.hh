@@ -0,0 +1,552 @@
+#pragma once
+#include <vector>
+#include <span>
+#include <string>
+#include <optional>
+#include <map>
+#include <bit>
+#include <cstdint>
+#include "types.hh"
+#include "math.hh"
+#include "document.hh"
+#include "symbols.hh"
+#include "lz.hh"
+
+// Compact binary encoding of atoms and edits, for things the
+// user never reads (autosave, journals). The .hsc format is
+// still what documents are actually saved as.
+//
+// Integers are LEB128 varints, signed ones zigzagged first.
+// Stroke points are delta coded against the previous point,
+// so a typical pen sample takes 3-4 bytes instead of 8.
+//
+// Atoms start with a tag, which for the first few is their
+// index in the Atom variant. Strokes that aren't plain black
+// use ColouredStroke and have the colour after the diameter,
+// so plain ones cost the same as before there were colours.
+// Tags never change meaning once journals have them, so that
+// one stays 5 even though Fill is 5 in the variant now, and
+// fills (like anything new) get a tag of their own.
+// Strokes that have been cut use CutStroke, which has the
+// colour either way and then where each piece stops.
+//
+// Erasers are their mask, block by block: each of a block's
+// rows is a run count then a byte each for where runs start
+// and stop. An empty row is a single 0 byte. Ones finer than
+// the document use FineEraser, which has the scale after the
+// diameter.
+//
+// Markers with a size (lettering) use Lettering, which has
+// where it goes, its size in 16ths and its colour after the
+// text. Plain timeline markers stay tagged 3.
+//
+// Curves are like coloured strokes, their points being the
+// Béziers' control points.
+//
+// Patterns are their tile size, their region like a Fill's
+// without the colour, then the motif's strokes as atoms.
+//
+// Instances are which symbol, then the transform's six floats.
+// The first time a symbol comes up it's written out there, as
+// a 0, its name and its atoms, and gets the next number; after
+// that it's only its number plus one. So a snapshot holds each
+// symbol once, however many times it's used. (A single edit is
+// a stream of its own, so it has the symbol in full.)
+//
+// Packed atoms (see cold.hh) are written as what they were.
+// One that won't open (which it always should) is kept as it
+// is, tagged Sealed: its bytes, their size opened, its box and
+// its sum, so there's still an atom there on reading it back.
+// Packing uses the same encoding, except points go a column
+// at a time: every x, then every y, then every pressure, each
+// delta coded. Runs of alike bytes are what LZ is good at.
+namespace Binary
+{
+	constexpr uint8_t ColouredStroke = 5;
+	constexpr uint8_t CutStroke      = 0x81;
+	constexpr uint8_t Lettering      = 0x82;
+	constexpr uint8_t Filled         = 0x83;
+	constexpr uint8_t FineEraser     = 0x84;
+	constexpr uint8_t Sealed         = 0x85;
+
+	std::optional<Atom> unpack(const Packed& p); // Further down
+
+	// Symbols that have been read, by their encoding on its own
+	// (with any symbols in them in full), so streams read with
+	// the same one share them. A journal has each symbol in full
+	// in every edit that uses it.
+	using Interned = std::map<std::vector<uint8_t>, std::shared_ptr<const Symbol>>;
+
+	class Writer {
+		std::vector<uint8_t>& out;
+		const bool columns; // Points a column at a time, for packing
+		std::map<const Symbol*, uint64_t> symbols {}; // Written so far, by number
+	public:
+		Writer(std::vector<uint8_t>& out, bool columns = false) : out{out}, columns{columns} {}
+
+		void u8(uint8_t x) { out.push_back(x); }
+		void u32(uint32_t x) {
+			for (int i=0; i<4; i++) out.push_back(x >> 8*i);
+		}
+		void varint(uint64_t x) {
+			for (; x >= 0x80; x >>= 7) out.push_back(x | 0x80);
+			out.push_back(x);
+		}
+		void zigzag(int64_t x) { varint((uint64_t(x) << 1) ^ uint64_t(x >> 63)); }
+		void bytes(std::string_view s) {
+			varint(s.size());
+			out.insert(out.end(), s.begin(), s.end());
+		}
+
+		void atom(const Atom& a) {
+			if (auto* p = std::get_if<Packed>(&a)) {
+				if (auto b = unpack(*p)) atom(*b);
+				else {
+					u8(Sealed);
+					bytes({(const char*) p->bytes.data(), p->bytes.size()});
+					varint(p->size);
+					for (int16_t k : p->box) zigzag(k);
+					varint(p->diameter);
+					varint(p->sum);
+				}
+				return;
+			}
+			auto* s = std::get_if<Stroke>(&a);
+			const bool cut      = s && !s->ends.empty();
+			const bool coloured = s && (cut || s->colour != Col3 {0,0,0} || s->alpha != 255);
+			auto* m = std::get_if<Marker>(&a);
+			const bool lettering = m && m->size > 0;
+			const bool fill = std::holds_alternative<Fill>(a);
+			auto* e = std::get_if<Eraser>(&a);
+			const bool fine = e && e->scale > 1;
+			u8(cut ? CutStroke : coloured ? ColouredStroke : lettering ? Lettering
+			   : fill ? Filled : fine ? FineEraser : a.index());
+			if (s) {
+				varint(s->diameter);
+				if (coloured) {
+					u8(s->colour.r), u8(s->colour.g), u8(s->colour.b);
+					u8(s->alpha);
+				}
+				if (cut) {
+					varint(s->ends.size());
+					for (uint32_t end : s->ends) varint(end);
+				}
+				points(s->points);
+			}
+			if (auto* c = std::get_if<Curve>(&a)) {
+				varint(c->diameter);
+				u8(c->colour.r), u8(c->colour.g), u8(c->colour.b);
+				u8(c->alpha);
+				points(c->points);
+			}
+			if (e) {
+				varint(e->diameter);
+				if (fine) u8(e->scale);
+				zigzag(e->tip.x);
+				zigzag(e->tip.y);
+				varint(e->shape.blocks.size());
+				for (const Mask::Block& b : e->shape.blocks) {
+					zigzag(b.tx);
+					zigzag(b.ty);
+					for (int r=0; r<Mask::Tile; r++) {
+						varint((b.rows[r+1] - b.rows[r]) / 2);
+						for (int i=b.rows[r]; i<b.rows[r+1]; i++) u8(b.runs[i]);
+					}
+				}
+			}
+			if (m) {
+				bytes(m->text);
+				if (lettering) {
+					zigzag(m->at.x);
+					zigzag(m->at.y);
+					varint(std::lround(m->size * 16));
+					u8(m->colour.r), u8(m->colour.g), u8(m->colour.b);
+					u8(m->alpha);
+				}
+			}
+			if (auto* l = std::get_if<Layer>(&a)) {
+				bytes(l->name);
+				u8(l->visible);
+				u8(uint8_t(clamp01(l->opacity) * 255 + 0.5f));
+				u8(uint8_t(l->blend));
+			}
+			if (auto* f = std::get_if<Fill>(&a)) {
+				u8(f->colour.r), u8(f->colour.g), u8(f->colour.b);
+				u8(f->alpha);
+				region(*f);
+			}
+			if (auto* p = std::get_if<Pattern>(&a)) {
+				varint(p->width);
+				varint(p->height);
+				region(p->region);
+				varint(p->motif.size());
+				for (const Stroke& s : p->motif) atom(s);
+			}
+			if (auto* i = std::get_if<Instance>(&a)) {
+				symbol(*i->symbol);
+				for (float k : i->transform) u32(std::bit_cast<uint32_t>(k));
+			}
+		}
+
+		// Numbered after its atoms, so any it uses come first.
+		void symbol(const Symbol& s) {
+			if (auto it = symbols.find(&s); it != symbols.end()) {
+				varint(it->second + 1);
+				return;
+			}
+			varint(0);
+			bytes(s.name);
+			varint(s.atoms.size());
+			for (const Atom& a : s.atoms) atom(a);
+			symbols.emplace(&s, symbols.size());
+		}
+
+		// Delta coded, with pressure.
+		void points(std::span<const Point> ps) {
+			varint(ps.size());
+			if (columns) {
+				// Each one guessed from the two before it.
+				auto column = [&](auto value) {
+					int64_t a = 0, b = 0;
+					for (Point q : ps) {
+						const int64_t v = value(q);
+						zigzag(v - (2*b - a));
+						a = b, b = v;
+					}
+				};
+				column([](Point q) { return q.x; });
+				column([](Point q) { return q.y; });
+				column([](Point q) { return uint16_t(clamp01(q.pressure) * 0xffff + 0.5f); });
+				return;
+			}
+			Point prev {0, 0, 0};
+			for (Point p : ps) {
+				zigzag(p.x - prev.x);
+				zigzag(p.y - prev.y);
+				varint(uint16_t(clamp01(p.pressure) * 0xffff + 0.5f));
+				prev = p;
+			}
+		}
+
+		// A fill's shape: its rule and outlines.
+		void region(const Fill& f) {
+			u8(uint8_t(f.rule));
+			varint(f.ends.size());
+			for (uint32_t end : f.ends) varint(end);
+			varint(f.outline.size());
+			Point prev {0, 0, 0};
+			for (Point p : f.outline) {
+				zigzag(p.x - prev.x);
+				zigzag(p.y - prev.y);
+				prev = p;
+			}
+		}
+
+		void edit(const DocEdit& e) {
+			u8(e.index());
+			std::visit(Overloaded {
+				[&](const Edit::AppendAtom& e)   { atom(e.atom); },
+				[&](const Edit::ExtendStroke& e) {
+					zigzag(e.point.x);
+					zigzag(e.point.y);
+					varint(uint16_t(clamp01(e.point.pressure) * 0xffff + 0.5f));
+				},
+				[&](const Edit::DeleteRange& e)  { varint(e.first); varint(e.last); },
+				[&](const Edit::ReplaceAtom& e)  { varint(e.index); atom(e.atom); },
+				[&](const Edit::Splice& e) {
+					varint(e.first);
+					varint(e.last);
+					varint(e.atoms.size());
+					for (auto& a : e.atoms) atom(*a);
+				}
+			}, e);
+		}
+
+	private:
+		static float clamp01(float p) { return p < 0 ? 0 : p > 1 ? 1 : p; }
+	};
+
+	// Reading never throws or asserts, since the input could
+	// be a file that got cut off halfway. Once anything is
+	// wrong 'ok' goes false and everything after reads 0.
+	class Reader {
+		static constexpr int MaxDepth = 16; // Symbols in symbols
+
+		std::span<const uint8_t> in;
+		std::size_t pos = 0;
+		const bool columns; // See Writer
+		std::vector<std::shared_ptr<const Symbol>> symbols {};
+		Interned* interned;
+		int depth = 0;
+	public:
+		bool ok = true;
+
+		Reader(std::span<const uint8_t> in, bool columns = false, Interned* interned = nullptr)
+		: in{in}, columns{columns}, interned{interned} {}
+
+		bool        atEnd() const { return pos == in.size(); }
+		std::size_t offset() const { return pos; }
+
+		void skip(std::size_t n) {
+			if (n > in.size()-pos) { ok = false; n = in.size()-pos; }
+			pos += n;
+		}
+
+		uint8_t u8() {
+			if (pos >= in.size()) { ok = false; return 0; }
+			return in[pos++];
+		}
+		uint32_t u32() {
+			uint32_t x = 0;
+			for (int i=0; i<4; i++) x |= uint32_t(u8()) << 8*i;
+			return x;
+		}
+		uint64_t varint() {
+			uint64_t x = 0;
+			for (unsigned shift=0; shift<64; shift+=7) {
+				uint8_t b = u8();
+				x |= uint64_t(b & 0x7f) << shift;
+				if (!(b & 0x80)) return x;
+			}
+			ok = false;
+			return 0;
+		}
+		int64_t zigzag() {
+			uint64_t x = varint();
+			return int64_t(x >> 1) ^ -int64_t(x & 1);
+		}
+		std::string bytes() {
+			uint64_t n = varint();
+			if (n > in.size()-pos) { ok = false; return {}; }
+			std::string s {(const char*)&in[pos], n};
+			pos += n;
+			return s;
+		}
+
+		Atom atom() {
+			switch (const uint8_t tag = u8()) {
+				case 0:
+				case ColouredStroke:
+				case CutStroke: {
+					Stroke s {unsigned(varint()), {}};
+					if (tag != 0) {
+						s.colour = {u8(), u8(), u8()};
+						s.alpha  = u8();
+					}
+					if (tag == CutStroke) {
+						uint64_t pieces = varint();
+						if (pieces > in.size()-pos) { ok = false; return s; }
+						while (pieces-- && ok) s.ends.push_back(varint());
+					}
+					points(s.points);
+					return s;
+				}
+				case 6: {
+					Curve c {unsigned(varint()), {}};
+					c.colour = {u8(), u8(), u8()};
+					c.alpha  = u8();
+					points(c.points);
+					return c;
+				}
+				case 1: {
+					Pattern p {};
+					p.width  = varint();
+					p.height = varint();
+					region(p.region);
+					uint64_t n = varint();
+					// Each stroke takes at least 3 bytes.
+					if (n > (in.size()-pos)/3) { ok = false; return p; }
+					while (n-- && ok) {
+						Atom a = atom();
+						if (auto* s = std::get_if<Stroke>(&a)) p.motif.push_back(std::move(*s));
+						else ok = false;
+					}
+					if (p.width == 0 || p.height == 0) ok = false;
+					return p;
+				}
+				case 2: case FineEraser: {
+					Eraser e {unsigned(varint())};
+					if (tag == FineEraser && (e.scale = u8()) == 0) ok = false;
+					e.tip.x = zigzag();
+					e.tip.y = zigzag();
+					uint64_t blocks = varint();
+					// Each block takes at least a byte per row.
+					if (blocks > (in.size()-pos)/Mask::Tile) { ok = false; return e; }
+					while (blocks-- && ok) {
+						const int tx = zigzag(), ty = zigzag();
+						for (int r=0; r<Mask::Tile && ok; r++)
+							for (uint64_t n = varint(); n-- && ok; ) {
+								const int x0 = u8(), x1 = u8();
+								if (x0 >= x1 || x1 > Mask::Tile) { ok = false; break; }
+								Masks::add(e.shape, ty*Mask::Tile + r, tx*Mask::Tile + x0, tx*Mask::Tile + x1);
+							}
+					}
+					return e;
+				}
+				case 3: return Marker {bytes()};
+				case Lettering: {
+					Marker m {bytes()};
+					m.at.x   = zigzag();
+					m.at.y   = zigzag();
+					m.size   = varint() / 16.f;
+					m.colour = {u8(), u8(), u8()};
+					m.alpha  = u8();
+					return m;
+				}
+				case 4: {
+					Layer l {bytes()};
+					l.visible = u8();
+					l.opacity = u8() / 255.f;
+					l.blend   = u8() ? Blend::Multiply : Blend::Darken;
+					return l;
+				}
+				case Filled: {
+					Fill f {};
+					f.colour = {u8(), u8(), u8()};
+					f.alpha  = u8();
+					region(f);
+					return f;
+				}
+				case 7: {
+					Instance i {symbol()};
+					for (float& k : i.transform) k = std::bit_cast<float>(u32());
+					if (!i.symbol) ok = false;
+					return i;
+				}
+				case Sealed: {
+					const std::string b = bytes();
+					Packed p {{b.begin(), b.end()}, uint32_t(varint())};
+					for (int16_t& k : p.box) k = zigzag();
+					p.diameter = varint();
+					p.sum = varint();
+					return p;
+				}
+			}
+			ok = false;
+			return {};
+		}
+
+		std::shared_ptr<const Symbol> symbol() {
+			if (const uint64_t n = varint(); n > 0) {
+				if (n > symbols.size()) { ok = false; return {}; }
+				return symbols[n-1];
+			}
+			if (depth == MaxDepth) { ok = false; return {}; }
+			auto s = std::make_shared<Symbol>(bytes());
+			uint64_t n = varint();
+			// Each atom takes at least 2 bytes.
+			if (n > (in.size()-pos)/2) { ok = false; return {}; }
+			depth++;
+			while (n-- && ok) {
+				Atom a = atom();
+				if (Symbols::allowed(a)) s->atoms.push_back(std::move(a));
+				else ok = false;
+			}
+			depth--;
+			if (!ok) return {};
+			s->box = Symbols::bounds(s->atoms);
+			std::shared_ptr<const Symbol> shared = s;
+			if (interned) {
+				std::vector<uint8_t> key {};
+				Writer {key}.symbol(*s);
+				shared = interned->try_emplace(std::move(key), s).first->second;
+			}
+			symbols.push_back(shared);
+			return shared;
+		}
+
+		void points(std::vector<Point>& out) {
+			uint64_t n = varint();
+			// Each point takes at least 3 bytes.
+			if (n > (in.size()-pos)/3) { ok = false; return; }
+			out.reserve(n);
+			if (columns) {
+				out.resize(n);
+				auto column = [&](auto set) {
+					int64_t a = 0, b = 0;
+					for (Point& q : out) {
+						const int64_t v = zigzag() + (2*b - a);
+						set(q, v);
+						a = b, b = v;
+					}
+				};
+				column([](Point& q, int64_t v) { q.x = v; });
+				column([](Point& q, int64_t v) { q.y = v; });
+				column([](Point& q, int64_t v) { q.pressure = uint16_t(v) / float(0xffff); });
+				return;
+			}
+			Point prev {0, 0, 0};
+			while (n-- && ok) {
+				prev.x += zigzag();
+				prev.y += zigzag();
+				prev.pressure = varint() / float(0xffff);
+				out.push_back(prev);
+			}
+		}
+
+		void region(Fill& f) {
+			f.rule = u8() ? FillRule::NonZero : FillRule::EvenOdd;
+			uint64_t contours = varint();
+			if (contours > in.size()-pos) { ok = false; return; }
+			while (contours-- && ok) f.ends.push_back(varint());
+			uint64_t n = varint();
+			// Each point takes at least 2 bytes.
+			if (n > (in.size()-pos)/2) { ok = false; return; }
+			f.outline.reserve(n);
+			Point prev {0, 0, 1};
+			while (n-- && ok) {
+				prev.x += zigzag();
+				prev.y += zigzag();
+				f.outline.push_back(prev);
+			}
+		}
+
+		DocEdit edit() {
+			switch (u8()) {
+				case 0: return Edit::AppendAtom {atom()};
+				case 1: {
+					Point p {};
+					p.x = zigzag();
+					p.y = zigzag();
+					p.pressure = varint() / float(0xffff);
+					return Edit::ExtendStroke {p};
+				}
+				case 2: {
+					std::size_t first = varint();
+					return Edit::DeleteRange {first, varint()};
+				}
+				case 3: {
+					std::size_t index = varint();
+					return Edit::ReplaceAtom {index, atom()};
+				}
+				case 4: {
+					Edit::Splice e {varint(), varint(), {}};
+					uint64_t n = varint();
+					while (n-- && ok)
+						e.atoms.push_back(std::make_shared<Atom>(atom()));
+					return e;
+				}
+			}
+			ok = false;
+			return {};
+		}
+	};
+
+	// What a packed atom was, or nothing if it won't decode.
+	std::optional<Atom> unpack(const Packed& p) {
+		auto raw = LZ::decompress(p.bytes, p.size);
+		if (!raw) return {};
+		Reader r {*raw, true};
+		Atom a = r.atom();
+		if (!r.ok || !r.atEnd()) return {};
+		return a;
+	}
+
+	// For noticing torn or corrupted records. Folded down to
+	// the 32 bits records have room for, the low bits of fnv()
+	// alone being the weakest.
+	uint32_t checksum(std::span<const uint8_t> data) {
+		const uint64_t h = fnv(data.data(), data.size());
+		return uint32_t(h ^ h >> 32);
+	}
+};
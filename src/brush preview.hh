@@ -0,0 +1,71 @@
+#pragma once
+#include <span>
+#include <array>
+#include <algorithm>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include "math.hh"
+
+// The brush outline under the mouse, drawn straight onto the
+// window surface as a sprite. Whatever was under it is saved
+// first, so moving it only means putting those pixels back and
+// drawing it again somewhere else. Only the two little rects
+// need presenting, so hovering costs the same however big the
+// document is.
+class BrushPreview {
+	std::vector<uint32_t> under;
+	Rect at {0, 0, 0, 0}; // Where it's drawn now, empty if it isn't
+
+	// Puts back what was under the sprite.
+	void restore(std::span<uint32_t> px, unsigned W) {
+		const int w = at.x1 - at.x0;
+		for (int y=at.y0; y<at.y1; y++)
+			std::copy_n(&under[(y-at.y0)*w], w, &px[y*W + at.x0]);
+	}
+
+public:
+	uint32_t colour = 0;
+
+	// Moves the sprite. Returns the rects that changed, which
+	// is all that has to go to the screen.
+	std::array<Rect,2> move(std::span<uint32_t> px, unsigned W, unsigned H,
+	                        Vec2 centre, Real radius) {
+		const Rect old = at;
+		if (!at.empty()) restore(px, W);
+
+		const int r = std::ceil(radius) + 1;
+		at = Rect {
+			int(std::floor(centre.x)) - r, int(std::floor(centre.y)) - r,
+			int(std::floor(centre.x)) + r+1, int(std::floor(centre.y)) + r+1
+		} & Rect {0, 0, int(W), int(H)};
+		if (at.empty()) return {old, at};
+
+		const int w = at.x1 - at.x0;
+		under.resize(w * (at.y1 - at.y0));
+		for (int y=at.y0; y<at.y1; y++)
+			std::copy_n(&px[y*W + at.x0], w, &under[(y-at.y0)*w]);
+
+		// A one pixel ring.
+		for (int y=at.y0; y<at.y1; y++)
+		for (int x=at.x0; x<at.x1; x++) {
+			const Real d = std::hypot(x+Real(0.5) - centre.x, y+Real(0.5) - centre.y);
+			if (std::abs(d - radius) < Real(0.6)) px[y*W + x] = colour;
+		}
+		return {old, at};
+	}
+
+	// Takes the sprite off, for anything that wants to look
+	// at the surface without it. Returns where it was.
+	Rect hide(std::span<uint32_t> px, unsigned W) {
+		const Rect old = at;
+		if (!at.empty()) restore(px, W);
+		at = {0, 0, 0, 0};
+		return old;
+	}
+
+	// Call when the whole surface got overwritten by a new
+	// frame, so the saved pixels are stale. The next move()
+	// draws it back without restoring anything.
+	void frameReplaced() { at = {0, 0, 0, 0}; }
+};
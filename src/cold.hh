@@ -0,0 +1,195 @@
+#pragma once
+#include <vector>
+#include <optional>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <cstdint>
+#include "types.hh"
+#include "math.hh"
+#include "document.hh"
+#include "binary.hh"
+#include "lz.hh"
+
+// Cold storage. Strokes and curves far enough back in the
+// document that they're unlikely to be touched again get
+// swapped for Packed copies: delta and varint coded like the
+// journal (only a column at a time), then LZ compressed, which
+// is a fraction of the size. ColdStore sweeps through in the
+// background, readers that diff versions take a packed
+// atom as the one it came from (so nothing gets redrawn), and
+// drawing opens them up only as it needs to (see Thawed).
+// Anything off screen or already in a tile cache stays shut.
+namespace Cold
+{
+	constexpr std::size_t MinPoints = 16; // Fewer isn't worth it
+
+	uint64_t sum(std::span<const uint8_t> encoded) {
+		return fnv(encoded.data(), encoded.size());
+	}
+
+	// The packed copy of 'item', if it's worth packing.
+	std::optional<Packed> pack(const PVector<Atom>::Item& item) {
+		std::span<const Point> points {};
+		std::size_t bytes = 0;
+		unsigned diameter = 0;
+		if (auto* s = std::get_if<Stroke>(&*item))
+			points = s->points, diameter = s->diameter,
+			bytes = s->points.capacity()*sizeof(Point) + s->ends.capacity()*sizeof(uint32_t);
+		else if (auto* c = std::get_if<Curve>(&*item))
+			points = c->points, diameter = c->diameter, bytes = c->points.capacity()*sizeof(Point);
+		if (points.size() < MinPoints) return {};
+
+		std::vector<uint8_t> raw {};
+		Binary::Writer {raw, true}.atom(*item);
+		Packed p {LZ::compress(raw), uint32_t(raw.size())};
+		if (p.bytes.size() >= bytes) return {};
+		p.bytes.shrink_to_fit();
+		p.diameter = diameter;
+		p.was = item.get();
+		p.sum = sum(raw);
+		p.box = {INT16_MAX, INT16_MAX, INT16_MIN, INT16_MIN};
+		for (Point q : points) {
+			p.box[0] = std::min(p.box[0], q.x), p.box[1] = std::min(p.box[1], q.y);
+			p.box[2] = std::max(p.box[2], q.x), p.box[3] = std::max(p.box[3], q.y);
+		}
+		return p;
+	}
+
+	// What it was, or nothing if it won't decode.
+	std::optional<Atom> unpack(const Packed& p) { return Binary::unpack(p); }
+
+	// Whether 'now' is 'old', or a packed copy of it. 'old'
+	// has to still be alive, so nothing else can be where it
+	// is; the sum is for a packed copy of something that was
+	// there before it.
+	bool same(const Atom* old, const Atom* now) {
+		if (old == now) return true;
+		auto* p = std::get_if<Packed>(now);
+		if (!p || p->was != old) return false;
+		std::vector<uint8_t> raw {};
+		Binary::Writer {raw, true}.atom(*old);
+		return raw.size() == p->size && sum(raw) == p->sum;
+	}
+
+	// For PVector::mismatch().
+	struct Same {
+		bool operator()(const PVector<Atom>::Item& old, const PVector<Atom>::Item& now) const {
+			return same(old.get(), now.get());
+		}
+	};
+};
+
+// Sweeps through the document packing what's cold, a batch at
+// a time. The newest atoms are left alone, being the ones most
+// likely to be undone, cut or drawn on some more. Each sweep
+// carries on from where the last one got to, since what's
+// behind that has been packed already (or is newer than that,
+// having been edited, so isn't cold). Atoms that didn't get any
+// smaller are remembered, so they aren't tried again if the
+// sweep goes back over them.
+class ColdStore {
+	static constexpr std::size_t Keep = 64;
+	std::size_t next = 0;
+	// By address, the weak pointer telling if it's still that one.
+	std::unordered_map<const Atom*, std::weak_ptr<const Atom>> tried;
+
+	bool wasTried(const PVector<Atom>::Item& item) {
+		auto it = tried.find(item.get());
+		if (it == tried.end()) return false;
+		if (it->second.lock() == item) return true;
+		tried.erase(it);
+		return false;
+	}
+
+public:
+	static constexpr std::size_t Batch = 64;
+
+	// Returns whether there's more of this sweep to go. Packed
+	// atoms only get to readers with the next publish (see
+	// Document::reseat), or settle().
+	bool step(Document& doc, std::size_t n = Batch) {
+		const PVector<Atom>& atoms = doc.latest().atoms;
+		const std::size_t end = atoms.size() > Keep ? atoms.size()-Keep : 0;
+		next = std::min(next, end); // Things got deleted
+		for (; next < end && n; next++, n--) {
+			const PVector<Atom>::Item item = atoms.item(next);
+			if (std::holds_alternative<Packed>(*item) || wasTried(item)) continue;
+			if (auto p = Cold::pack(item))
+				doc.reseat(next, std::make_shared<Atom>(std::move(*p)));
+			else
+				tried.emplace(item.get(), item);
+		}
+		if (next < end) return true;
+		std::erase_if(tried, [](const auto& kv) { return kv.second.expired(); });
+		return false;
+	}
+};
+
+// Packed atoms opened up for drawing. The ones drawn last are
+// kept, up to a budget, so drawing them again (every frame of
+// a zoom, say) doesn't mean opening them again. There's one for
+// every renderer (see shared()), on whichever thread, so they
+// don't each keep their own copies.
+class Thawed {
+	static constexpr std::size_t Budget = 4<<20;
+
+	struct Entry { std::shared_ptr<const Atom> atom; std::size_t bytes; uint64_t used; };
+	std::mutex m;
+	std::unordered_map<uint64_t, Entry> entries;
+	std::size_t bytes = 0;
+	uint64_t clock = 0;
+
+	static std::size_t cost(const Atom& a) {
+		std::size_t n = sizeof(Entry);
+		if (auto* s = std::get_if<Stroke>(&a)) n += s->points.capacity()*sizeof(Point);
+		if (auto* c = std::get_if<Curve>(&a))  n += c->points.capacity()*sizeof(Point);
+		return n;
+	}
+
+	// Drops the half that went longest without being used.
+	void shrink() {
+		std::vector<uint64_t> stamps {};
+		for (auto& [k, e] : entries) stamps.push_back(e.used);
+		auto mid = stamps.begin() + stamps.size()/2;
+		std::nth_element(stamps.begin(), mid, stamps.end());
+		std::erase_if(entries, [&](auto& kv) {
+			if (kv.second.used >= *mid) return false;
+			bytes -= kv.second.bytes;
+			return true;
+		});
+	}
+
+public:
+	static Thawed& shared() {
+		static Thawed t {};
+		return t;
+	}
+
+	// Null if it won't decode. Opened outside the lock, so two
+	// threads might both open the same one, once.
+	std::shared_ptr<const Atom> get(const Packed& p) {
+		const uint64_t k = fnv(p.bytes.data(), p.bytes.size(), p.sum);
+		{
+			std::lock_guard lock {m};
+			if (auto it = entries.find(k); it != entries.end()) {
+				it->second.used = ++clock;
+				return it->second.atom;
+			}
+		}
+		auto a = Cold::unpack(p);
+		if (!a) return nullptr;
+		auto atom = std::make_shared<const Atom>(std::move(*a));
+		const std::size_t n = cost(*atom);
+		std::lock_guard lock {m};
+		if (bytes + n > Budget && !entries.empty()) shrink();
+		if (entries.try_emplace(k, Entry {atom, n, ++clock}).second) bytes += n;
+		return atom;
+	}
+
+	void clear() {
+		std::lock_guard lock {m};
+		entries.clear(), bytes = 0;
+	}
+};
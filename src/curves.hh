@@ -0,0 +1,283 @@
+#pragma once
+#include <array>
+#include <vector>
+#include <span>
+#include <optional>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include "types.hh"
+#include "math.hh"
+
+// Fitting strokes with cubic Béziers, and turning them back
+// into lines for drawing.
+//
+// Fitting is Schneider's ("An Algorithm for Automatically
+// Fitting Digitized Curves", Graphics Gems, 1990): one cubic
+// is fitted to all the points by least squares, with its ends
+// on the first and last point and leaving along the stroke.
+// If it isn't close enough it gets a few goes at refitting
+// with better parameters (Newton's method), and otherwise the
+// points are split where it was furthest off and each half is
+// fitted the same way. Sharp corners are split at up front so
+// they stay sharp.
+namespace Curves
+{
+	using Cubic = std::array<Vec2,4>;
+
+	Vec2 add(Vec2 a, Vec2 b)  { return {a.x+b.x, a.y+b.y}; }
+	Vec2 sub(Vec2 a, Vec2 b)  { return {a.x-b.x, a.y-b.y}; }
+	Vec2 mul(Vec2 a, Real k)  { return {a.x*k, a.y*k}; }
+	Vec2 vec(Point p)         { return {Real(p.x), Real(p.y)}; }
+
+	Vec2 at(const Cubic& c, Real t) {
+		const Real s = 1-t;
+		const Real b0 = s*s*s, b1 = 3*s*s*t, b2 = 3*s*t*t, b3 = t*t*t;
+		return {b0*c[0].x + b1*c[1].x + b2*c[2].x + b3*c[3].x,
+		        b0*c[0].y + b1*c[1].y + b2*c[2].y + b3*c[3].y};
+	}
+
+	// Sharper than this (between where a stroke comes in and
+	// where it goes out) is a corner.
+	constexpr Real CornerCos = 0.5; // 60°
+	constexpr Real Spacing = 4;      // Pixels
+
+	// Parameters for the points from how far along they are.
+	void chordLengths(std::span<const Vec2> d, std::vector<Real>& u) {
+		u.assign(d.size(), 0);
+		for (std::size_t i=1; i<d.size(); i++) u[i] = u[i-1] + len(sub(d[i], d[i-1]));
+		for (Real& t : u) t /= u.back();
+	}
+
+	// Least squares for how far out along the end tangents the
+	// middle control points go.
+	Cubic generate(std::span<const Vec2> d, std::span<const Real> u, Vec2 t1, Vec2 t2) {
+		const Vec2 first = d.front(), last = d.back();
+		Real c00 = 0, c01 = 0, c11 = 0, x0 = 0, x1 = 0;
+		for (std::size_t i=0; i<d.size(); i++) {
+			const Real t = u[i], s = 1-t;
+			const Vec2 a1 = mul(t1, 3*s*s*t), a2 = mul(t2, 3*s*t*t);
+			c00 += dot(a1, a1), c01 += dot(a1, a2), c11 += dot(a2, a2);
+			const Vec2 tmp = sub(d[i], add(mul(first, s*s*s + 3*s*s*t), mul(last, 3*s*t*t + t*t*t)));
+			x0 += dot(a1, tmp), x1 += dot(a2, tmp);
+		}
+		const Real det = c00*c11 - c01*c01;
+		Real alpha1 = det != 0 ? (x0*c11 - x1*c01) / det : 0;
+		Real alpha2 = det != 0 ? (c00*x1 - c01*x0) / det : 0;
+		// Falls back on a third of the way along when that's
+		// no good, which is what a straight line would have.
+		const Real span = len(sub(last, first)), eps = Real(1e-6) * span;
+		if (alpha1 < eps || alpha2 < eps) alpha1 = alpha2 = span / 3;
+		return {first, add(first, mul(t1, alpha1)), add(last, mul(t2, alpha2)), last};
+	}
+
+	// How far off it is, squared, and where that is.
+	std::pair<Real,std::size_t> maxError(std::span<const Vec2> d, std::span<const Real> u, const Cubic& c) {
+		Real worst = 0;
+		std::size_t split = d.size() / 2;
+		for (std::size_t i=1; i+1<d.size(); i++)
+			if (const Real e = dot2(sub(at(c, u[i]), d[i])); e >= worst)
+				worst = e, split = i;
+		return {worst, split};
+	}
+
+	// One Newton step on each parameter, towards the point on
+	// the curve nearest the one it's for.
+	void reparameterize(std::span<const Vec2> d, std::vector<Real>& u, const Cubic& c) {
+		const std::array<Vec2,3> q1 {mul(sub(c[1], c[0]), 3), mul(sub(c[2], c[1]), 3), mul(sub(c[3], c[2]), 3)};
+		const std::array<Vec2,2> q2 {mul(sub(q1[1], q1[0]), 2), mul(sub(q1[2], q1[1]), 2)};
+		for (std::size_t i=0; i<d.size(); i++) {
+			const Real t = u[i], s = 1-t;
+			const Vec2 p  = sub(at(c, t), d[i]);
+			const Vec2 d1 = add(add(mul(q1[0], s*s), mul(q1[1], 2*s*t)), mul(q1[2], t*t));
+			const Vec2 d2 = add(mul(q2[0], s), mul(q2[1], t));
+			const Real den = dot2(d1) + dot(p, d2);
+			if (den != 0) u[i] = std::clamp(t - dot(p, d1) / den, Real(0), Real(1));
+		}
+	}
+
+	void fitCubic(std::span<const Vec2> d, Vec2 t1, Vec2 t2, Real error2, std::vector<Cubic>& out) {
+		if (d.size() == 2) {
+			const Real third = len(sub(d[1], d[0])) / 3;
+			out.push_back({d[0], add(d[0], mul(t1, third)), add(d[1], mul(t2, third)), d[1]});
+			return;
+		}
+		std::vector<Real> u {};
+		chordLengths(d, u);
+		Cubic c = generate(d, u, t1, t2);
+		auto [worst, split] = maxError(d, u, c);
+		// Close, so it's worth trying to get closer.
+		for (int i=0; i<4 && worst >= error2 && worst < 4*error2; i++) {
+			reparameterize(d, u, c);
+			c = generate(d, u, t1, t2);
+			std::tie(worst, split) = maxError(d, u, c);
+		}
+		if (worst < error2) {
+			out.push_back(c);
+			return;
+		}
+		const Vec2 across = sub(d[split-1], d[split+1]);
+		const Vec2 centre = dot2(across) > 0 ? norm(across) : norm(sub(d[split-1], d[split]));
+		fitCubic(d.subspan(0, split+1), t1, centre, error2, out);
+		fitCubic(d.subspan(split), mul(centre, -1), t2, error2, out);
+	}
+
+	// The stroke as a curve, as long as that's fewer points.
+	// Cut strokes (in more than one piece) stay as they are.
+	std::optional<Curve> fit(const Stroke& s, Real tolerance) {
+		if (!s.ends.empty()) return {};
+		// Samples were whole pixels, and so are control points,
+		// so there's no getting closer than a pixel anyway.
+		tolerance = std::max(tolerance, Real(1));
+		std::vector<Vec2> d {};
+		std::vector<float> pressure {};
+		for (Point p : s.points) {
+			if (!d.empty() && d.back().x == p.x && d.back().y == p.y) continue;
+			// Only points are checked against the curve, so long
+			// lines get some along them too, or it could wander
+			// off between the ends.
+			if (!d.empty()) {
+				const Vec2 from = d.back();
+				const float p0 = pressure.back();
+				const int n = len(sub(vec(p), from)) / Spacing;
+				for (int k=1; k<n; k++) {
+					const Real t = Real(k) / n;
+					d.push_back(add(from, mul(sub(vec(p), from), t)));
+					pressure.push_back(p0 + (p.pressure-p0) * t);
+				}
+			}
+			d.push_back(vec(p)), pressure.push_back(p.pressure);
+		}
+		if (d.size() < 3) return {};
+
+		Curve curve {s.diameter, {}, s.colour, s.alpha};
+		auto point = [&](Vec2 v, float p) {
+			curve.points.push_back({int16_t(std::lround(v.x)), int16_t(std::lround(v.y)), p});
+		};
+		point(d[0], pressure[0]);
+		std::vector<Cubic> cubics {};
+		for (std::size_t first=0; first+1<d.size(); ) {
+			// Runs between corners are fitted on their own.
+			std::size_t last = first+1;
+			for (; last+1<d.size(); last++) {
+				const Vec2 in = norm(sub(d[last], d[last-1])), out = norm(sub(d[last+1], d[last]));
+				if (dot(in, out) < CornerCos) break;
+			}
+			const auto run = std::span {d}.subspan(first, last-first+1);
+			cubics.clear();
+			fitCubic(run, norm(sub(run[1], run[0])), norm(sub(run[run.size()-2], run.back())),
+			         tolerance*tolerance, cubics);
+			// Pressure goes evenly from one end of each to the other.
+			const float p0 = pressure[first], p1 = pressure[last];
+			for (std::size_t i=0; i<cubics.size(); i++) {
+				const float a = p0 + (p1-p0) * i / cubics.size(), b = p0 + (p1-p0) * (i+1) / cubics.size();
+				point(cubics[i][1], a + (b-a)/3);
+				point(cubics[i][2], a + (b-a)*2/3);
+				point(cubics[i][3], b);
+			}
+			first = last;
+		}
+		if (curve.points.size() >= s.points.size()) return {};
+		return curve;
+	}
+
+	// Calls f(point) along the curve, close enough that no line
+	// between them is more than 'tolerance' off it. How many
+	// each cubic gets comes from how much it bends (Wang's
+	// formula), so flat ones are a single line. If f takes a
+	// pressure too, it gets that, from the control points'.
+	template <typename F>
+	void flatten(std::span<const Point> p, Real tolerance, F f) {
+		auto out = [&](Vec2 v, float pressure) {
+			if constexpr (std::is_invocable_v<F, Vec2, float>) f(v, pressure);
+			else f(v);
+		};
+		if (p.empty()) return;
+		out(vec(p[0]), p[0].pressure);
+		for (std::size_t i=0; i+3<p.size(); i+=3) {
+			const Cubic c {vec(p[i]), vec(p[i+1]), vec(p[i+2]), vec(p[i+3])};
+			const Real bend = std::max(len(add(sub(c[0], mul(c[1], 2)), c[2])),
+			                           len(add(sub(c[1], mul(c[2], 2)), c[3])));
+			const int n = std::clamp<int>(std::ceil(std::sqrt(Real(0.75) * bend / tolerance)), 1, 1024);
+			for (int k=1; k<=n; k++) {
+				const Real t = Real(k) / n, u = 1-t;
+				out(at(c, t), u*u*u*p[i].pressure + 3*u*u*t*p[i+1].pressure
+				            + 3*u*t*t*p[i+2].pressure + t*t*t*p[i+3].pressure);
+			}
+		}
+	}
+
+	// As a stroke, in whole pixels, keeping the pressure. Always
+	// comes out the same for the same curve.
+	Stroke toStroke(const Curve& c, Real tolerance) {
+		Stroke s {c.diameter, {}, c.colour, c.alpha};
+		flatten(c.points, tolerance, [&](Vec2 v, float pressure) {
+			const Point q {int16_t(std::lround(v.x)), int16_t(std::lround(v.y)), pressure};
+			if (s.points.empty() || s.points.back().x != q.x || s.points.back().y != q.y)
+				s.points.push_back(q);
+		});
+		return s;
+	}
+
+	// Whether 'now' is only 'old' fitted to a curve, which
+	// looks the same (to within the fitting tolerance).
+	bool refits(const Atom& old, const Atom& now) {
+		auto* s = std::get_if<Stroke>(&old);
+		auto* c = std::get_if<Curve>(&now);
+		return s && c && s->colour == c->colour && s->alpha == c->alpha
+		    && !s->points.empty() && !c->points.empty()
+		    && s->points.front().x == c->points.front().x && s->points.front().y == c->points.front().y;
+	}
+};
+
+// Curves flattened for drawing, kept per curve and zoom level.
+// Zoom levels are half an octave apart, and each is flattened
+// for the most zoomed in end of its range. When there are too
+// many points kept, the curves that went longest without being
+// drawn go first.
+class FlatCurves {
+	static constexpr std::size_t Cap = 1 << 20; // Points
+	static constexpr Real Tolerance = 0.25;     // Screen pixels
+
+	struct Entry { std::vector<Vec2> points; uint64_t used; };
+	std::unordered_map<uint64_t, Entry> entries;
+	std::size_t total = 0;
+	uint64_t clock = 0;
+
+	void evict() {
+		std::vector<std::pair<uint64_t,uint64_t>> order {}; // used, key
+		for (auto& [k, e] : entries) order.push_back({e.used, k});
+		ranges::sort(order);
+		for (auto [used, k] : order) {
+			if (total <= Cap/2) break;
+			auto it = entries.find(k);
+			total -= it->second.points.size();
+			entries.erase(it);
+		}
+	}
+
+public:
+	static int level(Real zoom) { return std::floor(std::log2(zoom) * 2); }
+
+	// The curve as points in document space.
+	const std::vector<Vec2>& get(const Curve& c, Real zoom) {
+		const int z = level(zoom);
+		uint64_t key = fnv(&z, sizeof z);
+		for (Point p : c.points) key = fnv(&p.x, sizeof p.x, fnv(&p.y, sizeof p.y, key));
+		if (auto it = entries.find(key); it != entries.end()) {
+			it->second.used = ++clock;
+			return it->second.points;
+		}
+		if (total > Cap) evict();
+		Entry& e = entries[key];
+		e.used = ++clock;
+		Curves::flatten(c.points, Tolerance / std::exp2((z+1) / Real(2)), [&](Vec2 v) { e.points.push_back(v); });
+		total += e.points.size();
+		return e.points;
+	}
+
+	std::size_t size() const { return total; }
+	void clear() { entries.clear(), total = 0; }
+};
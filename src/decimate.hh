@@ -0,0 +1,105 @@
+#pragma once
+#include <cmath>
+#include <optional>
+#include <numbers>
+#include "types.hh"
+#include "math.hh"
+
+// Drops pen samples as they come in, as long as the straight
+// line through the ones that are kept stays within 'tolerance'
+// of every sample dropped along the way.
+//
+// From the last kept point (the anchor) every dropped sample
+// narrows down which directions the next segment can leave in
+// and still pass close enough to it. A sample outside that
+// wedge can't be reached in one straight segment, so the one
+// before it gets kept and becomes the new anchor. Pressure
+// works the same way, as a range of slopes along the segment.
+// Each sample only touches the wedge, so it's O(1) per sample.
+//
+// Samples that aren't kept yet still show up on screen, since
+// the render thread draws the provisional tail up to the pen.
+class Decimator {
+	static constexpr Real Pi = std::numbers::pi_v<Real>;
+
+	Point anchor {}, last {};
+	bool  pending = false; // 'last' was dropped so far
+
+	bool constrained = false;
+	Real base = 0;         // Wedge angles are relative to this
+	Real lo = 0, hi = 0;   // Directions the segment can take
+	Real plo = 0, phi = 0; // Pressure per unit length
+	Real reach = 0;        // Furthest any sample got from the anchor
+
+	// Heavier strokes are drawn wider, which hides more.
+	Real toleranceAt(Point p) const {
+		return tolerance * (Real(0.5) + std::clamp(p.pressure, 0.f, 1.f));
+	}
+
+	bool fits(Point p) const {
+		const Real dx = p.x - anchor.x, dy = p.y - anchor.y;
+		const Real r = std::sqrt(dx*dx + dy*dy);
+		if (r < reach - toleranceAt(p)) return false; // Doubled back
+		if (!constrained) return true;
+		const Real a = std::remainder(std::atan2(dy, dx) - base, 2*Pi);
+		const Real slope = (p.pressure - anchor.pressure) / std::max(r, Real(1));
+		return lo <= a && a <= hi && plo <= slope && slope <= phi;
+	}
+
+	void narrow(Point p) {
+		const Real dx = p.x - anchor.x, dy = p.y - anchor.y;
+		const Real r = std::sqrt(dx*dx + dy*dy);
+		const Real tol = toleranceAt(p);
+		reach = std::max(reach, r);
+		if (r <= tol) return; // Any direction passes close enough
+
+		const Real a = std::atan2(dy, dx);
+		const Real spread = std::asin(tol / r);
+		const Real dp = (p.pressure - anchor.pressure) / std::max(r, Real(1));
+		const Real ds = pressureTolerance / std::max(r, Real(1));
+		if (!constrained) {
+			base = a;
+			lo = -spread, hi = spread;
+			plo = dp - ds, phi = dp + ds;
+			constrained = true;
+			return;
+		}
+		const Real rel = std::remainder(a - base, 2*Pi);
+		lo  = std::max(lo,  rel - spread), hi  = std::min(hi,  rel + spread);
+		plo = std::max(plo, dp - ds),      phi = std::min(phi, dp + ds);
+	}
+
+	void restart(Point p) {
+		anchor = p;
+		pending = constrained = false;
+		reach = 0;
+	}
+
+public:
+	Real tolerance = 0.5;          // Document units, at half pressure
+	Real pressureTolerance = 0.05;
+
+	// Call with the stroke's first point, which is always kept.
+	void begin(Point p) { restart(p); }
+
+	// Returns a point to append to the stroke, if one's
+	// settled now. It's always an earlier sample, never 'p'.
+	std::optional<Point> add(Point p) {
+		std::optional<Point> kept {};
+		if (!fits(p)) {
+			if (pending) kept = last;
+			restart(pending ? last : anchor);
+		}
+		narrow(p);
+		last = p, pending = true;
+		return kept;
+	}
+
+	// The pen's up, so the last sample has to be kept.
+	std::optional<Point> end() {
+		std::optional<Point> kept {};
+		if (pending) kept = last;
+		restart(last);
+		return kept;
+	}
+};
@@ -0,0 +1,482 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <variant>
+#include <iterator>
+#include <functional>
+#include <span>
+#include <cstdint>
+#include "types.hh"
+#include "mask.hh"
+
+// Persistent (immutable) vector. Every "modification" returns
+// a new vector sharing all untouched chunks with the old one,
+// so keeping old versions around only costs what changed.
+// It's a 32-way trie: leaves hold 32 items, branches 32 kids.
+template <typename T>
+class PVector {
+	static constexpr unsigned    Bits  = 5;
+	static constexpr std::size_t Width = 1 << Bits;
+	static constexpr std::size_t Mask  = Width-1;
+
+public:
+	using Item = std::shared_ptr<const T>;
+
+private:
+	using Node = std::shared_ptr<const void>;
+	struct Leaf   { std::array<Item,Width> items; };
+	struct Branch { std::array<Node,Width> kids;  };
+
+	Node        root;
+	unsigned    shift = 0; // Bits consumed above the leaves
+	std::size_t count = 0;
+
+	template <typename N>
+	static const N& as(const Node& n) { return *static_cast<const N*>(n.get()); }
+
+	// Copies the path down to index 'i' and puts 'item'
+	// there, creating any nodes that don't exist yet.
+	static Node assoc(const Node& n, unsigned shift, std::size_t i, Item item) {
+		if (shift == 0) {
+			auto leaf = n ? std::make_shared<Leaf>(as<Leaf>(n))
+			              : std::make_shared<Leaf>();
+			leaf->items[i & Mask] = std::move(item);
+			return leaf;
+		}
+		auto branch = n ? std::make_shared<Branch>(as<Branch>(n))
+		                : std::make_shared<Branch>();
+		auto& kid = branch->kids[(i >> shift) & Mask];
+		kid = assoc(kid, shift-Bits, i, std::move(item));
+		return branch;
+	}
+
+	// Copies the path down to index 'last' and drops
+	// everything to the right of it.
+	static Node trim(const Node& n, unsigned shift, std::size_t last) {
+		const std::size_t k = (last >> shift) & Mask;
+		if (shift == 0) {
+			auto leaf = std::make_shared<Leaf>(as<Leaf>(n));
+			for (std::size_t j=k+1; j<Width; j++) leaf->items[j] = {};
+			return leaf;
+		}
+		auto branch = std::make_shared<Branch>(as<Branch>(n));
+		for (std::size_t j=k+1; j<Width; j++) branch->kids[j] = {};
+		branch->kids[k] = trim(branch->kids[k], shift-Bits, last);
+		return branch;
+	}
+
+	// Like assoc(), but puts in a whole leaf, 'i' being the
+	// index of its first item.
+	static Node graft(const Node& n, unsigned shift, std::size_t i, Node leaf) {
+		if (shift == 0) return leaf;
+		auto branch = n ? std::make_shared<Branch>(as<Branch>(n))
+		                : std::make_shared<Branch>();
+		auto& kid = branch->kids[(i >> shift) & Mask];
+		kid = graft(kid, shift-Bits, i, std::move(leaf));
+		return branch;
+	}
+
+	// Grows the tree by one level if the root is full.
+	void makeRoom() {
+		if (root && count == (Width << shift)) {
+			auto branch = std::make_shared<Branch>();
+			branch->kids[0] = root;
+			root = branch;
+			shift += Bits;
+		}
+	}
+
+	template <typename F>
+	static void walk(const Node& n, unsigned shift, std::size_t& left, F& f) {
+		if (shift == 0) {
+			for (const Item& item : as<Leaf>(n).items) {
+				if (!left) return;
+				f(*item), --left;
+			}
+			return;
+		}
+		for (const Node& kid : as<Branch>(n).kids) {
+			if (!left) return;
+			walk(kid, shift-Bits, left, f);
+		}
+	}
+
+	// Index of the first difference under 'a' and 'b', which
+	// cover the same indices from 'base'. Shared subtrees are
+	// skipped without looking inside them. Items that aren't
+	// the same object can still count as the same by 'same'.
+	template <typename F>
+	static std::size_t diff(const Node& a, const Node& b, unsigned shift,
+	                        std::size_t base, std::size_t n, F& same) {
+		if (a == b || base >= n) return n;
+		if (!a || !b) return base;
+		if (shift == 0) {
+			auto& x = as<Leaf>(a).items;
+			auto& y = as<Leaf>(b).items;
+			for (std::size_t j=0; j<Width && base+j<n; j++)
+				if (x[j] != y[j] && !same(x[j], y[j])) return base+j;
+			return n;
+		}
+		for (std::size_t j=0; j<Width; j++) {
+			std::size_t d = diff(as<Branch>(a).kids[j], as<Branch>(b).kids[j],
+			                     shift-Bits, base + (j << shift), n, same);
+			if (d < n) return d;
+		}
+		return n;
+	}
+
+	const Leaf& leafFor(std::size_t i) const {
+		const Node* n = &root;
+		for (unsigned s=shift; s>0; s-=Bits)
+			n = &as<Branch>(*n).kids[(i >> s) & Mask];
+		return as<Leaf>(*n);
+	}
+
+public:
+	std::size_t size () const { return count; }
+	bool        empty() const { return count == 0; }
+
+	const Item& item(std::size_t i) const {
+		assert(i < count);
+		return leafFor(i).items[i & Mask];
+	}
+	const T& operator[](std::size_t i) const { return *item(i); }
+	const T& back() const { return (*this)[count-1]; }
+
+	PVector push_back(Item x) const {
+		PVector result = *this;
+		result.makeRoom();
+		result.root = assoc(result.root, result.shift, count, std::move(x));
+		result.count++;
+		return result;
+	}
+	PVector push_back(T x) const {
+		return push_back(Item {std::make_shared<T>(std::move(x))});
+	}
+
+	PVector set(std::size_t i, Item x) const {
+		assert(i < count);
+		PVector result = *this;
+		result.root = assoc(root, shift, i, std::move(x));
+		return result;
+	}
+	PVector set(std::size_t i, T x) const {
+		return set(i, Item {std::make_shared<T>(std::move(x))});
+	}
+
+	// The first 'n' items.
+	PVector take(std::size_t n) const {
+		if (n >= count) return *this;
+		PVector result {};
+		if (n == 0) return result;
+		result.root  = root;
+		result.shift = shift;
+		while (result.shift > 0 && n <= (Width << (result.shift-Bits))) {
+			result.root = as<Branch>(result.root).kids[0];
+			result.shift -= Bits;
+		}
+		result.root  = trim(result.root, result.shift, n-1);
+		result.count = n;
+		return result;
+	}
+
+	// Replaces [first,last) with 'items'. If that's as many as
+	// were there it only copies the paths down to them. If not,
+	// everything after 'last' moves and has to be put back, so
+	// it's only cheap near the end. That's done a leaf at a
+	// time though, and only the pointers are copied, never the
+	// items themselves.
+	PVector splice(std::size_t first, std::size_t last,
+	               std::span<const Item> items) const {
+		assert(first <= last && last <= count);
+		if (items.size() == last-first) {
+			PVector result = *this;
+			for (std::size_t i=0; i<items.size(); i++)
+				result.root = assoc(result.root, shift, first+i, items[i]);
+			return result;
+		}
+		PVector result = take(first);
+		const std::size_t k = items.size(), n = count - (last-first) + k;
+		auto at = [&](std::size_t j) -> const Item& {
+			return j < first+k ? items[j-first] : item(j-first-k + last);
+		};
+		// Up to where a leaf starts one by one, then whole leaves.
+		std::size_t j = first;
+		for (; j < n && (j & Mask); j++) result = result.push_back(at(j));
+		for (; j < n; j += Width) {
+			auto leaf = std::make_shared<Leaf>();
+			for (std::size_t i=0; i<Width && j+i<n; i++) leaf->items[i] = at(j+i);
+			result.makeRoom();
+			result.root  = graft(result.root, result.shift, j, std::move(leaf));
+			result.count = std::min(n, j+Width);
+		}
+		return result;
+	}
+	PVector erase(std::size_t first, std::size_t last) const {
+		return splice(first, last, {});
+	}
+
+	// First index where the two differ (by identity, not
+	// value), or the shorter size if one is a prefix of the
+	// other. Cheap when they're versions of the same vector.
+	// 'same(mine, theirs)' can say items that aren't identical
+	// are as good as (see Cold::same).
+	template <typename F>
+	std::size_t mismatch(const PVector& o, F same) const {
+		const std::size_t n = std::min(count, o.count);
+		if (shift != o.shift) {
+			for (std::size_t i=0; i<n; i++)
+				if (item(i) != o.item(i) && !same(item(i), o.item(i))) return i;
+			return n;
+		}
+		return diff(root, o.root, shift, 0, n, same);
+	}
+	std::size_t mismatch(const PVector& o) const {
+		return mismatch(o, [](const Item&, const Item&) { return false; });
+	}
+
+	// Faster than iterating, since it doesn't
+	// walk down from the root for every leaf.
+	template <typename F>
+	void forEach(F f) const {
+		std::size_t left = count;
+		if (root) walk(root, shift, left, f);
+	}
+
+	class iterator {
+		const PVector* v = nullptr;
+		const Leaf*    leaf = nullptr;
+		std::size_t    i = 0;
+	public:
+		using value_type      = T;
+		using difference_type = std::ptrdiff_t;
+
+		iterator() = default;
+		iterator(const PVector* v, std::size_t i) : v{v}, i{i} {
+			if (i < v->count) leaf = &v->leafFor(i);
+		}
+		const T& operator*() const { return *leaf->items[i & Mask]; }
+		const T* operator->() const { return &**this; }
+		iterator& operator++() {
+			if ((++i & Mask) == 0 && i < v->count) leaf = &v->leafFor(i);
+			return *this;
+		}
+		iterator operator++(int) { auto old = *this; ++*this; return old; }
+		bool operator==(const iterator& o) const { return i == o.i; }
+		std::size_t index() const { return i; }
+	};
+	iterator begin() const { return {this, 0}; }
+	iterator end  () const { return {this, count}; }
+};
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+// Ways the document can change.
+namespace Edit
+{
+	struct AppendAtom  { Atom atom; };
+	struct ExtendStroke{ Point point; };  // Onto the last atom (or eraser, in its mask's pixels)
+	struct DeleteRange { std::size_t first, last; };
+	struct ReplaceAtom { std::size_t index; Atom atom; };
+	// Swaps [first,last) for atoms that already exist
+	// elsewhere (e.g. in the undo history) without copying.
+	struct Splice {
+		std::size_t first, last;
+		std::vector<PVector<Atom>::Item> atoms;
+	};
+};
+using DocEdit = std::variant<
+	Edit::AppendAtom, Edit::ExtendStroke,
+	Edit::DeleteRange, Edit::ReplaceAtom,
+	Edit::Splice
+>;
+
+// A read-only view of the document at some version.
+// Cheap to copy, and stays valid however long it's held.
+struct Snapshot {
+	PVector<Atom> atoms;
+	uint64_t      version = 0;
+};
+
+// One writer (the main thread) edits a draft and publishes it.
+// Any number of readers grab the latest published snapshot
+// without ever blocking the writer or each other.
+//
+// Published versions are freed with epoch based reclamation:
+// a reader announces the epoch it's reading in, and a retired
+// version is only deleted once every reader has moved past
+// the epoch it was retired in.
+class Document {
+	static constexpr std::size_t MaxReaders = 16;
+
+	struct Version { Snapshot snap; };
+
+	std::atomic<const Version*> current;
+	std::atomic<uint64_t>       epoch {1};
+
+	// 0 means the slot's reader isn't reading right now.
+	std::array<std::atomic<uint64_t>,MaxReaders> active {};
+	std::array<std::atomic<bool>    ,MaxReaders> taken  {};
+
+	// Writer only:
+	Snapshot draft;
+	bool     changed = false;
+	bool     reseated = false;    // Only reseat()s since the last publish
+	bool     lastPrivate = false; // Last atom not published yet
+	std::vector<std::pair<const Version*,uint64_t>> retired;
+
+	// Hands the draft over to readers.
+	void swapIn() {
+		const Version* old = current.exchange(
+			new Version {draft}, std::memory_order_seq_cst
+		);
+		retired.push_back({old, epoch.fetch_add(1, std::memory_order_seq_cst)});
+		collect();
+	}
+
+	void collect() {
+		uint64_t oldest = UINT64_MAX;
+		for (auto& a : active)
+			if (uint64_t e = a.load(std::memory_order_seq_cst))
+				oldest = std::min(oldest, e);
+		std::erase_if(retired, [&](auto& r) {
+			if (r.second >= oldest) return false;
+			delete r.first;
+			return true;
+		});
+	}
+
+	// Lets us append points to the stroke being drawn without
+	// copying it every sample. The stroke is only copied once
+	// per publish, since until then no reader can see it.
+	// (Items are always allocated non-const, see PVector.)
+	Atom& lastAtom() {
+		const std::size_t i = draft.atoms.size()-1;
+		if (!lastPrivate) {
+			draft.atoms = draft.atoms.set(i, Atom {draft.atoms[i]});
+			lastPrivate = true;
+		}
+		return const_cast<Atom&>(draft.atoms[i]);
+	}
+
+public:
+	Document() : current{new Version {}} {}
+	~Document() {
+		for (auto& r : retired) delete r.first;
+		delete current.load();
+	}
+	Document(const Document&) = delete;
+	Document& operator=(const Document&) = delete;
+
+	/* WRITER */
+
+	const Snapshot& latest() const { return draft; }
+
+	// What readers see right now. Unlike the draft this is
+	// safe to hand to other threads, since nothing in it is
+	// ever changed in place.
+	const Snapshot& published() const { return current.load()->snap; }
+
+	// Told about every edit (before it's applied) and every
+	// version (before readers can see it). For the journal.
+	std::function<void(const DocEdit&)> onEdit;
+	std::function<void(uint64_t)>       onPublish;
+
+	void apply(DocEdit e) {
+		if (onEdit) onEdit(e);
+		std::visit(Overloaded {
+			[&](Edit::AppendAtom& e) {
+				draft.atoms = draft.atoms.push_back(std::move(e.atom));
+				lastPrivate = true;
+			},
+			[&](Edit::ExtendStroke& e) {
+				if (draft.atoms.empty()) return;
+				if (auto* s = std::get_if<Stroke>(&lastAtom()))
+					s->points.push_back(e.point);
+				else if (auto* r = std::get_if<Eraser>(&lastAtom()))
+					Masks::extend(*r, e.point);
+			},
+			[&](Edit::DeleteRange& e) {
+				draft.atoms = draft.atoms.erase(e.first, e.last);
+				lastPrivate = false;
+			},
+			[&](Edit::ReplaceAtom& e) {
+				draft.atoms = draft.atoms.set(e.index, std::move(e.atom));
+				lastPrivate |= e.index+1 == draft.atoms.size();
+			},
+			[&](Edit::Splice& e) {
+				draft.atoms = draft.atoms.splice(e.first, e.last, e.atoms);
+				lastPrivate = false;
+			}
+		}, e);
+		changed = true;
+	}
+
+	// Swaps atom i for another copy of the same thing, only
+	// kept differently (packed, see Cold). That's not an edit,
+	// so neither the journal nor the history hear about it, it
+	// doesn't make a new version, and readers see it's still
+	// the same atom. It goes out with the next publish, or
+	// settle() if there isn't one.
+	void reseat(std::size_t i, PVector<Atom>::Item item) {
+		draft.atoms = draft.atoms.set(i, std::move(item));
+		lastPrivate &= i+1 != draft.atoms.size();
+		reseated = true;
+	}
+
+	// Lets readers have what's been reseated, as the version
+	// they've got already, if there's nothing else new. Returns
+	// whether there was anything.
+	bool settle() {
+		if (changed || !reseated) return false;
+		reseated = false;
+		swapIn();
+		return true;
+	}
+
+	// Numbers versions on from 'version', for a document
+	// picked up from somewhere (an autosave) that had
+	// already got that far.
+	void resume(uint64_t version) {
+		draft.version = std::max(draft.version, version);
+	}
+
+	// Makes the draft visible to readers. Returns whether
+	// there was anything new to publish.
+	bool publish() {
+		if (!changed) return false;
+		changed = reseated = false;
+		lastPrivate = false;
+		draft.version++;
+		if (onPublish) onPublish(draft.version);
+		swapIn();
+		return true;
+	}
+
+	/* READERS */
+
+	// Each reading thread needs its own one of these.
+	class Reader {
+		Document*   doc;
+		std::size_t slot;
+	public:
+		Reader(Document& d) : doc{&d} {
+			for (slot=0; slot<MaxReaders; slot++)
+				if (!doc->taken[slot].exchange(true)) return;
+			assert(!"Too many document readers");
+		}
+		~Reader() { doc->taken[slot].store(false); }
+		Reader(const Reader&) = delete;
+		Reader& operator=(const Reader&) = delete;
+
+		Snapshot snapshot() const {
+			auto& a = doc->active[slot];
+			a.store(doc->epoch.load(), std::memory_order_seq_cst);
+			Snapshot s = doc->current.load(std::memory_order_seq_cst)->snap;
+			a.store(0, std::memory_order_release);
+			return s;
+		}
+	};
+};
@@ -0,0 +1,224 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <optional>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include "document.hh"
+#include "renderer.hh"
+#include "layers.hh"
+#include "queue.hh"
+
+// Headless time-lapse export. Frame i shows the document after
+// its first atomsAt(i) atoms. Frames are split into contiguous
+// runs, one per thread, and each thread draws its run
+// incrementally: only the atoms added since its previous frame
+// get drawn, so the total work is about one full render per
+// thread, however many frames there are.
+//
+// Documents with layers go through a LayerStack instead, so
+// opacity and blending come out like they do on screen.
+namespace Export
+{
+	struct Options {
+		unsigned    W = 800, H = 600;
+		std::size_t frames = 300;
+		unsigned    fps = 30;
+		unsigned    threads = 0; // 0 means one per core
+		// Defaults to spreading the atoms evenly over the frames.
+		std::function<std::size_t(std::size_t)> atomsAt;
+	};
+
+	// Headless renderers just use 0x00RRGGBB.
+	uint32_t packRGB(Col3 c) { return c.r << 16 | c.g << 8 | c.b; }
+	Col3   unpackRGB(uint32_t p) { return {uint8_t(p >> 16), uint8_t(p >> 8), uint8_t(p)}; }
+
+	// Calls write(i, pixels) for every frame, from whichever
+	// thread drew it.
+	void renderFrames(const PVector<Atom>& atoms, Options o,
+	                  std::function<void(std::size_t, std::span<const uint32_t>)> write) {
+		if (!o.atomsAt) o.atomsAt = [&](std::size_t i) {
+			return o.frames > 1 ? atoms.size()*i / (o.frames-1) : atoms.size();
+		};
+		unsigned threads = o.threads ? o.threads : std::thread::hardware_concurrency();
+		threads = std::clamp<unsigned>(threads, 1, std::max<std::size_t>(1, o.frames));
+#		if !SKETCH_THREADS
+		threads = 1;
+#		endif
+
+		bool layered = false;
+		atoms.forEach([&](const Atom& a) { layered = layered || std::holds_alternative<Layer>(a); });
+
+		auto run = [&](std::size_t first, std::size_t last) {
+			std::vector<uint32_t> pixels (o.W*o.H);
+			Renderer r {pixels, o.W, o.H, packRGB, unpackRGB};
+			r.clear();
+			std::optional<LayerStack> stack {};
+			if (layered) {
+				stack.emplace(o.W, o.H, packRGB, unpackRGB);
+				stack->setView(r.view);
+			}
+			std::size_t drawn = 0;
+			using It = PVector<Atom>::iterator;
+			for (std::size_t i=first; i<last; i++) {
+				std::size_t n = std::min(o.atomsAt(i), atoms.size());
+				if (stack) {
+					const Rect dirty = stack->sync(atoms, n);
+					stack->render(dirty);
+					stack->composite(pixels, dirty);
+				}
+				else {
+					// Only happens if atomsAt() isn't increasing.
+					if (n < drawn) r.clear(), drawn = 0;
+					r.display(ranges::subrange {It {&atoms, drawn}, It {&atoms, n}});
+				}
+				drawn = n;
+				write(i, pixels);
+			}
+		};
+
+		const std::size_t chunk = (o.frames + threads-1) / threads;
+#		if SKETCH_THREADS
+		std::vector<std::jthread> workers {};
+		for (std::size_t first=chunk; first<o.frames; first+=chunk)
+			workers.emplace_back(run, first, std::min(o.frames, first+chunk));
+#		endif
+		run(0, std::min(o.frames, chunk));
+	}
+
+	/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+	// YUV4MPEG2 (4:2:0, full range). Every frame is the same
+	// size, so each thread can pwrite() straight to its spot
+	// in the file without waiting on the others.
+	bool y4m(const PVector<Atom>& atoms, const std::string& path, Options o) {
+		const std::string header = "YUV4MPEG2 W" + std::to_string(o.W)
+			+ " H" + std::to_string(o.H) + " F" + std::to_string(o.fps)
+			+ ":1 Ip A1:1 C420jpeg\n";
+		const std::string frameTag = "FRAME\n";
+		const std::size_t CW = (o.W+1)/2, CH = (o.H+1)/2;
+		const std::size_t frameSize = frameTag.size() + o.W*o.H + 2*CW*CH;
+
+		int fd = ::open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		if (fd < 0) return false;
+		bool ok = ::write(fd, header.data(), header.size()) == (ssize_t)header.size();
+
+		std::atomic<bool> failed {false};
+		renderFrames(atoms, o, [&](std::size_t i, std::span<const uint32_t> px) {
+			std::vector<uint8_t> frame (frameSize);
+			ranges::copy(frameTag, frame.begin());
+			uint8_t* Y = &frame[frameTag.size()];
+			uint8_t* U = Y + o.W*o.H;
+			uint8_t* V = U + CW*CH;
+			for (std::size_t j=0; j<o.W*o.H; j++) {
+				Col3 c = unpackRGB(px[j]);
+				Y[j] = (77*c.r + 150*c.g + 29*c.b + 128) >> 8;
+			}
+			// Chroma is averaged over each 2x2 block.
+			for (std::size_t y=0; y<CH; y++)
+			for (std::size_t x=0; x<CW; x++) {
+				int r=0, g=0, b=0, n=0;
+				for (std::size_t dy=0; dy<2 && 2*y+dy<o.H; dy++)
+				for (std::size_t dx=0; dx<2 && 2*x+dx<o.W; dx++, n++) {
+					Col3 c = unpackRGB(px[(2*y+dy)*o.W + 2*x+dx]);
+					r += c.r, g += c.g, b += c.b;
+				}
+				r /= n, g /= n, b /= n;
+				U[y*CW+x] = std::clamp((-43*r -  85*g + 128*b + 128*256 + 128) >> 8, 0, 255);
+				V[y*CW+x] = std::clamp(( 128*r - 107*g -  21*b + 128*256 + 128) >> 8, 0, 255);
+			}
+			const off_t at = header.size() + i*frameSize;
+			if (::pwrite(fd, frame.data(), frame.size(), at) != (ssize_t)frame.size())
+				failed = true;
+		});
+		const bool closed = ::close(fd) == 0;
+		return ok && !failed && closed;
+	}
+
+	/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+	// Minimal PNG writer. It only uses stored (uncompressed)
+	// deflate blocks, so the files are big, but it needs no
+	// zlib and costs next to nothing next to the rendering.
+	class PNG {
+		static uint32_t crc(std::span<const uint8_t> data, uint32_t c = 0xffffffff) {
+			static const auto table = [] {
+				std::array<uint32_t,256> t {};
+				for (uint32_t n=0; n<256; n++) {
+					uint32_t c = n;
+					for (int k=0; k<8; k++) c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+					t[n] = c;
+				}
+				return t;
+			} ();
+			for (uint8_t b : data) c = table[(c ^ b) & 0xff] ^ (c >> 8);
+			return c;
+		}
+
+		static void be32(std::vector<uint8_t>& out, uint32_t x) {
+			for (int i=3; i>=0; i--) out.push_back(x >> 8*i);
+		}
+
+		static void chunk(std::vector<uint8_t>& out, const char* type,
+		                  std::span<const uint8_t> data) {
+			be32(out, data.size());
+			const std::size_t start = out.size();
+			out.insert(out.end(), type, type+4);
+			out.insert(out.end(), data.begin(), data.end());
+			be32(out, crc({&out[start], out.size()-start}) ^ 0xffffffff);
+		}
+
+	public:
+		static std::vector<uint8_t> encode(std::span<const uint32_t> px, unsigned W, unsigned H) {
+			// Filter type 0 (none) in front of every row.
+			std::vector<uint8_t> raw {};
+			raw.reserve((3*W+1)*H);
+			for (unsigned y=0; y<H; y++) {
+				raw.push_back(0);
+				for (unsigned x=0; x<W; x++) {
+					Col3 c = unpackRGB(px[y*W+x]);
+					raw.insert(raw.end(), {c.r, c.g, c.b});
+				}
+			}
+
+			std::vector<uint8_t> z {0x78, 0x01};
+			uint32_t a = 1, b = 0;
+			for (std::size_t i=0; i<raw.size() || i==0; i+=0xffff) {
+				const uint16_t n = std::min<std::size_t>(0xffff, raw.size()-i);
+				z.insert(z.end(), {uint8_t(i+n == raw.size()), uint8_t(n), uint8_t(n>>8),
+				                   uint8_t(~n), uint8_t(~n>>8)});
+				z.insert(z.end(), raw.begin()+i, raw.begin()+i+n);
+			}
+			for (uint8_t x : raw) a = (a + x) % 65521, b = (b + a) % 65521;
+			be32(z, b << 16 | a);
+
+			std::vector<uint8_t> out {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+			std::vector<uint8_t> ihdr {};
+			be32(ihdr, W), be32(ihdr, H);
+			ihdr.insert(ihdr.end(), {8, 2, 0, 0, 0}); // 8-bit RGB
+			chunk(out, "IHDR", ihdr);
+			chunk(out, "IDAT", z);
+			chunk(out, "IEND", {});
+			return out;
+		}
+	};
+
+	// Writes "<prefix>000000.png", "<prefix>000001.png", ...
+	bool pngs(const PVector<Atom>& atoms, const std::string& prefix, Options o) {
+		std::atomic<bool> failed {false};
+		renderFrames(atoms, o, [&](std::size_t i, std::span<const uint32_t> px) {
+			char name[16];
+			std::snprintf(name, sizeof name, "%06zu.png", i);
+			auto data = PNG::encode(px, o.W, o.H);
+			std::FILE* f = std::fopen((prefix + name).c_str(), "wb");
+			if (!f || std::fwrite(data.data(), 1, data.size(), f) != data.size())
+				failed = true;
+			if (f) std::fclose(f);
+		});
+		return !failed;
+	}
+};
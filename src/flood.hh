@@ -0,0 +1,197 @@
+#pragma once
+#include <span>
+#include <vector>
+#include <array>
+#include <optional>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "types.hh"
+#include "math.hh"
+#include "renderer.hh"
+
+// The bucket tool. What's on screen gets flood filled from
+// where it was clicked, and the edge of what got filled is
+// traced back into outlines, so it goes in the document as a
+// Fill rather than as pixels.
+namespace Flood
+{
+	// Whether every byte of 'p' is within 'tolerance' of the
+	// same byte of 'seed', so channel order doesn't matter.
+	inline bool near(uint32_t p, uint32_t seed, uint8_t tolerance) {
+		if (p == seed) return true;
+		int worst = 0;
+		for (int i=0; i<32; i+=8)
+			worst = std::max(worst, std::abs(int(p >> i & 255) - int(seed >> i & 255)));
+		return worst <= tolerance;
+	}
+
+	// 4-connected pixels like the one at (x, y), as a W by H
+	// mask. Works a run at a time: a seed grows into the whole
+	// run it's in, and only the start of each run above and
+	// below it that could be filled gets pushed as a new seed.
+	std::vector<uint8_t> region(std::span<const uint32_t> px, unsigned W, unsigned H,
+	                            int x, int y, uint8_t tolerance) {
+		std::vector<uint8_t> mask (W*H);
+		if (x < 0 || y < 0 || x >= int(W) || y >= int(H)) return mask;
+		const uint32_t seed = px[y*W + x];
+		auto open = [&](int x, int y) {
+			return !mask[y*W + x] && near(px[y*W + x], seed, tolerance);
+		};
+		std::vector<std::pair<int,int>> seeds {{x, y}};
+		while (!seeds.empty()) {
+			auto [sx, sy] = seeds.back();
+			seeds.pop_back();
+			if (!open(sx, sy)) continue;
+			int x0 = sx, x1 = sx+1;
+			while (x0 > 0 && open(x0-1, sy)) x0--;
+			while (x1 < int(W) && open(x1, sy)) x1++;
+			std::fill(&mask[sy*W + x0], &mask[sy*W + x1], 1);
+			for (int ny : {sy-1, sy+1}) {
+				if (ny < 0 || ny >= int(H)) continue;
+				bool before = false;
+				for (int nx=x0; nx<x1; nx++) {
+					const bool now = open(nx, ny);
+					if (now && !before) seeds.push_back({nx, ny});
+					before = now;
+				}
+			}
+		}
+		return mask;
+	}
+
+	// Grows the mask by a pixel, so it goes under the
+	// anti-aliased edges of whatever it stopped at.
+	void grow(std::vector<uint8_t>& mask, unsigned W, unsigned H) {
+		std::vector<uint8_t> out = mask;
+		for (unsigned y=0; y<H; y++)
+		for (unsigned x=0; x<W; x++) {
+			if (!mask[y*W + x]) continue;
+			if (x > 0)   out[y*W + x-1] = 1;
+			if (x+1 < W) out[y*W + x+1] = 1;
+			if (y > 0)   out[(y-1)*W + x] = 1;
+			if (y+1 < H) out[(y+1)*W + x] = 1;
+		}
+		mask = std::move(out);
+	}
+
+	// Marching squares over the pixel centres, with everything
+	// off the edge outside. Outlines go through the midpoints
+	// between centres, so corners get cut at 45 degrees rather
+	// than following every pixel step. Where only diagonal
+	// corners are inside they're kept apart, same as the fill.
+	std::vector<std::vector<Vec2>> trace(const std::vector<uint8_t>& mask, unsigned W, unsigned H) {
+		// Midpoints are in half pixels, shifted to stay positive.
+		const uint32_t stride = 2*W + 6;
+		auto id = [&](int X, int Y) { return uint32_t(Y+2)*stride + uint32_t(X+2); };
+		auto inside = [&](int x, int y) {
+			return x >= 0 && y >= 0 && x < int(W) && y < int(H) && mask[y*W + x];
+		};
+
+		// Every midpoint on an outline joins exactly two others.
+		std::unordered_map<uint32_t, std::array<uint32_t,2>> links {};
+		auto link = [&](uint32_t a, uint32_t b) {
+			auto add = [&](uint32_t from, uint32_t to) {
+				auto [it, added] = links.try_emplace(from, std::array {to, to});
+				if (!added) it->second[1] = to;
+			};
+			add(a, b), add(b, a);
+		};
+		for (int y=-1; y<int(H); y++)
+		for (int x=-1; x<int(W); x++) {
+			const int cell = inside(x, y) | inside(x+1, y) << 1 | inside(x+1, y+1) << 2 | inside(x, y+1) << 3;
+			if (cell == 0 || cell == 15) continue;
+			const uint32_t T = id(2*x+2, 2*y+1), B = id(2*x+2, 2*y+3);
+			const uint32_t L = id(2*x+1, 2*y+2), R = id(2*x+3, 2*y+2);
+			switch (cell) {
+				case 1:  case 14: link(T, L); break;
+				case 2:  case 13: link(T, R); break;
+				case 4:  case 11: link(R, B); break;
+				case 8:  case 7:  link(B, L); break;
+				case 3:  case 12: link(L, R); break;
+				case 6:  case 9:  link(T, B); break;
+				case 5:  link(T, L), link(R, B); break;
+				case 10: link(T, R), link(B, L); break;
+			}
+		}
+
+		std::vector<std::vector<Vec2>> loops {};
+		while (!links.empty()) {
+			const uint32_t start = links.begin()->first;
+			std::vector<Vec2> loop {};
+			uint32_t at = start, from = UINT32_MAX;
+			do {
+				auto it = links.find(at);
+				if (it == links.end()) break;
+				loop.push_back({Real(int(at % stride) - 2) / 2, Real(int(at / stride) - 2) / 2});
+				const auto [a, b] = it->second;
+				const uint32_t next = a != from ? a : b;
+				links.erase(it);
+				from = at, at = next;
+			} while (at != start);
+			if (loop.size() >= 3) loops.push_back(std::move(loop));
+		}
+		return loops;
+	}
+
+	// Douglas-Peucker on a closed loop, split in two at the
+	// point furthest from the first one.
+	std::vector<Vec2> simplify(const std::vector<Vec2>& loop, Real tolerance) {
+		const std::size_t n = loop.size();
+		if (n < 4) return loop;
+		auto d2 = [](Vec2 a, Vec2 b) { return dot2({a.x-b.x, a.y-b.y}); };
+		std::size_t far = 0;
+		for (std::size_t i=1; i<n; i++)
+			if (d2(loop[i], loop[0]) > d2(loop[far], loop[0])) far = i;
+
+		std::vector<bool> keep (n);
+		keep[0] = keep[far] = true;
+		std::vector<std::pair<std::size_t,std::size_t>> todo {{0, far}, {far, n}};
+		while (!todo.empty()) {
+			auto [i, j] = todo.back();
+			todo.pop_back();
+			const Vec2 a = loop[i], b = loop[j % n];
+			const Vec2 ab {b.x-a.x, b.y-a.y};
+			const Real length = len(ab);
+			Real worst = 0;
+			std::size_t at = i;
+			for (std::size_t k=i+1; k<j; k++) {
+				const Vec2 p = loop[k];
+				const Real d = length > 0
+					? std::abs(ab.x*(p.y-a.y) - ab.y*(p.x-a.x)) / length
+					: std::sqrt(d2(p, a));
+				if (d > worst) worst = d, at = k;
+			}
+			if (worst > tolerance) {
+				keep[at] = true;
+				todo.push_back({i, at}), todo.push_back({at, j});
+			}
+		}
+		std::vector<Vec2> out {};
+		for (std::size_t i=0; i<n; i++)
+			if (keep[i]) out.push_back(loop[i]);
+		return out;
+	}
+
+	// Fills whatever's like the pixel at 'at' in the frame.
+	// Outlines are simplified to within 'tolerance' pixels.
+	std::optional<Fill> bucket(std::span<const uint32_t> px, unsigned W, unsigned H,
+	                           Vec2 at, Viewport view, uint8_t tolerance = 48,
+	                           Real simplifyBy = 0.75f) {
+		auto mask = region(px, W, H, std::floor(at.x), std::floor(at.y), tolerance);
+		grow(mask, W, H);
+		Fill fill {};
+		for (const auto& loop : trace(mask, W, H)) {
+			const auto kept = simplify(loop, simplifyBy);
+			if (kept.size() < 3) continue;
+			if (!fill.outline.empty()) fill.ends.push_back(fill.outline.size());
+			for (Vec2 p : kept) {
+				const Vec2 d = view.toDocument(p);
+				fill.outline.push_back({int16_t(std::lround(d.x)), int16_t(std::lround(d.y)), 1});
+			}
+		}
+		if (fill.outline.empty()) return {};
+		return fill;
+	}
+};
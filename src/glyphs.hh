@@ -0,0 +1,306 @@
+#pragma once
+#include <array>
+#include <vector>
+#include <unordered_map>
+#include <optional>
+#include <string_view>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "types.hh"
+#include "math.hh"
+
+// A little single stroke font for lettering, so there's no
+// font file to load. Glyphs are drawn on a grid 4 wide, with
+// capitals from 0 to 6 (the baseline), lowercase from 2, and
+// descenders down to 8. Each one is lines through grid points
+// as "xy" digit pairs, lines split up by spaces.
+namespace Font
+{
+	constexpr int CapHeight = 6, Descent = 2, Width = 4;
+	constexpr int Advance = 5, LineHeight = 10;
+
+	constexpr std::array<std::string_view,95> Glyphs {
+		/*   */ "",
+		/* ! */ "2024 2626",
+		/* " */ "1012 3032",
+		/* # */ "1016 3036 0242 0444",
+		/* $ */ "413010010213334445361605 2027",
+		/* % */ "4006 0010110100 3545463635",
+		/* & */ "4602011020310405163644",
+		/* ' */ "2022",
+		/* ( */ "30212536",
+		/* ) */ "10212516",
+		/* * */ "2024 0143 0341",
+		/* + */ "2125 0343",
+		/* , */ "262718",
+		/* - */ "0343",
+		/* . */ "2626",
+		/* / */ "4006",
+		/* 0 */ "100105163645413010 4105",
+		/* 1 */ "112026 1636",
+		/* 2 */ "01103041420646",
+		/* 3 */ "01103041423313 334445361605",
+		/* 4 */ "36300444",
+		/* 5 */ "400003334445361605",
+		/* 6 */ "413010010516364544331304",
+		/* 7 */ "004016",
+		/* 8 */ "13020110304142331304051636454433",
+		/* 9 */ "423313020110304145361605",
+		/* : */ "2222 2626",
+		/* ; */ "2222 262718",
+		/* < */ "410345",
+		/* = */ "0242 0444",
+		/* > */ "014305",
+		/* ? */ "01103041422324 2626",
+		/* @ */ "3432121434454130100105163646",
+		/* A */ "062046 1333",
+		/* B */ "06003041423303 3344453606",
+		/* C */ "4130100105163645",
+		/* D */ "00062645412000",
+		/* E */ "40000646 0333",
+		/* F */ "400006 0333",
+		/* G */ "41301001051636454323",
+		/* H */ "0006 4046 0343",
+		/* I */ "1030 2026 1636",
+		/* J */ "1040 3035261605",
+		/* K */ "0006 400346",
+		/* L */ "000646",
+		/* M */ "0600234046",
+		/* N */ "06004640",
+		/* O */ "100105163645413010",
+		/* P */ "06003041423303",
+		/* Q */ "100105163645413010 3446",
+		/* R */ "06003041423303 2346",
+		/* S */ "413010010213334445361605",
+		/* T */ "0040 2026",
+		/* U */ "000516364540",
+		/* V */ "002640",
+		/* W */ "0016233640",
+		/* X */ "0046 4006",
+		/* Y */ "002340 2326",
+		/* Z */ "00400646",
+		/* [ */ "30202636",
+		/* \ */ "0046",
+		/* ] */ "10202616",
+		/* ^ */ "122032",
+		/* _ */ "0747",
+		/* ` */ "1021",
+		/* a */ "4246 4332120305163645",
+		/* b */ "0006 0312324345361605",
+		/* c */ "4332120305163645",
+		/* d */ "4046 4332120305163645",
+		/* e */ "04444332120305163645",
+		/* f */ "4130201116 0232",
+		/* g */ "4247381807 4332120304153544",
+		/* h */ "0006 0312324346",
+		/* i */ "2226 2020",
+		/* j */ "3237281807 3030",
+		/* k */ "0006 420446",
+		/* l */ "10152636",
+		/* m */ "0206 03122326 23324346",
+		/* n */ "0206 0312324346",
+		/* o */ "120305163645433212",
+		/* p */ "0208 0312324345361605",
+		/* q */ "4248 4332120305163645",
+		/* r */ "0206 04223243",
+		/* s */ "43321203143445361605",
+		/* t */ "11152636 0232",
+		/* u */ "0205163645 4246",
+		/* v */ "022642",
+		/* w */ "0216243642",
+		/* x */ "0246 4206",
+		/* y */ "0205163645 4247381807",
+		/* z */ "02420646",
+		/* { */ "30212213242536",
+		/* | */ "2027",
+		/* } */ "10212233242516",
+		/* ~ */ "03123342",
+	};
+
+	// Anything it doesn't have comes out as a '?'.
+	constexpr std::string_view glyph(char32_t c) {
+		return c >= 32 && c < 127 ? Glyphs[c-32] : Glyphs['?'-32];
+	}
+
+	// Calls f(a, b) for each line of a glyph, in grid units.
+	template <typename F>
+	void lines(char32_t c, F f) {
+		Vec2 prev {};
+		bool first = true;
+		const std::string_view g = glyph(c);
+		for (std::size_t i=0; i+1<g.size(); ) {
+			if (g[i] == ' ') { first = true, i++; continue; }
+			const Vec2 p {Real(g[i]-'0'), Real(g[i+1]-'0')};
+			if (!first) f(prev, p);
+			prev = p, first = false, i += 2;
+		}
+	}
+
+	// How many columns and lines 'text' takes up.
+	std::pair<int,int> extent(std::string_view text) {
+		int cols = 0, col = 0, rows = 1;
+		for (char c : text) {
+			if (c == '\n') { rows++, col = 0; continue; }
+			if ((c & 0xc0) == 0x80) continue; // Rest of a UTF-8 character
+			cols = std::max(cols, ++col);
+		}
+		return {cols, rows};
+	}
+};
+
+// Glyphs drawn once as coverage and packed into one atlas, so
+// text only costs blitting them. A glyph is kept per pixel size
+// and quarter pixel horizontal offset. The atlas is split into
+// shelves by height, and when it fills up the glyphs that went
+// longest without being used make room.
+class GlyphAtlas {
+public:
+	static constexpr int Size = 512;
+	static constexpr int Subpixels = 4;
+
+	// Where it is in the atlas, and where its top left goes
+	// relative to the pen (at the top of the capitals).
+	struct Glyph { int x, y, w, h, left, top; };
+
+private:
+	struct Key {
+		char32_t c;
+		uint16_t px;
+		uint8_t  sub;
+		bool operator==(const Key&) const = default;
+	};
+	struct KeyHash {
+		std::size_t operator()(Key k) const {
+			return std::hash<uint64_t> {}(uint64_t(k.c) << 24 | uint64_t(k.px) << 8 | k.sub);
+		}
+	};
+	// The glyph is trimmed down to what it actually covers, but
+	// the room it was given is x to x+w.
+	struct Entry { Glyph g; uint64_t used; std::size_t shelf; int x, w; };
+	struct Shelf {
+		int y, h, end = 0;
+		std::vector<std::pair<int,int>> free {}; // x, width, by x
+	};
+
+	std::vector<uint8_t> pixels; // Coverage, allocated when first used
+	std::unordered_map<Key, Entry, KeyHash> entries;
+	std::vector<Shelf> shelves;
+	int bottom = 0;       // Of the last shelf
+	uint64_t clock = 0;   // Ticks every lookup
+
+	// Room for a w by h glyph, taken out of a shelf (x, shelf).
+	std::optional<std::pair<int,std::size_t>> place(int w, int h) {
+		for (std::size_t s=0; s<shelves.size(); s++) {
+			Shelf& sh = shelves[s];
+			if (sh.h != h) continue;
+			for (auto it = sh.free.begin(); it != sh.free.end(); ++it)
+				if (it->second >= w) {
+					const int x = it->first;
+					if (it->second == w) sh.free.erase(it);
+					else it->first += w, it->second -= w;
+					return std::pair {x, s};
+				}
+			if (sh.end + w <= Size) {
+				sh.end += w;
+				return std::pair {sh.end - w, s};
+			}
+		}
+		if (bottom + h > Size || w > Size) return {};
+		shelves.push_back({bottom, h});
+		bottom += h;
+		shelves.back().end = w;
+		return std::pair {0, shelves.size()-1};
+	}
+
+	// Gives a glyph's space back to its shelf.
+	void release(const Entry& e) {
+		Shelf& sh = shelves[e.shelf];
+		auto it = ranges::lower_bound(sh.free, std::pair {e.x, 0});
+		it = sh.free.insert(it, {e.x, e.w});
+		// Joins up with whatever's free on either side.
+		if (auto next = it+1; next != sh.free.end() && it->first + it->second == next->first)
+			it->second += next->second, sh.free.erase(next);
+		if (it != sh.free.begin())
+			if (auto prev = it-1; prev->first + prev->second == it->first)
+				prev->second += it->second, it = sh.free.erase(it) - 1;
+		if (it->first + it->second == sh.end)
+			sh.end = it->first, sh.free.erase(it);
+	}
+
+	void draw(const Glyph& g, char32_t c, Real px, int sub) {
+		const Real unit = px / Font::CapHeight;
+		const Real radius = std::max(Real(0.6), unit * Real(0.4));
+		std::vector<std::pair<Vec2,Vec2>> lines {};
+		Font::lines(c, [&](Vec2 a, Vec2 b) { lines.push_back({a, b}); });
+		const Real dx = g.left + Real(0.5) - Real(sub) / Subpixels, dy = g.top + Real(0.5);
+		for (int y=0; y<g.h; y++)
+		for (int x=0; x<g.w; x++) {
+			const Vec2 p {(x + dx) / unit, (y + dy) / unit};
+			Real d = INFINITY;
+			for (auto [a, b] : lines) d = std::min(d, SDFline(p, a, b));
+			pixels[(g.y+y)*Size + g.x+x] = 255 * clamp(radius + Real(0.5) - d*unit, 0, 1);
+		}
+	}
+
+	// Just the part of 'g' that has any coverage.
+	Glyph trim(const Glyph& g) const {
+		int x0 = g.w, y0 = g.h, x1 = 0, y1 = 0;
+		for (int y=0; y<g.h; y++)
+		for (int x=0; x<g.w; x++)
+			if (row(g, y)[x]) {
+				x0 = std::min(x0, x), x1 = std::max(x1, x+1);
+				y0 = std::min(y0, y), y1 = std::max(y1, y+1);
+			}
+		if (x0 >= x1) return {g.x, g.y, 0, 0, g.left, g.top};
+		return {g.x+x0, g.y+y0, x1-x0, y1-y0, g.left+x0, g.top+y0};
+	}
+
+public:
+	std::size_t count() const { return entries.size(); }
+
+	void clear() {
+		entries.clear(), shelves.clear();
+		bottom = 0;
+	}
+
+	// Row 'y' of a glyph's coverage.
+	const uint8_t* row(const Glyph& g, int y) const { return &pixels[(g.y+y)*Size + g.x]; }
+
+	// 'px' is the capital height in pixels, and 'sub' which
+	// quarter of a pixel the pen is at.
+	Glyph get(char32_t c, Real px, int sub) {
+		if (pixels.empty()) pixels.resize(Size*Size);
+		const uint16_t size = std::clamp<int>(std::lround(px), 1, 255);
+		const Key key {c, size, uint8_t(sub)};
+		if (auto it = entries.find(key); it != entries.end()) {
+			it->second.used = ++clock;
+			return it->second.g;
+		}
+
+		const Real unit = Real(size) / Font::CapHeight;
+		const int pad = std::ceil(std::max(Real(0.6), unit * Real(0.4))) + 1;
+		const int w = std::ceil(Font::Width * unit) + 2*pad + 1;
+		const int h = (int(std::ceil((Font::CapHeight + Font::Descent) * unit)) + 2*pad + 3) & ~3;
+		auto spot = place(w, h);
+		while (!spot && !entries.empty()) {
+			// Makes room a glyph at a time, oldest first,
+			// from shelves this one would fit.
+			auto old = entries.end();
+			for (auto it = entries.begin(); it != entries.end(); ++it)
+				if (shelves[it->second.shelf].h == h && (old == entries.end() || it->second.used < old->second.used))
+					old = it;
+			if (old == entries.end()) { clear(); spot = place(w, h); break; }
+			release(old->second);
+			entries.erase(old);
+			spot = place(w, h);
+		}
+		if (!spot) return {0, 0, 0, 0, 0, 0};
+
+		const Glyph room {spot->first, shelves[spot->second].y, w, h, -pad, -pad};
+		draw(room, c, size, sub);
+		const Glyph g = trim(room);
+		entries[key] = {g, ++clock, spot->second, room.x, room.w};
+		return g;
+	}
+};
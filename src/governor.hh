@@ -0,0 +1,157 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+#include "math.hh"
+#include "queue.hh"
+
+// What the governor lets the renderer get away with.
+struct RenderSettings {
+	Real                      lodTolerance = 2;     // Draft pixels
+	std::chrono::microseconds refineBudget {4000};  // Per frame
+	std::size_t               cacheBytes = 128<<20; // Timeline keyframes and tiles, half each
+	bool operator==(const RenderSettings&) const = default;
+};
+
+// Keeps frames near a target time by trading quality for
+// speed. Each frame it's told how long events, raster and
+// present took, and once the (smoothed) total goes over the
+// target it coarsens LOD, cuts the refinement quota and
+// shrinks caches, one notch per frame. When there's plenty
+// of headroom for a while it gives them back in reverse.
+//
+// Time comes from 'now', so it can be driven by a made up
+// clock headlessly instead of steady_clock.
+class Governor {
+public:
+	using Duration = std::chrono::microseconds;
+	using Clock    = std::function<Duration()>;
+
+	enum Phase { Events, Raster, Present, Phases };
+
+	// Everything it's decided so far, for showing or logging.
+	struct Counters {
+		uint64_t frames = 0;
+		uint64_t overBudget = 0;
+		uint64_t lodRaised = 0, lodLowered = 0;
+		uint64_t quotaCut  = 0, quotaRaised = 0;
+		uint64_t cacheShrunk = 0, cacheGrown = 0;
+		Duration smoothed {0};
+	};
+
+private:
+	static constexpr Real     MaxLod = 16;
+	static constexpr Duration MinQuota {500};
+	static constexpr std::size_t MinCache = 4<<20;
+	static constexpr unsigned RelaxAfter = 30; // Frames of headroom
+
+	Clock    now;
+	Duration mark {0};
+	std::array<Duration,Phases> cost {};
+	RenderSettings best, current;
+	Counters stats {};
+	unsigned calm = 0;
+
+	// Work on the main thread and raster overlap when there
+	// is a render thread, so only the slower of them counts.
+	Duration total() const {
+#		if SKETCH_THREADS
+		return std::max(cost[Events] + cost[Present], cost[Raster]);
+#		else
+		return cost[Events] + cost[Raster] + cost[Present];
+#		endif
+	}
+
+	// Cheapest knob first, image quality last.
+	void degrade() {
+		if (current.cacheBytes > MinCache) {
+			current.cacheBytes = std::max(MinCache, current.cacheBytes/2);
+			stats.cacheShrunk++;
+		}
+		else if (current.refineBudget > MinQuota) {
+			current.refineBudget = std::max(MinQuota, current.refineBudget/2);
+			stats.quotaCut++;
+		}
+		else if (current.lodTolerance < MaxLod) {
+			current.lodTolerance = std::min(MaxLod, current.lodTolerance*Real(1.5));
+			stats.lodRaised++;
+		}
+	}
+
+	void relax() {
+		if (current.lodTolerance > best.lodTolerance) {
+			current.lodTolerance = std::max(best.lodTolerance, current.lodTolerance/Real(1.5));
+			stats.lodLowered++;
+		}
+		else if (current.refineBudget < best.refineBudget) {
+			current.refineBudget = std::min(best.refineBudget, current.refineBudget*2);
+			stats.quotaRaised++;
+		}
+		else if (current.cacheBytes < best.cacheBytes) {
+			current.cacheBytes = std::min(best.cacheBytes, current.cacheBytes*2);
+			stats.cacheGrown++;
+		}
+	}
+
+public:
+	Duration target {8000};
+
+	Governor(RenderSettings best = {}, Clock clock = {})
+	: now{clock ? clock : [] {
+		return std::chrono::duration_cast<Duration>(
+			std::chrono::steady_clock::now().time_since_epoch());
+	}}
+	, best{best}, current{best} {
+		mark = now();
+	}
+
+	// Starts the frame's clock. Call it first thing in the loop
+	// body, so however long the loop waited for it to come round
+	// (a browser's next animation frame, or an event) isn't
+	// charged to anything.
+	void begin() { mark = now(); }
+
+	// Charges the time since the last lap to 'p'.
+	void lap(Phase p) {
+		const Duration t = now();
+		cost[p] += t - mark;
+		mark = t;
+	}
+
+	// For time measured elsewhere, like on the render thread.
+	void add(Phase p, Duration d) { cost[p] += d; }
+
+	// Forgets what this frame cost so far, for when the loop
+	// goes back to sleep instead of drawing one. The sleep
+	// itself comes before the next begin(), so isn't counted.
+	void skip() { cost = {}; }
+
+	// Call once the frame's been presented. Returns true if
+	// the settings changed and need handing to the renderer.
+	bool endFrame() {
+		const Duration t = total();
+		cost = {};
+		stats.frames++;
+		// Exponential average, so one hitch doesn't throw
+		// away quality but a run of slow frames does.
+		stats.smoothed = stats.frames == 1 ? t : (stats.smoothed*7 + t) / 8;
+
+		const RenderSettings before = current;
+		if (stats.smoothed > target) {
+			stats.overBudget++;
+			calm = 0;
+			degrade();
+		}
+		else if (stats.smoothed < target/2 && ++calm >= RelaxAfter) {
+			calm = 0;
+			relax();
+		}
+		else if (stats.smoothed >= target/2) calm = 0;
+		return current != before;
+	}
+
+	const RenderSettings& settings() const { return current; }
+	const Counters&       counters() const { return stats; }
+};
@@ -0,0 +1,195 @@
+#pragma once
+#include <deque>
+#include <vector>
+#include <variant>
+#include "document.hh"
+
+// Undo/redo log. Instead of whole copies of the document,
+// each step only records enough to reverse itself, and any
+// atoms it needs are shared with the document (and with old
+// snapshots) rather than copied. Appending a stroke costs a
+// few dozen bytes of history no matter how long the stroke is.
+class History {
+	using Item = PVector<Atom>::Item;
+
+	// Every step is a splice: [at,at+n) in the document gets
+	// swapped for 'items', which are whatever *isn't* in the
+	// document right now. Appends start out with no items,
+	// deletions with n=0, replacements with one of each.
+	struct Command {
+		std::size_t at, n;
+		std::vector<Item> items;
+		bool joined = false; // Undone and redone with the one before
+
+		std::size_t cost() const {
+			// Whatever's in 'items' is usually only referenced
+			// from here (see above), so count it in full.
+			std::size_t bytes = sizeof(Command) + items.capacity()*sizeof(Item);
+			for (const Item& x : items) bytes += atomCost(*x);
+			return bytes;
+		}
+	};
+
+	// Acts as a ring: old steps fall off the front when
+	// there's no room, new ones are pushed on the back.
+	std::deque<Command> log;
+	std::size_t done  = 0; // Everything after this has been undone
+	std::size_t bytes = 0;
+	std::size_t cap;
+	bool extending = false; // Last step was an Append we can grow
+	bool grouping  = false; // Between begin() and end()
+	bool joining   = false; // The group's got its first step
+
+	static std::vector<Item> slice(const PVector<Atom>& atoms,
+	                               std::size_t first, std::size_t last) {
+		std::vector<Item> result {};
+		for (std::size_t i=first; i<last; i++)
+			result.push_back(atoms.item(i));
+		return result;
+	}
+
+	static std::size_t atomCost(const Atom& a) {
+		std::size_t bytes = sizeof(Atom);
+		if (auto* s = std::get_if<Stroke>(&a))
+			bytes += s->points.capacity()*sizeof(Point) + s->ends.capacity()*sizeof(uint32_t);
+		if (auto* m = std::get_if<Marker>(&a))
+			bytes += m->text.capacity();
+		if (auto* l = std::get_if<Layer>(&a))
+			bytes += l->name.capacity();
+		if (auto* f = std::get_if<Fill>(&a))
+			bytes += f->outline.capacity()*sizeof(Point);
+		if (auto* e = std::get_if<Eraser>(&a))
+			bytes += Masks::bytes(e->shape);
+		// Instances share their symbol, so it's not counted.
+		if (auto* c = std::get_if<Curve>(&a))
+			bytes += c->points.capacity()*sizeof(Point);
+		if (auto* p = std::get_if<Packed>(&a))
+			bytes += p->bytes.capacity();
+		if (auto* p = std::get_if<Pattern>(&a)) {
+			bytes += p->region.outline.capacity()*sizeof(Point);
+			for (const Stroke& s : p->motif)
+				bytes += sizeof(Stroke) + s.points.capacity()*sizeof(Point);
+		}
+		return bytes;
+	}
+
+	void push(Command c) {
+		// Doing something new throws away everything undone.
+		while (log.size() > done) {
+			bytes -= log.back().cost();
+			log.pop_back();
+		}
+		c.joined = joining;
+		joining = grouping;
+		bytes += c.cost();
+		log.push_back(std::move(c));
+		done++;
+		// A group goes all at once, so there's never half of one.
+		while (bytes > cap && log.size() > 1)
+			do {
+				bytes -= log.front().cost();
+				log.pop_front();
+				done--;
+			} while (log.size() > 1 && log.front().joined);
+	}
+
+	// Commands change size as they move between done and
+	// undone, so the running total has to be patched up.
+	template <typename F>
+	void update(Command& c, F f) {
+		bytes -= c.cost();
+		f();
+		bytes += c.cost();
+	}
+
+	// Undo and redo are the same thing: swap what the command
+	// holds with what's in the document. Either way it's only
+	// a splice, which costs about as much as the change itself
+	// when it's at the end or the same size as what it swaps.
+	// Otherwise everything after it has to be moved (see
+	// PVector::splice).
+	static void reverse(Document& doc, Command& c) {
+		const PVector<Atom>& atoms = doc.latest().atoms;
+		std::vector<Item> taken = slice(atoms, c.at, c.at+c.n);
+		c.n = c.items.size();
+		doc.apply(Edit::Splice {c.at, c.at+taken.size(), std::move(c.items)});
+		c.items = std::move(taken);
+	}
+
+public:
+	History(std::size_t capBytes = 4<<20) : cap{capBytes} {}
+
+	std::size_t memory  () const { return bytes; }
+	std::size_t steps   () const { return log.size(); }
+	bool        canUndo () const { return done > 0; }
+	bool        canRedo () const { return done < log.size(); }
+
+	// Applies 'e' to the document and remembers how to reverse it.
+	void apply(Document& doc, DocEdit e) {
+		// More of a stroke that's been undone since it started.
+		// Growing whatever's last now would grow the wrong atom.
+		if (std::holds_alternative<Edit::ExtendStroke>(e) && !extending) return;
+		const PVector<Atom>& atoms = doc.latest().atoms;
+		std::visit(Overloaded {
+			[&](const Edit::AppendAtom&) {
+				push({atoms.size(), 1, {}});
+				extending = true;
+			},
+			// Part of the stroke the last Append started,
+			// undoing that takes the new points with it.
+			[&](const Edit::ExtendStroke&) {},
+			[&](const Edit::DeleteRange& e) {
+				push({e.first, 0, slice(atoms, e.first, e.last)});
+				extending = false;
+			},
+			[&](const Edit::ReplaceAtom& e) {
+				push({e.index, 1, {atoms.item(e.index)}});
+				extending = false;
+			},
+			[&](const Edit::Splice& e) {
+				push({e.first, e.atoms.size(), slice(atoms, e.first, e.last)});
+				extending = false;
+			}
+		}, e);
+		doc.apply(std::move(e));
+	}
+
+	// Swaps the stroke that was just drawn for a tidier one (a
+	// fitted curve, say), as part of the step that drew it, so
+	// undoing takes both. Anything else is a step of its own.
+	void amend(Document& doc, Edit::ReplaceAtom e) {
+		if (!extending || e.index+1 != doc.latest().atoms.size()) {
+			apply(doc, std::move(e));
+			return;
+		}
+		doc.apply(std::move(e));
+		extending = false;
+	}
+
+	// Between these, every edit goes in the same step, so one
+	// undo takes back a whole gesture (a drag with the cutter,
+	// say) however many edits it made.
+	void begin() { grouping = true, joining = false; }
+	void end()   { grouping = false, joining = false; }
+
+	// Both end a group that's under way.
+	void undo(Document& doc) {
+		end();
+		while (canUndo()) {
+			Command& c = log[--done];
+			update(c, [&] { reverse(doc, c); });
+			if (!c.joined) break;
+		}
+		extending = false;
+	}
+
+	void redo(Document& doc) {
+		end();
+		if (!canRedo()) return;
+		do {
+			Command& c = log[done++];
+			update(c, [&] { reverse(doc, c); });
+		} while (canRedo() && log[done].joined);
+		extending = false;
+	}
+};
@@ -0,0 +1,320 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <optional>
+#include <condition_variable>
+#include <fcntl.h>
+#include <unistd.h>
+#include "document.hh"
+#include "binary.hh"
+#include "queue.hh"
+
+// Background autosave. Every edit is encoded as it happens
+// (which is cheap, it's just the edit) and a worker thread
+// appends them to "<path>.journal" in batches. Every so often
+// the worker writes the whole document out to "<path>.snapshot"
+// from an RCU snapshot and starts the journal over, so neither
+// part ever makes the main thread wait on the disk.
+//
+// Records are [length][checksum][payload], so a record torn
+// by a crash is just ignored. A publish record marks where
+// each document version ends, and the snapshot says which
+// version it holds, which is how recovery knows what part of
+// the journal is already in the snapshot. Versions carry on
+// from one session to the next (see recover()), so records
+// from an older journal are never mistaken for newer ones.
+//
+// NOTE: On the web this is all in MEMFS unless the directory
+//       is mounted as IDBFS and synced, so it won't survive
+//       a reload by itself.
+class Journal {
+	using Clock = std::chrono::steady_clock;
+
+	static constexpr std::size_t BatchBytes   = 64<<10;
+	static constexpr auto        BatchPeriod  = std::chrono::milliseconds {250};
+	static constexpr uint8_t     PublishTag   = 0xff;
+	static constexpr uint32_t    SnapshotMagic= 0x4a435348; // "HSCJ"
+
+	const std::string journalPath, snapshotPath;
+	const std::size_t compactBytes;
+	Document&         doc;
+	Document::Reader  reader;
+
+	// Shared between the main thread and the worker.
+	std::mutex              m;
+	std::condition_variable wake;
+	std::vector<uint8_t>    pending;
+	uint64_t                enqueued = 0; // Stream offset after 'pending'
+	std::deque<std::pair<uint64_t,uint64_t>> markers; // (version, offset)
+	bool                    stopping = false;
+
+	// Worker only.
+	int         fd = -1;
+	uint64_t    fileBase = 0;    // Stream offset of the file's first byte
+	uint64_t    written  = 0;    // Stream offset of the file's end
+	uint64_t    snapshotVersion = UINT64_MAX;
+	Clock::time_point lastFlush = Clock::now();
+
+#	if SKETCH_THREADS
+	std::thread worker;
+#	endif
+
+	void record(std::vector<uint8_t>& payload, std::optional<uint64_t> version = {}) {
+		std::vector<uint8_t> head {};
+		Binary::Writer w {head};
+		w.u32(payload.size());
+		w.u32(Binary::checksum(payload));
+
+		std::lock_guard lock {m};
+		pending.insert(pending.end(), head.begin(), head.end());
+		pending.insert(pending.end(), payload.begin(), payload.end());
+		enqueued += head.size() + payload.size();
+		if (version) markers.push_back({*version, enqueued});
+		if (pending.size() >= BatchBytes) wake.notify_one();
+	}
+
+	void edited(const DocEdit& e) {
+		std::vector<uint8_t> payload {};
+		Binary::Writer {payload}.edit(e);
+		record(payload);
+	}
+
+	void published(uint64_t version) {
+		std::vector<uint8_t> payload {};
+		Binary::Writer w {payload};
+		w.u8(PublishTag);
+		w.varint(version);
+		record(payload, version);
+	}
+
+	static bool writeAll(int fd, std::span<const uint8_t> data) {
+		while (!data.empty()) {
+			ssize_t n = ::write(fd, data.data(), data.size());
+			if (n <= 0) return false;
+			data = data.subspan(n);
+		}
+		return true;
+	}
+
+	// Writes everything queued so far to the journal.
+	void flush() {
+		std::vector<uint8_t> batch {};
+		{
+			std::lock_guard lock {m};
+			batch.swap(pending);
+		}
+		lastFlush = Clock::now();
+		if (batch.empty()) return;
+		writeAll(fd, batch);
+		::fdatasync(fd);
+		written += batch.size();
+	}
+
+	// Writes a full snapshot and drops the journal records
+	// it makes redundant. Only ever runs on the worker.
+	void compact() {
+		Snapshot snap = reader.snapshot();
+		if (snap.version == snapshotVersion && written == fileBase) return;
+		flush(); // Publish record for snap.version is on disk now.
+
+		std::vector<uint8_t> data {};
+		Binary::Writer w {data};
+		w.u32(SnapshotMagic);
+		w.varint(snap.version);
+		w.varint(snap.atoms.size());
+		snap.atoms.forEach([&](const Atom& a) { w.atom(a); });
+		w.u32(Binary::checksum(data));
+
+		const std::string tmp = snapshotPath + ".tmp";
+		int sfd = ::open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		if (sfd < 0) return;
+		bool ok = writeAll(sfd, data) && ::fdatasync(sfd) == 0;
+		::close(sfd);
+		if (!ok || ::rename(tmp.c_str(), snapshotPath.c_str()) != 0) return;
+		snapshotVersion = snap.version;
+
+		// Keep only what comes after this version's publish record.
+		uint64_t cut = fileBase;
+		{
+			std::lock_guard lock {m};
+			while (!markers.empty() && markers.front().first <= snap.version) {
+				cut = markers.front().second;
+				markers.pop_front();
+			}
+		}
+		std::vector<uint8_t> tail (written - cut);
+		if (::pread(fd, tail.data(), tail.size(), cut - fileBase) != (ssize_t)tail.size())
+			return;
+		const std::string jtmp = journalPath + ".tmp";
+		int jfd = ::open(jtmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_APPEND, 0644);
+		if (jfd < 0) return;
+		if (!writeAll(jfd, tail) || ::fdatasync(jfd) != 0
+		||  ::rename(jtmp.c_str(), journalPath.c_str()) != 0) {
+			::close(jfd);
+			return;
+		}
+		::close(fd);
+		fd = jfd;
+		fileBase = cut;
+	}
+
+	// One round of the worker's job.
+	void service() {
+		if (Clock::now() - lastFlush >= BatchPeriod) flush();
+		if (written - fileBase >= compactBytes) compact();
+	}
+
+	void loop() {
+		std::unique_lock lock {m};
+		while (!stopping) {
+			wake.wait_for(lock, BatchPeriod, [&] {
+				return stopping || pending.size() >= BatchBytes;
+			});
+			lock.unlock();
+			flush();
+			if (written - fileBase >= compactBytes) compact();
+			lock.lock();
+		}
+	}
+
+public:
+	// Publish the document's starting state before this,
+	// since the first thing it does is write a snapshot.
+	Journal(Document& doc, const std::string& path,
+	        std::size_t compactBytes = 4<<20)
+	: journalPath {journalFile (path)}
+	, snapshotPath{snapshotFile(path)}
+	, compactBytes{compactBytes}
+	, doc{doc}, reader{doc} {
+		fd = ::open(journalPath.c_str(), O_RDWR|O_CREAT|O_APPEND, 0644);
+		written = enqueued = ::lseek(fd, 0, SEEK_END);
+		// Whatever was in the old journal has been recovered into
+		// 'doc' already, so it's all part of this snapshot. Saying
+		// so in the old journal too means that if we crash before
+		// the new one replaces it, it isn't replayed a second time.
+		published(doc.published().version);
+		compact();
+
+		doc.onEdit    = [this](const DocEdit& e) { edited(e); };
+		doc.onPublish = [this](uint64_t v)       { published(v); };
+#		if SKETCH_THREADS
+		worker = std::thread {[this]{ loop(); }};
+#		endif
+	}
+
+	~Journal() {
+		doc.onEdit = {};
+		doc.onPublish = {};
+		{
+			std::lock_guard lock {m};
+			stopping = true;
+		}
+		wake.notify_one();
+#		if SKETCH_THREADS
+		worker.join();
+#		endif
+		flush();
+		::close(fd);
+	}
+
+	Journal(const Journal&) = delete;
+	Journal& operator=(const Journal&) = delete;
+
+	// Without threads the main loop has to give us a turn.
+	void tick() {
+#		if !SKETCH_THREADS
+		service();
+#		endif
+	}
+
+	// Rebuilds whatever was autosaved at 'path' into 'doc',
+	// and numbers its versions on from the newest one seen
+	// there. Returns false if there was nothing to recover.
+	static bool recover(Document& doc, const std::string& path) {
+		auto slurp = [](const std::string& file) {
+			std::vector<uint8_t> data {};
+			int fd = ::open(file.c_str(), O_RDONLY);
+			if (fd < 0) return data;
+			uint8_t buf[1<<16];
+			for (ssize_t n; (n = ::read(fd, buf, sizeof buf)) > 0; )
+				data.insert(data.end(), buf, buf+n);
+			::close(fd);
+			return data;
+		};
+
+		std::size_t size = 0;
+		auto valid = [&](const DocEdit& e) {
+			return std::visit(Overloaded {
+				[&](const Edit::AppendAtom&)    { return true; },
+				[&](const Edit::ExtendStroke&)  { return size > 0; },
+				[&](const Edit::DeleteRange& e) { return e.first <= e.last && e.last <= size; },
+				[&](const Edit::ReplaceAtom& e) { return e.index < size; },
+				[&](const Edit::Splice& e)      { return e.first <= e.last && e.last <= size; }
+			}, e);
+		};
+		auto sizeAfter = [&](const DocEdit& e) {
+			std::visit(Overloaded {
+				[&](const Edit::AppendAtom&)    { size++; },
+				[&](const Edit::DeleteRange& e) { size -= e.last-e.first; },
+				[&](const Edit::Splice& e)      { size += e.atoms.size() - (e.last-e.first); },
+				[&](const auto&) {}
+			}, e);
+		};
+
+		bool found = false;
+		uint64_t version = 0, latest = 0;
+		Binary::Interned symbols {}; // So replayed instances share them
+		auto snapData = slurp(snapshotFile(path));
+		if (snapData.size() >= 8) {
+			std::span<const uint8_t> body {snapData.data(), snapData.size()-4};
+			Binary::Reader tail {std::span {snapData}.last(4)};
+			Binary::Reader r {body, false, &symbols};
+			if (tail.u32() == Binary::checksum(body) && r.u32() == SnapshotMagic) {
+				version = r.varint();
+				for (uint64_t n = r.varint(); n-- && r.ok; size++)
+					doc.apply(Edit::AppendAtom {r.atom()});
+				found = r.ok;
+			}
+		}
+
+		// Split the journal into records, stopping at the first
+		// one that's torn, and skip anything the snapshot has.
+		auto journal = slurp(journalFile(path));
+		std::vector<std::span<const uint8_t>> records {};
+		std::size_t skip = 0;
+		for (Binary::Reader r {journal}; !r.atEnd(); ) {
+			const uint32_t length = r.u32(), sum = r.u32();
+			if (!r.ok || length > journal.size()-r.offset()) break;
+			std::span<const uint8_t> payload {&journal[r.offset()], length};
+			if (Binary::checksum(payload) != sum) break;
+			r.skip(length);
+			records.push_back(payload);
+
+			Binary::Reader p {payload};
+			if (p.u8() != PublishTag) continue;
+			const uint64_t v = p.varint();
+			if (v <= version) skip = records.size();
+			latest = std::max(latest, v);
+		}
+		doc.resume(std::max(latest, version));
+
+		for (auto payload : records | views::drop(skip)) {
+			if (payload[0] == PublishTag) continue;
+			Binary::Reader r {payload, false, &symbols};
+			DocEdit e = r.edit();
+			if (!r.ok || !valid(e)) break;
+			sizeAfter(e);
+			doc.apply(std::move(e));
+			found = true;
+		}
+		return found;
+	}
+
+private:
+	static std::string journalFile (const std::string& p) { return p + ".journal";  }
+	static std::string snapshotFile(const std::string& p) { return p + ".snapshot"; }
+};
@@ -0,0 +1,250 @@
+#pragma once
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include "types.hh"
+#include "document.hh"
+#include "renderer.hh"
+#include "cold.hh"
+#include "simd.hh"
+#include "occlusion.hh"
+
+// Keeps a surface per layer for one view, each the layer drawn
+// on its own over white, and blends them together on demand.
+//
+// Layers are told apart by their Layer atom (the exact same
+// one, not an equal copy), so on a new document version every
+// layer whose atoms are all the same objects as before is left
+// alone. One that only had things added on the end just gets
+// those drawn on top, and any other change makes the whole
+// layer redraw. Surfaces are redrawn lazily, a tile at a time,
+// when something asks for that part of the screen.
+class LayerStack {
+	static constexpr int Tile = 64;
+
+	// The atoms are pointed to rather than shared, so each one
+	// has to stay alive (see 'synced') for as long as a surface
+	// might compare against it. Otherwise a freed atom's address
+	// could come back as a new one, and look unchanged.
+	struct Surface {
+		const Atom* header = nullptr; // Layer atom, none for the base layer
+		Layer props {};
+		std::vector<const Atom*> atoms {};
+		std::vector<Rect>        bounds {}; // Screen space, per atom
+		std::vector<uint32_t>    pixels {};
+		std::vector<bool>        valid  {}; // Per tile
+	};
+
+	unsigned W, H, tilesX, tilesY;
+	std::vector<Surface> layers;
+	PVector<Atom> synced; // The version 'layers' point into
+	Renderer painter;
+	Viewport view {};
+	uint32_t white;
+	std::vector<uint32_t> row;
+	std::vector<const Atom*> near;  // Scratch for render()
+	std::vector<Rect>        nearBounds;
+	std::vector<bool>        hidden;
+
+	Rect tileRect(std::size_t t) const {
+		const int x = t%tilesX*Tile, y = t/tilesX*Tile;
+		return Rect {x, y, x+Tile, y+Tile} & painter.bounds();
+	}
+
+	// Draws atoms [from, end) of a layer onto its surface.
+	void draw(Surface& l, std::size_t from, std::size_t fromPoint = 0) {
+		painter.retarget(l.pixels);
+		painter.clip = painter.bounds();
+		for (std::size_t i=from; i<l.atoms.size(); i++)
+			if (auto* s = std::get_if<Stroke>(l.atoms[i]); s && i == from && fromPoint)
+				painter.displayPoints(std::span {s->points}.subspan(fromPoint), s->colour, s->alpha);
+			else painter.displayAtom(*l.atoms[i]);
+	}
+
+public:
+	LayerStack(unsigned W, unsigned H,
+	           std::function<uint32_t(Col3)> map,
+	           std::function<Col3(uint32_t)> get)
+	: W{W}, H{H}
+	, tilesX{(W+Tile-1)/Tile}, tilesY{(H+Tile-1)/Tile}
+	, painter{{}, W, H, map, get}
+	, white{map({255,255,255})}
+	, row(W) {}
+
+	// Whether there's more than the base layer, which is the
+	// only time any of this is worth it.
+	bool layered() const { return layers.size() > 1 || (layers.size() == 1 && layers[0].header); }
+
+	// Frees every surface.
+	void clear() { layers.clear(), synced = {}; }
+
+	// Drops every surface if the view's different.
+	void setView(Viewport v) {
+		if (v == view) return;
+		view = painter.view = v;
+		for (Surface& l : layers) {
+			std::fill(l.valid.begin(), l.valid.end(), false);
+			l.bounds.clear();
+		}
+	}
+
+	// Catches up with the first 'n' atoms. Returns the part of
+	// the screen that looks different now.
+	Rect sync(const PVector<Atom>& atoms, std::size_t n = SIZE_MAX) {
+		n = std::min(n, atoms.size());
+		std::vector<Surface> next (1);
+		using It = PVector<Atom>::iterator;
+		for (It it {&atoms, 0}; it.index() < n; ++it) {
+			if (auto* l = std::get_if<Layer>(&*it)) {
+				next.emplace_back();
+				next.back().header = &*it;
+				next.back().props = *l;
+			}
+			else next.back().atoms.push_back(&*it);
+		}
+		if (next[0].atoms.empty() && next.size() > 1) next.erase(next.begin());
+
+		Rect dirty {0, 0, 0, 0};
+		const Rect screen = painter.bounds();
+		std::vector<bool> claimed (layers.size());
+		auto match = [&](const Surface& l) -> Surface* {
+			for (std::size_t i=0; i<layers.size(); i++)
+				if (!claimed[i] && layers[i].header == l.header) return &layers[i];
+			// An edited Layer atom is a new object, so fall
+			// back on the layer starting with the same atom.
+			for (std::size_t i=0; i<layers.size(); i++)
+				if (!claimed[i] && !l.atoms.empty() && !layers[i].atoms.empty()
+				&&  Cold::same(layers[i].atoms[0], l.atoms[0])) return &layers[i];
+			return nullptr;
+		};
+
+		for (std::size_t k=0; k<next.size(); k++) {
+			Surface& l = next[k];
+			const bool shown = l.props.visible;
+			Surface* old = match(l);
+			if (!old) {
+				l.pixels.assign(W*H, white);
+				l.valid.assign(tilesX*tilesY, false);
+				if (shown) dirty = screen;
+				continue;
+			}
+			claimed[old - layers.data()] = true;
+			// Anything that changes how it blends shows everywhere.
+			if ((shown || old->props.visible)
+			&&  (std::size_t(old - layers.data()) != k || shown != old->props.visible
+			||   l.props.opacity != old->props.opacity || l.props.blend != old->props.blend))
+				dirty = screen;
+
+			l.pixels = std::move(old->pixels);
+			l.valid  = std::move(old->valid);
+			l.bounds = std::move(old->bounds);
+			std::size_t same = 0;
+			while (same < l.atoms.size() && same < old->atoms.size()
+			&&     Cold::same(old->atoms[same], l.atoms[same])) same++;
+
+			std::size_t fromPoint = 0;
+			bool adds = same == old->atoms.size();
+			// The last stroke (or eraser) getting longer counts
+			// as adding too.
+			if (!adds && same+1 == old->atoms.size() && same < l.atoms.size()) {
+				auto* a = std::get_if<Stroke>(old->atoms[same]);
+				auto* b = std::get_if<Stroke>(l.atoms[same]);
+				adds = a && b && !a->points.empty() && a->points.size() <= b->points.size()
+				    && a->ends.empty() && b->ends.empty()
+				    && a->colour == b->colour && a->alpha == b->alpha
+				    && std::equal(a->points.begin(), a->points.end(), b->points.begin(),
+				                  [](Point p, Point q) { return p.x == q.x && p.y == q.y; });
+				fromPoint = adds ? a->points.size()-1 : 0;
+				auto* e = std::get_if<Eraser>(old->atoms[same]);
+				auto* f = std::get_if<Eraser>(l.atoms[same]);
+				if (e && f) adds = Masks::covers(f->shape, e->shape);
+			}
+			// The last stroke being fitted to a curve only
+			// needs redrawing where it is.
+			if (!adds && same+1 == old->atoms.size() && same+1 == l.atoms.size()
+			&&  Curves::refits(*old->atoms[same], *l.atoms[same])) {
+				const Rect r = painter.screenBounds(*old->atoms[same]) | painter.screenBounds(*l.atoms[same]);
+				l.bounds.resize(std::min(l.bounds.size(), same));
+				for (std::size_t t=0; t<l.valid.size(); t++)
+					if (tileRect(t).intersects(r)) l.valid[t] = false;
+				if (shown) dirty = dirty | (r & screen);
+				continue;
+			}
+			if (!adds) {
+				std::fill(l.valid.begin(), l.valid.end(), false);
+				l.bounds.clear();
+				if (shown) dirty = screen;
+				continue;
+			}
+			l.bounds.resize(std::min(l.bounds.size(), same));
+			Rect touched {0, 0, 0, 0};
+			for (std::size_t i=same; i<l.atoms.size(); i++)
+				if (auto* s = std::get_if<Stroke>(l.atoms[i]))
+					touched = touched | painter.screenBounds(
+						std::span {s->points}.subspan(i == same ? fromPoint : 0));
+				else touched = touched | painter.screenBounds(*l.atoms[i]);
+			draw(l, same, fromPoint);
+			if (shown) dirty = dirty | (touched & screen);
+			// A see-through stroke drawn on from where it left
+			// off is doubled up there, so those tiles start over.
+			auto* grew = same < old->atoms.size() ? std::get_if<Stroke>(l.atoms[same]) : nullptr;
+			if (grew && grew->alpha < 255)
+				for (std::size_t t=0; t<l.valid.size(); t++)
+					if (tileRect(t).intersects(touched)) l.valid[t] = false;
+		}
+		// Layers that went away show through.
+		for (std::size_t i=0; i<layers.size(); i++)
+			if (!claimed[i] && layers[i].props.visible) dirty = screen;
+		layers = std::move(next);
+		synced = atoms;
+		return dirty;
+	}
+
+	// Redraws whatever's stale on any visible layer within 'r'.
+	void render(Rect r) {
+		r = r & painter.bounds();
+		if (r.empty()) return;
+		for (Surface& l : layers) {
+			if (!l.props.visible) continue;
+			for (std::size_t i=l.bounds.size(); i<l.atoms.size(); i++)
+				l.bounds.push_back(painter.screenBounds(*l.atoms[i]));
+			painter.retarget(l.pixels);
+			for (unsigned ty = r.y0/Tile; ty*Tile < unsigned(r.y1); ty++)
+			for (unsigned tx = r.x0/Tile; tx*Tile < unsigned(r.x1); tx++) {
+				const std::size_t t = ty*tilesX + tx;
+				if (l.valid[t]) continue;
+				painter.clip = tileRect(t);
+				painter.clear();
+				near.clear(), nearBounds.clear();
+				for (std::size_t i=0; i<l.atoms.size(); i++)
+					if (l.bounds[i].intersects(painter.clip))
+						near.push_back(l.atoms[i]), nearBounds.push_back(l.bounds[i]);
+				Occlusion::cull(near, nearBounds, view, painter.clip, hidden);
+				for (std::size_t i=0; i<near.size(); i++)
+					if (!hidden[i]) painter.displayAtom(*near[i]);
+				l.valid[t] = true;
+			}
+		}
+		painter.clip = painter.bounds();
+	}
+
+	// Blends the visible layers within 'r' into 'out', which
+	// is W by H. Call render() on 'r' first.
+	void composite(std::span<uint32_t> out, Rect r) {
+		r = r & painter.bounds();
+		const std::size_t n = r.empty() ? 0 : r.x1 - r.x0;
+		for (int y=r.y0; y<r.y1; y++) {
+			std::fill_n(row.begin(), n, white);
+			for (const Surface& l : layers) {
+				if (!l.props.visible || l.props.opacity <= 0) continue;
+				const uint32_t* src = &l.pixels[y*W + r.x0];
+				const uint8_t opacity = std::clamp(l.props.opacity, 0.f, 1.f) * 255 + 0.5f;
+				switch (l.props.blend) {
+					case Blend::Darken:   SIMD::darken  (row.data(), src, n, opacity); break;
+					case Blend::Multiply: SIMD::multiply(row.data(), src, n, opacity); break;
+				}
+			}
+			std::copy_n(row.begin(), n, &out[y*W + r.x0]);
+		}
+	}
+};
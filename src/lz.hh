@@ -0,0 +1,106 @@
+#pragma once
+#include <vector>
+#include <span>
+#include <array>
+#include <optional>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+// Small LZ77 codec, laid out like LZ4's blocks: a token byte
+// with how many literals (top 4 bits) and how long the match
+// after them is less 4 (bottom 4), 15 meaning more follows in
+// bytes of 255 until one isn't. Then the literals, and the
+// match as a 2 byte offset back. The last sequence is only
+// literals. It's for squeezing what's already been delta and
+// varint coded, which leaves a lot of short repeats.
+namespace LZ
+{
+	constexpr std::size_t MinMatch = 4;
+	constexpr unsigned    HashBits = 12;
+
+	namespace detail
+	{
+		inline uint32_t read32(const uint8_t* p) { uint32_t x; std::memcpy(&x, p, 4); return x; }
+		inline uint32_t hash(uint32_t x) { return (x * 2654435761u) >> (32 - HashBits); }
+
+		inline void length(std::vector<uint8_t>& out, std::size_t n) {
+			for (; n >= 255; n -= 255) out.push_back(255);
+			out.push_back(n);
+		}
+	}
+
+	std::vector<uint8_t> compress(std::span<const uint8_t> in) {
+		using namespace detail;
+		std::vector<uint8_t> out {};
+		out.reserve(in.size()/2 + 16);
+		std::array<uint32_t, 1u << HashBits> last; // Where each hash was last seen, plus 1
+		last.fill(0);
+
+		auto emit = [&](std::size_t anchor, std::size_t literals, std::size_t offset, std::size_t match) {
+			const std::size_t m = match ? match - MinMatch : 0;
+			out.push_back(std::min<std::size_t>(literals, 15) << 4 | std::min<std::size_t>(m, 15));
+			if (literals >= 15) length(out, literals - 15);
+			out.insert(out.end(), in.begin()+anchor, in.begin()+anchor+literals);
+			if (!match) return;
+			out.push_back(offset), out.push_back(offset >> 8);
+			if (m >= 15) length(out, m - 15);
+		};
+
+		const std::size_t n = in.size();
+		std::size_t i = 0, anchor = 0;
+		while (i + MinMatch <= n) {
+			const uint32_t x = read32(&in[i]);
+			uint32_t& slot = last[hash(x)];
+			const std::size_t c = slot;
+			slot = i + 1;
+			if (c && i - (c-1) <= 0xffff && read32(&in[c-1]) == x) {
+				const std::size_t from = c-1;
+				std::size_t m = MinMatch;
+				while (i+m < n && in[from+m] == in[i+m]) m++;
+				emit(anchor, i - anchor, i - from, m);
+				i += m, anchor = i;
+				continue;
+			}
+			// Skips ahead faster the longer nothing's matched.
+			i += 1 + ((i - anchor) >> 6);
+		}
+		emit(anchor, n - anchor, 0, 0);
+		return out;
+	}
+
+	// Null if 'in' doesn't decode to exactly 'size' bytes.
+	std::optional<std::vector<uint8_t>> decompress(std::span<const uint8_t> in, std::size_t size) {
+		std::vector<uint8_t> out {};
+		out.reserve(size);
+		std::size_t i = 0;
+		auto length = [&](std::size_t n) -> std::optional<std::size_t> {
+			if (n < 15) return n;
+			for (;;) {
+				if (i == in.size()) return {};
+				const uint8_t b = in[i++];
+				n += b;
+				if (b != 255) return n;
+			}
+		};
+		while (i < in.size()) {
+			const uint8_t token = in[i++];
+			auto literals = length(token >> 4);
+			if (!literals || *literals > in.size()-i || out.size() + *literals > size) return {};
+			out.insert(out.end(), in.begin()+i, in.begin()+i+*literals);
+			i += *literals;
+			if (i == in.size()) break;
+
+			if (in.size()-i < 2) return {};
+			const std::size_t offset = in[i] | in[i+1] << 8;
+			i += 2;
+			auto m = length(token & 15);
+			if (!m || offset == 0 || offset > out.size() || out.size() + *m + MinMatch > size) return {};
+			// Byte by byte, since it can overlap what it's copying.
+			for (std::size_t k = out.size() - offset, left = *m + MinMatch; left--; k++)
+				out.push_back(out[k]);
+		}
+		if (out.size() != size) return {};
+		return out;
+	}
+};
@@ -5,6 +5,17 @@
 #include "window.hh"
 #include "external.hh"
 #include "renderer.hh"
+#include "render thread.hh"
+#include "history.hh"
+#include "journal.hh"
+#include "export.hh"
+#include "scheduler.hh"
+#include "decimate.hh"
+#include "curves.hh"
+#include "brush preview.hh"
+#include "flood.hh"
+#include "segments.hh"
+#include "cold.hh"
 #include "parser.hh"
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
@@ -12,41 +23,193 @@
 struct AppState {
 	bool quit = false;
 	
-	RawSketch example;
-	Point cursor;
+	Document doc;
+	History history;
+	std::optional<Journal> journal; // After 'doc', so it goes first
+	Point cursor;      // In document coordinates
+	Vec2  mouse {};    // In screen coordinates
+	BrushPreview brush {};
+	bool brushMoved = true;
 	bool pressed = false;
+	Decimator decimator {};  // Thins out the stroke being drawn
+	Col3    colour {0, 0, 0}; // What new strokes are drawn with
+	uint8_t alpha = 255;
+	enum struct Tool { Pen, Bucket, Eraser, Cutter } tool = Tool::Pen;
+	SegmentIndex segments {}; // For the cutter
+	ColdStore cold {};        // Packs away strokes nobody's touched
+	bool packing = false;     // A sweep's under way
+	Point cutFrom {};
+	unsigned eraseScale = 1;  // Of the eraser being drawn, see eraserScale()
+	std::optional<Vec2> bucketAt; // A bucket click, done when presenting
+
+	Viewport view {};
+	bool panning = false;
+	uint32_t lastWheel = 0;
+	ViewChange sentView {};
+
+	Governor  governor {};
+	Scheduler scheduler {};
+
+	// Timeline playback, in atoms. Not set when live.
+	std::optional<std::size_t> playhead;
+	bool playing = false;
+	std::size_t playFrom = 0; // Where playing last started, and when
+	Scheduler::Clock::time_point playStart {};
+
+	std::atomic<bool> exporting = false;
+#	if SKETCH_THREADS
+	std::jthread exporter;
+#	endif
 };
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
-void draw(Window& w, Renderer& r, const AppState& s) {
-	r.clear();
-	r.displayRaw(s.example);
-	w.updatePixels();
+// Exports a 10 second time-lapse off the main thread.
+void exportTimelapse(AppState& s) {
+	if (s.exporting.exchange(true)) return;
+	auto job = [&s, atoms = s.doc.published().atoms] {
+		Export::Options o {};
+		o.frames = 10*o.fps;
+		std::cout << (Export::y4m(atoms, "timelapse.y4m", o)
+			? "Exported timelapse.y4m\n" : "Export failed!\n");
+		s.exporting = false;
+	};
+#	if SKETCH_THREADS
+	s.exporter = std::jthread {job};
+#	else
+	job();
+#	endif
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+// Erasers are the same size on screen whatever the zoom.
+unsigned eraserSize(const Viewport& v) {
+	return std::max<unsigned>(1, std::lround(16 / v.zoom));
+}
+
+// Zoomed in, an eraser's mask gets finer than the document, so
+// it isn't blocky on screen. Up to 8 of its pixels to one.
+unsigned eraserScale(const Viewport& v) {
+	unsigned k = 1;
+	while (k < 8 && 2*k <= v.zoom) k *= 2;
+	return k;
 }
 
-bool detectEvents(AppState& s) {
+// Where the pointer is in a mask 'scale' times finer.
+Point maskPoint(const Viewport& v, Vec2 mouse, unsigned scale) {
+	const Vec2 d = v.toDocument(mouse);
+	auto clamp = [](Real x) { return (int16_t) std::clamp<long>(std::lround(x), INT16_MIN, INT16_MAX); };
+	return {clamp(d.x*scale), clamp(d.y*scale), JS::penPressure};
+}
+
+// How long after the last wheel tick zooming counts as over.
+constexpr uint32_t WheelSettle = 150;
+
+// How much of an idle loop iteration background jobs can have.
+constexpr std::chrono::milliseconds IdleSlice {4};
+
+bool detectEvents(RenderThread& r, AppState& s) {
 	bool input = false;
 	for (SDL_Event ev; SDL_PollEvent(&ev); input=true)
 	switch (ev.type) {
 		case SDL_QUIT:
 			s.quit = true;
 			break;
-		case SDL_MOUSEMOTION:
+		case SDL_MOUSEMOTION: {
+			if (s.panning) {
+				s.view.x -= ev.motion.xrel / s.view.zoom;
+				s.view.y -= ev.motion.yrel / s.view.zoom;
+			}
+			s.mouse = {(Real) ev.motion.x, (Real) ev.motion.y};
+			s.brushMoved = true;
+			Vec2 d = s.view.toDocument(s.mouse);
 			s.cursor = {
-				(int16_t) ev.motion.x,
-				(int16_t) ev.motion.y,
+				(int16_t) std::lround(d.x),
+				(int16_t) std::lround(d.y),
 				JS::penPressure
 			};
-			break;
+			if (s.pressed && s.tool == AppState::Tool::Eraser)
+				s.history.apply(s.doc, Edit::ExtendStroke {maskPoint(s.view, s.mouse, s.eraseScale)});
+			else if (s.pressed && s.tool == AppState::Tool::Cutter) {
+				s.segments.erase(s.doc, s.history, s.cutFrom, s.cursor, eraserSize(s.view) / 2.f);
+				s.cutFrom = s.cursor;
+			}
+			else if (s.pressed)
+				if (auto p = s.decimator.add(s.cursor))
+					s.history.apply(s.doc, Edit::ExtendStroke {*p});
+			r.send(InputSample {s.cursor, s.pressed});
+		} break;
 		case SDL_MOUSEBUTTONDOWN:
+			// Middle or right drag pans the view.
+			if (ev.button.button != SDL_BUTTON_LEFT) {
+				s.panning = true;
+				break;
+			}
+			// Drawing always goes back to the live document.
+			if (s.tool == AppState::Tool::Bucket) {
+				// It fills what's on screen, so not mid-playback.
+				if (!s.playhead) s.bucketAt = s.mouse;
+				s.playhead.reset(), s.playing = false;
+				r.seek(RenderThread::Live);
+				break;
+			}
+			s.playhead.reset(), s.playing = false;
+			r.seek(RenderThread::Live);
 			s.pressed = true;
 			s.cursor.pressure = JS::penPressure;
+			if (s.tool == AppState::Tool::Eraser) {
+				const unsigned k = s.eraseScale = eraserScale(s.view);
+				s.history.apply(s.doc, Edit::AppendAtom {
+					Masks::start(std::max<unsigned>(1, std::lround(16 / s.view.zoom * k)), maskPoint(s.view, s.mouse, k), k)
+				});
+			}
+			else if (s.tool == AppState::Tool::Cutter) {
+				// The whole drag is one step to undo.
+				s.history.begin();
+				s.segments.erase(s.doc, s.history, s.cursor, s.cursor, eraserSize(s.view) / 2.f);
+				s.cutFrom = s.cursor;
+			}
+			else {
+				// Half a screen pixel, whatever the zoom.
+				s.decimator.tolerance = 0.5f / s.view.zoom;
+				s.decimator.begin(s.cursor);
+				s.history.apply(s.doc, Edit::AppendAtom {Stroke {3, {s.cursor}, s.colour, s.alpha}});
+			}
+			r.send(InputSample {s.cursor, s.pressed});
 			break;
 		case SDL_MOUSEBUTTONUP:
+			if (ev.button.button != SDL_BUTTON_LEFT) {
+				s.panning = false;
+				break;
+			}
+			if (s.pressed && s.tool == AppState::Tool::Pen) {
+				if (auto p = s.decimator.end())
+					s.history.apply(s.doc, Edit::ExtendStroke {*p});
+				// Done, so it can be a curve now.
+				const PVector<Atom>& atoms = s.doc.latest().atoms;
+				if (auto* stroke = atoms.empty() ? nullptr : std::get_if<Stroke>(&atoms.back()))
+					if (auto curve = Curves::fit(*stroke, 1 / s.view.zoom))
+						s.history.amend(s.doc, Edit::ReplaceAtom {atoms.size()-1, std::move(*curve)});
+			}
+			if (s.pressed && s.tool == AppState::Tool::Cutter) s.history.end();
 			s.pressed = false;
 			s.cursor.pressure = 0.0;
+			r.send(InputSample {s.cursor, s.pressed});
 			break;
+		case SDL_MOUSEWHEEL: {
+			// Zooms around whatever's under the mouse.
+			Vec2 d = s.view.toDocument(s.mouse);
+			s.view.zoom = clamp(s.view.zoom * std::pow(1.1f, ev.wheel.y), 1/16.f, 32);
+			s.view.x = d.x - s.mouse.x/s.view.zoom;
+			s.view.y = d.y - s.mouse.y/s.view.zoom;
+			s.lastWheel = SDL_GetTicks();
+			s.brushMoved = true;
+			// One more frame once it's settled, to say so.
+			s.scheduler.after(std::chrono::milliseconds {WheelSettle}, [&s] {
+				s.scheduler.requestFrame();
+			});
+		} break;
 		case SDL_KEYDOWN:
 			switch (ev.key.keysym.sym) {
 				case SDLK_ESCAPE:
@@ -58,6 +221,61 @@ bool detectEvents(AppState& s) {
 				case SDLK_v:
 					JS::paste();
 					break;
+				// Undoing halfway through drawing something ends
+				// it there, the rest of the drag doesn't count.
+				case SDLK_z:
+					if (!(ev.key.keysym.mod & KMOD_CTRL)) break;
+					s.pressed = false;
+					if (ev.key.keysym.mod & KMOD_SHIFT)
+						s.history.redo(s.doc);
+					else
+						s.history.undo(s.doc);
+					break;
+				case SDLK_y:
+					if (!(ev.key.keysym.mod & KMOD_CTRL)) break;
+					s.pressed = false;
+					s.history.redo(s.doc);
+					break;
+				case SDLK_e:
+					exportTimelapse(s);
+					break;
+				case SDLK_p:
+					if (!s.playhead) s.playhead = 0;
+					s.playing = !s.playing;
+					s.playFrom = *s.playhead, s.playStart = Scheduler::Clock::now();
+					break;
+				case SDLK_b:
+					s.tool = s.tool == AppState::Tool::Bucket
+						? AppState::Tool::Pen : AppState::Tool::Bucket;
+					s.brushMoved = true;
+					break;
+				// Shift for the one that cuts strokes up instead.
+				case SDLK_x: {
+					const auto tool = ev.key.keysym.mod & KMOD_SHIFT
+						? AppState::Tool::Cutter : AppState::Tool::Eraser;
+					s.tool = s.tool == tool ? AppState::Tool::Pen : tool;
+					s.brushMoved = true;
+				} break;
+				// Black, red, blue, green, and a see-through
+				// yellow for highlighting.
+				case SDLK_1: s.colour = {  0,   0,   0}, s.alpha = 255; break;
+				case SDLK_2: s.colour = {208,  48,  32}, s.alpha = 255; break;
+				case SDLK_3: s.colour = { 32,  80, 200}, s.alpha = 255; break;
+				case SDLK_4: s.colour = { 32, 150,  64}, s.alpha = 255; break;
+				case SDLK_5: s.colour = {255, 220,   0}, s.alpha = 96;  break;
+				case SDLK_LEFT:
+				case SDLK_RIGHT: {
+					// Shift scrubs by a tenth of the timeline.
+					const std::size_t size = s.doc.latest().atoms.size();
+					const std::size_t step = ev.key.keysym.mod & KMOD_SHIFT
+						? std::max<std::size_t>(1, size/10) : 1;
+					std::size_t at = s.playhead.value_or(size);
+					at = ev.key.keysym.sym == SDLK_LEFT
+						? at - std::min(at, step)
+						: std::min(size, at + step);
+					s.playhead = at, s.playing = false;
+					r.seek(at);
+				} break;
 			} break;
 	}
 	return input;
@@ -65,8 +283,78 @@ bool detectEvents(AppState& s) {
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
-void appLoopBody(Window& w, Renderer& r, AppState& s) {
-	if (detectEvents(s)) draw(w,r,s);
+// Rendering happens on its own thread, this only polls
+// input and hands over whichever frame is newest. When
+// there's none of that to do it gives idle jobs a turn.
+void appLoopBody(Window& w, RenderThread& r, AppState& s) {
+	s.governor.begin();
+	const bool input = detectEvents(r,s);
+	const bool wanted = s.scheduler.due();
+	if (!input && !wanted && !s.playing && !r.busy()) {
+		s.scheduler.runIdle(IdleSlice);
+		s.governor.skip();
+		return;
+	}
+	s.governor.lap(Governor::Events);
+	if (s.playing) {
+		// Plays the whole timeline in about ten seconds (short
+		// ones at 60 atoms a second), going by the clock rather
+		// than how many frames there have been.
+		const std::size_t size = s.doc.latest().atoms.size();
+		const double rate = std::max<std::size_t>(size, 600) / 10.0;
+		const std::chrono::duration<double> t = Scheduler::Clock::now() - s.playStart;
+		s.playhead = s.playFrom + std::size_t(t.count() * rate);
+		if (*s.playhead >= size) s.playhead.reset(), s.playing = false;
+		r.seek(s.playhead.value_or(RenderThread::Live));
+	}
+	s.scheduler.animating = s.playing;
+	// Anything moving the view lets the renderer cut corners
+	// until it settles, then it sharpens up on its own.
+	const ViewChange v {
+		s.view,
+		s.panning || s.playing || SDL_GetTicks() - s.lastWheel < WheelSettle
+	};
+	if (v.view != s.sentView.view || v.interacting != s.sentView.interacting)
+		r.send(s.sentView = v);
+	// The bucket fills what was last presented, without the
+	// brush on top of it.
+	if (s.bucketAt) {
+		const Rect hidden = s.brush.hide(w.pixels, w.width());
+		w.updatePixels({&hidden, 1});
+		if (auto fill = Flood::bucket(w.pixels, w.width(), w.height(), *s.bucketAt, s.view)) {
+			fill->colour = s.colour, fill->alpha = s.alpha;
+			s.history.apply(s.doc, Edit::AppendAtom {std::move(*fill)});
+		}
+		s.bucketAt.reset();
+		s.brushMoved = true;
+	}
+	// Once per loop rather than per edit, so a fast pen
+	// doesn't make a new version for every sample.
+	if (s.doc.publish()) r.documentChanged();
+	s.governor.lap(Governor::Events);
+	// A new frame covers the brush, otherwise only the bits
+	// of screen it moved between need sending.
+	const bool frame = r.present(w.pixels);
+	if (frame) s.brush.frameReplaced();
+	if (frame || s.brushMoved) {
+		const bool erasing = s.tool == AppState::Tool::Eraser || s.tool == AppState::Tool::Cutter;
+		const Real radius = erasing
+			? eraserSize(s.view) * s.view.zoom / 2
+			: std::max<Real>(3, 1.5f*s.view.zoom);
+		const auto moved = s.brush.move(w.pixels, w.width(), w.height(), s.mouse, radius);
+		if (frame) w.updatePixels();
+		else       w.updatePixels(moved);
+		s.brushMoved = false;
+	}
+	s.governor.lap(Governor::Present);
+	// Without threads present() did the drawing, so that
+	// part of its time is really raster.
+	const auto raster = r.rasterTime();
+#	if !SKETCH_THREADS
+	s.governor.add(Governor::Present, -raster);
+#	endif
+	s.governor.add(Governor::Raster, raster);
+	if (s.governor.endFrame()) r.send(s.governor.settings());
 }
 
 int main() {
@@ -77,8 +365,10 @@ int main() {
 	static // Emscripten destructs this early if it's not set static.
 	Window window {title.c_str(), 800, 600};
 	AppState state {};
-	Renderer renderer {
-		window.pixels, window.width(), window.height(),
+	// Lets the render thread wake up a sleeping main loop.
+	static const uint32_t FrameReady = SDL_RegisterEvents(1);
+	RenderThread renderer {
+		state.doc, window.width(), window.height(),
 		[=](Col3 c) -> uint32_t {
 			return SDL_MapRGB(window.format, c.r, c.g, c.b);
 		},
@@ -86,11 +376,19 @@ int main() {
 			Col3 c;
 			SDL_GetRGB(pixel, window.format, &c.r, &c.g, &c.b);
 			return c;
+		},
+		[] {
+			SDL_Event ev {};
+			ev.type = FrameReady;
+			SDL_PushEvent(&ev);
 		}
 	};
 
+	if (Journal::recover(state.doc, "autosave")) {
+		std::cout << "Recovered autosave.\n";
+	}
 	// Gives a whole new meaning to 'if'stream, huh? :^)
-	if (std::ifstream input {"example file.hsc"}; !input) {
+	else if (std::ifstream input {"example file.hsc"}; !input) {
 		std::cerr << "File not found!.\n";
 	}
 	else  {
@@ -104,9 +402,35 @@ int main() {
 		std::cout << "\n#### ELEMENTS ####\n";
 		if (auto sketch = SketchFormat::parse(tokens)) {
 			std::cout << *sketch << "\n";
+			for (const Atom& a : sketch->atoms)
+				state.doc.apply(Edit::AppendAtom {a});
 		}
 		std::cout << "\n#### END ####\n";
 	}
+	state.brush.colour = SDL_MapRGB(window.format, 96, 96, 96);
+	state.doc.publish();
+	state.journal.emplace(state.doc, "autosave");
+	// Every so often, whenever there's nothing else going on,
+	// packs away a batch of old strokes at a time.
+	state.scheduler.every(std::chrono::seconds {10}, [&] {
+		if (std::exchange(state.packing, true)) return;
+		state.scheduler.whenIdle([&] {
+			state.packing = state.cold.step(state.doc);
+			// Readers see no change, so there's nothing to redraw.
+			state.doc.settle();
+			return state.packing;
+		});
+	});
+#	if !SKETCH_THREADS
+	// No worker threads to do these on their own.
+	state.scheduler.every(std::chrono::milliseconds {250}, [&] {
+		state.journal->tick();
+	});
+	state.scheduler.whenIdle([&] {
+		renderer.idle(IdleSlice);
+		return true;
+	});
+#	endif
 
 #	ifdef __EMSCRIPTEN__
 		JS::listenForPenPressure();
@@ -125,6 +449,11 @@ int main() {
 			0, true
 		);
 #	else
-		while (!state.quit) appLoopBody(window, state);
+		// Sleeps until there's input, a frame from the render
+		// thread, or a timer due, instead of spinning.
+		while (!state.quit) {
+			SDL_WaitEventTimeout(nullptr, state.scheduler.timeout().count());
+			appLoopBody(window, renderer, state);
+		}
 #	endif
 }
\ No newline at end of file
@@ -0,0 +1,128 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "types.hh"
+#include "math.hh"
+
+// Building masks up out of eraser strokes. Only the mask gets
+// bigger: erasing never looks at what's under it, so it costs
+// the same however much has been drawn.
+namespace Masks
+{
+	constexpr int Tile = Mask::Tile;
+
+	// Which block a pixel is in, rounding down.
+	constexpr int blockOf(int x) { return x >= 0 ? x / Tile : (x+1) / Tile - 1; }
+
+	Mask::Block& block(Mask& m, int tx, int ty) {
+		auto it = ranges::lower_bound(m.blocks, std::pair {ty, tx}, {},
+			[](const Mask::Block& b) { return std::pair<int,int> {b.ty, b.tx}; });
+		if (it == m.blocks.end() || it->tx != tx || it->ty != ty)
+			it = m.blocks.insert(it, Mask::Block {int16_t(tx), int16_t(ty)});
+		return *it;
+	}
+
+	// Adds [x0, x1) of row y.
+	void add(Mask& m, int y, int x0, int x1) {
+		if (x0 >= x1) return;
+		if (m.x0 == m.x1) m.x0 = x0, m.x1 = x1, m.y0 = y, m.y1 = y+1;
+		m.x0 = std::min<int>(m.x0, x0), m.x1 = std::max<int>(m.x1, x1);
+		m.y0 = std::min<int>(m.y0, y),  m.y1 = std::max<int>(m.y1, y+1);
+
+		const int ty = blockOf(y), r = y - ty*Tile;
+		std::vector<uint8_t> merged {};
+		for (int tx=blockOf(x0); tx<=blockOf(x1-1); tx++) {
+			Mask::Block& b = block(m, tx, ty);
+			int a = std::max(x0 - tx*Tile, 0), z = std::min(x1 - tx*Tile, Tile);
+			// Runs it overlaps or touches get swallowed up.
+			merged.clear();
+			const auto first = b.runs.begin() + b.rows[r], last = b.runs.begin() + b.rows[r+1];
+			bool placed = false;
+			for (auto i=first; i<last; i+=2) {
+				if (i[1] < a) { merged.push_back(i[0]), merged.push_back(i[1]); continue; }
+				if (i[0] > z) {
+					if (!placed) merged.push_back(a), merged.push_back(z), placed = true;
+					merged.push_back(i[0]), merged.push_back(i[1]);
+					continue;
+				}
+				a = std::min<int>(a, i[0]), z = std::max<int>(z, i[1]);
+			}
+			if (!placed) merged.push_back(a), merged.push_back(z);
+			const int grew = int(merged.size()) - int(last - first);
+			b.runs.insert(b.runs.erase(first, last), merged.begin(), merged.end());
+			for (int k=r+1; k<=Tile; k++) b.rows[k] += grew;
+		}
+	}
+
+	// Adds every pixel whose centre is within 'radius' of the
+	// segment from a to b.
+	void add(Mask& m, Point a, Point b, Real radius) {
+		const Vec2 p {Real(a.x), Real(a.y)}, q {Real(b.x), Real(b.y)};
+		const Vec2 d {q.x-p.x, q.y-p.y};
+		const Real l = len(d);
+		const Vec2 n = l > 0 ? Vec2 {-d.y/l*radius, d.x/l*radius} : Vec2 {0, 0};
+		// The sides of the stroke, without the round ends.
+		const std::array<Vec2,4> side {{
+			{p.x+n.x, p.y+n.y}, {q.x+n.x, q.y+n.y},
+			{q.x-n.x, q.y-n.y}, {p.x-n.x, p.y-n.y}
+		}};
+		const int y0 = std::floor(std::min(p.y, q.y) - radius);
+		const int y1 = std::ceil (std::max(p.y, q.y) + radius);
+		for (int y=y0; y<=y1; y++) {
+			const Real c = y + Real(0.5);
+			Real lo = INFINITY, hi = -INFINITY;
+			for (Vec2 e : {p, q})
+				if (const Real dy = std::abs(c - e.y); dy <= radius) {
+					const Real w = std::sqrt(radius*radius - dy*dy);
+					lo = std::min(lo, e.x-w), hi = std::max(hi, e.x+w);
+				}
+			if (l > 0)
+				for (int i=0; i<4; i++) {
+					const Vec2 s = side[i], t = side[(i+1) % 4];
+					if ((s.y - c) * (t.y - c) > 0 || s.y == t.y) continue;
+					const Real x = s.x + (c - s.y) * (t.x - s.x) / (t.y - s.y);
+					lo = std::min(lo, x), hi = std::max(hi, x);
+				}
+			if (lo > hi) continue;
+			add(m, y, std::ceil(lo - Real(0.5)), std::floor(hi - Real(0.5)) + 1);
+		}
+	}
+
+	// Carries the eraser on to 'p', in the mask's pixels.
+	void extend(Eraser& e, Point p) {
+		add(e.shape, e.tip, p, e.diameter / Real(2));
+		e.tip = p;
+	}
+
+	Eraser start(unsigned diameter, Point p, unsigned scale = 1) {
+		Eraser e {diameter, {}, p, uint8_t(scale)};
+		extend(e, p);
+		return e;
+	}
+
+	// Whether every pixel in 'small' is in 'big' too.
+	bool covers(const Mask& big, const Mask& small) {
+		bool all = true;
+		auto it = big.blocks.begin();
+		for (const Mask::Block& s : small.blocks) {
+			while (it != big.blocks.end() && std::pair {it->ty, it->tx} < std::pair {s.ty, s.tx}) ++it;
+			if (it == big.blocks.end() || it->tx != s.tx || it->ty != s.ty) return false;
+			for (int r=0; r<Tile && all; r++)
+			for (int i=s.rows[r]; i<s.rows[r+1] && all; i+=2) {
+				bool in = false;
+				for (int j=it->rows[r]; j<it->rows[r+1] && !in; j+=2)
+					in = it->runs[j] <= s.runs[i] && s.runs[i+1] <= it->runs[j+1];
+				all = in;
+			}
+		}
+		return all;
+	}
+
+	std::size_t bytes(const Mask& m) {
+		std::size_t n = m.blocks.capacity() * sizeof(Mask::Block);
+		for (const Mask::Block& b : m.blocks) n += b.runs.capacity();
+		return n;
+	}
+};
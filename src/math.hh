@@ -1,10 +1,35 @@
 #pragma once
 #include <cmath>
 #include <cassert>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+#include <cstddef>
 
 using Real = float;
 struct Vec2 { Real x, y; };
 
+// Integer pixel rectangle, [x0,x1) by [y0,y1).
+struct Rect {
+	int x0, y0, x1, y1;
+	bool empty() const { return x0 >= x1 || y0 >= y1; }
+	bool intersects(Rect o) const {
+		return x0 < o.x1 && o.x0 < x1 && y0 < o.y1 && o.y0 < y1;
+	}
+	Rect operator&(Rect o) const {
+		return {std::max(x0,o.x0), std::max(y0,o.y0),
+		        std::min(x1,o.x1), std::min(y1,o.y1)};
+	}
+	// Smallest rect holding both, ignoring empty ones.
+	Rect operator|(Rect o) const {
+		if (empty()) return o;
+		if (o.empty()) return *this;
+		return {std::min(x0,o.x0), std::min(y0,o.y0),
+		        std::max(x1,o.x1), std::max(y1,o.y1)};
+	}
+	Rect moved(int dx, int dy) const { return {x0+dx, y0+dy, x1+dx, y1+dy}; }
+};
+
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
 template <typename... Ts> Real
@@ -40,6 +65,14 @@ Real len (Vec2 a)         { return sqrt(dot2(a)); }
 Vec2 norm(Vec2 a)         { return {a.x/len(a), a.y/len(a)}; }
 
 
+// FNV-1a, for telling things apart by what's in them.
+uint64_t fnv(const void* data, std::size_t n, uint64_t h = 0xcbf29ce484222325) {
+	for (std::size_t i=0; i<n; i++)
+		h = (h ^ static_cast<const uint8_t*>(data)[i]) * 0x100000001b3;
+	return h;
+}
+
+
 Real SDFline(Vec2 p, Vec2 a, Vec2 b) {
 	Vec2 c = {p.x-a.x, p.y-a.y};
 	Vec2 d = {b.x-a.x, b.y-a.y};
@@ -0,0 +1,99 @@
+#pragma once
+#include <vector>
+#include <span>
+#include <algorithm>
+#include <cstdint>
+#include "types.hh"
+#include "renderer.hh"
+
+// Skips drawing whatever's hidden under opaque fills anyway.
+//
+// A tile (64 pixels at most) is split into 8x8 cells, one bit
+// each. Going through a tile's atoms from the top down, every
+// opaque fill adds the cells it covers completely, and any
+// atom whose bounds only touch cells that are covered already
+// can't show up, so it doesn't get drawn at all.
+namespace Occlusion
+{
+	constexpr int Cell = 8;
+
+	// Cells of 'tile' that 'r' touches at all.
+	uint64_t touched(Rect r, Rect tile) {
+		r = r & tile;
+		if (r.empty()) return 0;
+		const int cx0 = (r.x0-tile.x0)/Cell, cx1 = (r.x1-tile.x0 + Cell-1)/Cell;
+		const int cy0 = (r.y0-tile.y0)/Cell, cy1 = (r.y1-tile.y0 + Cell-1)/Cell;
+		uint64_t row = 0, cells = 0;
+		for (int x=cx0; x<cx1; x++) row |= 1ull << x;
+		for (int y=cy0; y<cy1; y++) cells |= row << 8*y;
+		return cells;
+	}
+
+	// Cells of 'tile' that every pixel of is painted by 'f'.
+	// Cells with an edge going through them (or within a
+	// pixel of them) never count.
+	uint64_t covered(const Fill& f, Viewport v, Rect tile) {
+		if (f.alpha < 255 || f.outline.size() < 3) return 0;
+		struct Edge { Vec2 a, b; };
+		std::vector<Edge> edges {};
+		f.edges([&](Point a, Point b) { edges.push_back({v.toScreen(a), v.toScreen(b)}); });
+
+		uint64_t cells = 0;
+		std::vector<std::pair<Real,int>> xs {}; // Where the row's middle crosses, and which way
+		for (int cy=0; cy<8 && tile.y0 + cy*Cell < tile.y1; cy++) {
+			const Real y0 = tile.y0 + cy*Cell;
+			const Real y1 = std::min(y0 + Cell, Real(tile.y1));
+			const Real mid = (y0 + y1) / 2;
+			unsigned near = 0; // Cells in this row an edge goes through
+			xs.clear();
+			for (auto [a, b] : edges) {
+				if ((a.y <= mid) != (b.y <= mid))
+					xs.push_back({a.x + (mid-a.y) * (b.x-a.x) / (b.y-a.y), a.y < b.y ? 1 : -1});
+				if (std::max(a.y, b.y) < y0-1 || std::min(a.y, b.y) > y1+1) continue;
+				// Where the edge is while it's in this row.
+				Real ex0 = a.x, ex1 = b.x;
+				if (a.y != b.y) {
+					const Real t0 = std::clamp((y0-1 - a.y) / (b.y-a.y), Real(0), Real(1));
+					const Real t1 = std::clamp((y1+1 - a.y) / (b.y-a.y), Real(0), Real(1));
+					ex0 = a.x + t0*(b.x-a.x), ex1 = a.x + t1*(b.x-a.x);
+				}
+				if (ex0 > ex1) std::swap(ex0, ex1);
+				const int c0 = std::max<int>(0, std::floor((ex0-1 - tile.x0) / Cell));
+				const int c1 = std::min<int>(7, std::floor((ex1+1 - tile.x0) / Cell));
+				for (int c=c0; c<=c1; c++) near |= 1u << c;
+			}
+			ranges::sort(xs);
+			std::size_t i = 0;
+			int winding = 0;
+			for (int cx=0; cx<8; cx++) {
+				const Real x = tile.x0 + cx*Cell + Cell/2;
+				for (; i<xs.size() && xs[i].first < x; i++) winding += xs[i].second;
+				const bool inside = f.rule == FillRule::NonZero ? winding : winding % 2;
+				if (inside && !(near >> cx & 1)) cells |= 1ull << (8*cy + cx);
+			}
+		}
+		return cells;
+	}
+
+	// 'atoms' are the ones touching 'tile' in drawing order,
+	// with their bounds (all in 'v's screen space). Sets
+	// hidden[i] for each one that can't be seen.
+	void cull(std::span<const Atom* const> atoms, std::span<const Rect> bounds,
+	          Viewport v, Rect tile, std::vector<bool>& hidden) {
+		hidden.assign(atoms.size(), false);
+		const bool any = ranges::any_of(atoms, [](const Atom* a) {
+			auto* f = std::get_if<Fill>(a);
+			return f && f->alpha == 255;
+		});
+		if (!any) return;
+
+		const uint64_t all = touched(tile, tile);
+		uint64_t opaque = 0;
+		for (std::size_t i=atoms.size(); i--; ) {
+			if ((opaque & all) == all) { hidden[i] = true; continue; }
+			if (!(touched(bounds[i], tile) & ~opaque)) { hidden[i] = true; continue; }
+			if (auto* f = std::get_if<Fill>(atoms[i]))
+				opaque |= covered(*f, v, tile);
+		}
+	}
+};
@@ -9,6 +9,8 @@
 #include <concepts>
 #include "types.hh"
 #include "math.hh"
+#include "mask.hh"
+#include "symbols.hh"
 
 class ParserBase {
 protected: // Useful functions for parsing:
@@ -18,6 +20,8 @@ protected: // Useful functions for parsing:
 	static constexpr bool isUppercase (char c) { return 'A' <= c&&c <= 'Z'; }
 	static constexpr bool isBase10    (char c) { return '0' <= c&&c <= '9'; }
 	static constexpr bool isBase36    (char c) { return isBase10(c) || isLowercase(c) || isUppercase(c); }
+	static constexpr bool isHex       (char c) { return isBase10(c) || ('a' <= c&&c <= 'f'); }
+	static constexpr int  hexDigit    (char c) { return isBase10(c) ? c-'0' : c-'a'+10; }
 
 	template <std::size_t N, std::integral T=signed>
 	static constexpr T base36(std::string_view str) {
@@ -219,9 +223,18 @@ private:
 		std::pair { "Data"sv  , V{ tUnbounded{tBase36, 1} }},
 		std::pair { "Pencil"sv, V{ tUnbounded{tBase36, 1} }},
 		std::pair { "Brush"sv , V{ tUnbounded{tBase36, 2} }},
+		std::pair { "Fill"sv  , V{ tUnbounded{tBase36, 1} }},
 		std::pair { "Affine"sv, V{ tBounded  {tNumber, 9} }},
 		std::pair { "Marker"sv, V{ tSingle   {tString   } }},
-		/* TODO: Mask */
+		std::pair { "Layer"sv , V{ tBounded  {tNumber, 4} }},
+		std::pair { "Colour"sv, V{ tBounded  {tNumber, 2} }},
+		std::pair { "Erase"sv , V{ tUnbounded{tBase36, 1} }},
+		std::pair { "Lettering"sv, V{ tBounded{tNumber, 4} }},
+		std::pair { "Pattern"sv, V{ tUnbounded{tBase36, 1} }},
+		std::pair { "Region"sv , V{ tUnbounded{tBase36, 1} }},
+		std::pair { "Curve"sv  , V{ tUnbounded{tBase36, 2} }},
+		std::pair { "Symbol"sv , V{ tSingle   {tString   } }},
+		std::pair { "Use"sv    , V{ tSingle   {tString   } }},
 	};
 
 	struct ElementData {
@@ -229,6 +242,63 @@ private:
 		std::span<const Token> members;
 	};
 
+	// Data, Pencil and Brush members: each stroke is its points,
+	// after its diameter for Brush.
+	static std::vector<Stroke> strokes(std::span<const Token> members, bool isBrush) {
+		std::vector<Stroke> result {};
+		for (std::size_t j=0; j<members.size(); /**/) {
+			unsigned diameter = isBrush
+				? base36<2,unsigned>(members[j++])
+				: 3;
+			if (j == members.size()) break;
+			Stroke stroke {diameter, {}};
+			std::string digits {};
+			for (char c : members[j++]) {
+				if (c == '\'') continue;
+				digits.push_back(c);
+				if (digits.size() < (isBrush? 8:6)) continue;
+				stroke.points.push_back(Point {
+					.x = base36<3,int16_t>(digits.substr(0, 3)),
+					.y = base36<3,int16_t>(digits.substr(3, 3)),
+					.pressure = isBrush
+						? base36<2,unsigned>(digits.substr(6,2))
+							/ float(36*36-1)
+						: 1.0f
+				});
+				digits.clear();
+			}
+			assert(digits.empty());
+			result.push_back(stroke);
+		}
+		return result;
+	}
+
+	// [rule] outline outline ..., points like Data. Fills and
+	// patterns' regions.
+	static bool outlines(std::span<const Token> members, Fill& fill) {
+		if (!members.empty() && (members[0] == "evenodd" || members[0] == "nonzero")) {
+			if (members[0] == "nonzero") fill.rule = FillRule::NonZero;
+			members = members.subspan(1);
+		}
+		for (Token outline : members) {
+			if (!fill.outline.empty()) fill.ends.push_back(fill.outline.size());
+			std::string digits {};
+			for (char c : outline) {
+				if (c == '\'') continue;
+				digits.push_back(c);
+				if (digits.size() < 6) continue;
+				fill.outline.push_back(Point {
+					.x = base36<3,int16_t>(digits.substr(0, 3)),
+					.y = base36<3,int16_t>(digits.substr(3, 3)),
+					.pressure = 1.0f
+				});
+				digits.clear();
+			}
+			if (!digits.empty()) return false;
+		}
+		return true;
+	}
+
 	// TODO: change std::optional to std::expected
 	static auto parseElement(const Tokens& tkn, std::size_t& i)
 	-> std::optional<ElementData> {
@@ -281,6 +351,8 @@ public:
 		if (tkn[0] == ";") return Sketch {};
 
 		Sketch result {};
+		// Symbols defined so far, which Use refers to by name.
+		std::map<std::string, std::shared_ptr<Symbol>, std::less<>> symbols {};
 		for (std::size_t i=0; i<tkn.size(); i++) {
 			std::vector<ElementData> elemsList {};
 			while (i<tkn.size() && !isAny(tkn[i], ",", ";")) {
@@ -306,30 +378,47 @@ public:
 
 			/* PARSE MAIN ELEMENT */
 			if (isAny(currElem->type, "Data", "Pencil", "Brush")) {
-				const bool isBrush = currElem->type == "Brush";
-				for (std::size_t j=0; j<currElem->members.size(); /**/) {
-					unsigned diameter = isBrush
-						? base36<2,unsigned>(currElem->members[j++])
-						: 3;
-					Stroke stroke {diameter, {}};
+				for (Stroke& s : strokes(currElem->members, currElem->type == "Brush"))
+					timelineAtoms.push_back(std::move(s));
+			}
+			else if (currElem->type == "Curve") {
+				// Like Brush, but the points are control points.
+				for (Stroke& s : strokes(currElem->members, true)) {
+					if (s.points.empty() || (s.points.size()-1) % 3) return {};
+					timelineAtoms.push_back(Curve {s.diameter, std::move(s.points)});
+				}
+			}
+			else if (currElem->type == "Fill") {
+				Fill fill {};
+				if (!outlines(currElem->members, fill)) return {};
+				timelineAtoms.push_back(fill);
+			}
+			else if (currElem->type == "Pattern") {
+				// ww hh, then the motif like Brush. Its region
+				// comes after it, as a modifier.
+				if (currElem->members.size() < 2) return {};
+				Pattern pattern {};
+				pattern.width  = base36<2,unsigned>(currElem->members[0]);
+				pattern.height = base36<2,unsigned>(currElem->members[1]);
+				if (!pattern.width || !pattern.height) return {};
+				pattern.motif = strokes(currElem->members.subspan(2), true);
+				timelineAtoms.push_back(std::move(pattern));
+			}
+			else if (currElem->type == "Erase") {
+				// dd then one row each: yyy and runs of xxx ll.
+				if (currElem->members.empty()) return {};
+				Eraser eraser {base36<2,unsigned>(currElem->members[0])};
+				for (Token row : currElem->members.subspan(1)) {
 					std::string digits {};
-					for (char c : currElem->members[j++]) {
-						if (c == '\'') continue;
-						digits.push_back(c);
-						if (digits.size() < (isBrush? 8:6)) continue;
-						stroke.points.push_back(Point {
-							.x = base36<3,int16_t>(digits.substr(0, 3)),
-							.y = base36<3,int16_t>(digits.substr(3, 3)),
-							.pressure = isBrush
-								? base36<2,unsigned>(digits.substr(6,2))
-									/ float(36*36-1)
-								: 1.0f
-						});
-						digits.clear();
+					for (char c : row) if (c != '\'') digits.push_back(c);
+					if (digits.size() < 3 || (digits.size()-3) % 5) return {};
+					const int y = base36<3,int16_t>(digits.substr(0, 3));
+					for (std::size_t j=3; j<digits.size(); j+=5) {
+						const int x = base36<3,int16_t>(digits.substr(j, 3));
+						Masks::add(eraser.shape, y, x, x + base36<2,unsigned>(digits.substr(j+3, 2)));
 					}
-					assert(digits.empty());
-					timelineAtoms.push_back(stroke);
 				}
+				timelineAtoms.push_back(std::move(eraser));
 			}
 			else if (currElem->type == "Marker") {
 				std::string_view message = currElem->members[0];
@@ -340,9 +429,45 @@ public:
 					Marker {std::string {message}}
 				);
 			}
+			else if (currElem->type == "Layer") {
+				// (name) opacity blend visible
+				std::string_view name = currElem->members[0];
+				if (!name.starts_with('(') || !name.ends_with(')')) return {};
+				name.remove_prefix(1), name.remove_suffix(1);
+				Layer layer {std::string {name}};
+				layer.opacity = clamp(base10<float>(currElem->members[1]), 0, 1);
+				if      (currElem->members[2] == "darken")   layer.blend = Blend::Darken;
+				else if (currElem->members[2] == "multiply") layer.blend = Blend::Multiply;
+				else return {};
+				layer.visible = currElem->members[3] != "0";
+				timelineAtoms.push_back(layer);
+			}
+			else if (currElem->type == "Lettering") {
+				// (text) x y size
+				std::string_view text = currElem->members[0];
+				if (!text.starts_with('(') || !text.ends_with(')')) return {};
+				text.remove_prefix(1), text.remove_suffix(1);
+				Marker m {std::string {text}};
+				m.at.x = base10<float>(currElem->members[1]);
+				m.at.y = base10<float>(currElem->members[2]);
+				m.size = base10<float>(currElem->members[3]);
+				if (!(m.size > 0)) return {};
+				timelineAtoms.push_back(std::move(m));
+			}
+			else if (currElem->type == "Use") {
+				// (name) of a symbol defined before it. Where it
+				// goes is an Affine after it.
+				std::string_view name = currElem->members[0];
+				if (!name.starts_with('(') || !name.ends_with(')')) return {};
+				name.remove_prefix(1), name.remove_suffix(1);
+				auto it = symbols.find(name);
+				if (it == symbols.end()) return {};
+				timelineAtoms.push_back(Instance {it->second});
+			}
 			++currElem;
 
 			/* PARSE ALL MODIFIERS */
+			std::optional<std::string_view> defines {};
 			for (; currElem != elemsList.end(); ++currElem) {
 				if (currElem->type == "Affine") {
 					std::array<float,9> m;
@@ -350,7 +475,57 @@ public:
 						m[j] = base10<float>(currElem->members[j]);
 
 					timelineElem.modifiers.push_back(Affine {m});
+					// Instances are drawn through it as well.
+					for (Atom& a : timelineAtoms)
+						if (auto* u = std::get_if<Instance>(&a))
+							u->transform = Symbols::compose({m[0], m[1], m[2], m[3], m[4], m[5]}, u->transform);
+				}
+				// The statement defines a symbol (or adds to one)
+				// instead of drawing anything, once the rest of
+				// its modifiers are done.
+				else if (currElem->type == "Symbol") {
+					std::string_view name = currElem->members[0];
+					if (!name.starts_with('(') || !name.ends_with(')')) return {};
+					name.remove_prefix(1), name.remove_suffix(1);
+					defines = name;
+				}
+				// Not kept as a modifier either, it's part of the
+				// pattern.
+				else if (currElem->type == "Region") {
+					for (Atom& a : timelineAtoms)
+						if (auto* p = std::get_if<Pattern>(&a))
+							if (!outlines(currElem->members, p->region)) return {};
+				}
+				// Not kept as a modifier, strokes just have one.
+				else if (currElem->type == "Colour") {
+					Token hex = currElem->members[0];
+					if (hex.size() != 6 || !ranges::all_of(hex, isHex)) return {};
+					auto byte = [&](std::size_t i) {
+						return uint8_t(16*hexDigit(hex[i]) + hexDigit(hex[i+1]));
+					};
+					const Col3 colour {byte(0), byte(2), byte(4)};
+					const uint8_t alpha = clamp(base10<float>(currElem->members[1]), 0, 1) * 255 + 0.5f;
+					for (Atom& a : timelineAtoms)
+						if (auto* s = std::get_if<Stroke>(&a))
+							s->colour = colour, s->alpha = alpha;
+						else if (auto* f = std::get_if<Fill>(&a))
+							f->colour = colour, f->alpha = alpha;
+						else if (auto* m = std::get_if<Marker>(&a))
+							m->colour = colour, m->alpha = alpha;
+						else if (auto* c = std::get_if<Curve>(&a))
+							c->colour = colour, c->alpha = alpha;
+				}
+			}
+
+			if (defines) {
+				auto& symbol = symbols[std::string {*defines}];
+				if (!symbol) symbol = std::make_shared<Symbol>(std::string {*defines});
+				for (Atom& a : timelineAtoms) {
+					if (!Symbols::allowed(a) || Symbols::uses(a, symbol.get())) return {};
+					symbol->atoms.push_back(std::move(a));
 				}
+				if (i<tkn.size() && tkn[i] == ";") break;
+				continue;
 			}
 
 			if (isGrouping) {
@@ -361,10 +536,14 @@ public:
 				result.elements.push_back(timelineElem);
 			}
 			
-			result.atoms.splice(result.atoms.begin(), timelineAtoms);
+			// Statements are in drawing order, keep them that way.
+			result.atoms.splice(result.atoms.end(), timelineAtoms);
 
 			if (i<tkn.size() && tkn[i] == ";") break;
 		}
+		// Only now, since they can be added to right up to the end.
+		for (auto& [name, symbol] : symbols)
+			symbol->box = Symbols::bounds(symbol->atoms);
 		return result;
 	}
 };
\ No newline at end of file
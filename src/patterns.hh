@@ -0,0 +1,108 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include "types.hh"
+#include "math.hh"
+
+// Patterns' motifs drawn out once into a tile per zoom, so
+// filling a region is only copying tile rows. A handful are
+// kept, and the one that went longest without being used goes
+// when there's too many or they're too big.
+class PatternTiles {
+	static constexpr std::size_t Max      = 16;
+	static constexpr std::size_t MaxBytes = 16<<20;
+	static constexpr int         MinRow   = 64; // Pixels copied in one go, at least
+	static constexpr int         MaxSize  = 4096;
+
+public:
+	// One repeat of the motif is w by h pixels. Each row is the
+	// repeat over and over out to 'stride', so any run of up to
+	// stride-w pixels can be read straight out of it.
+	struct Tile {
+		uint64_t key;
+		Real     zoom;
+		int      w, h, stride;
+		std::vector<uint32_t> pixels {};
+		uint64_t used = 0;
+		Pattern  of {}; // Its motif and size, to check hits against
+
+		const uint32_t* row(int y) const { return &pixels[y*stride]; }
+	};
+
+private:
+	std::vector<Tile> tiles;
+	std::size_t bytes = 0;
+	uint64_t clock = 0;
+
+public:
+	// A hash of everything that changes how the motif looks.
+	static uint64_t key(const Pattern& p) {
+		uint64_t h = fnv(nullptr, 0);
+		auto mix = [&](const void* data, std::size_t n) { h = fnv(data, n, h); };
+		mix(&p.width, sizeof p.width), mix(&p.height, sizeof p.height);
+		for (const Stroke& s : p.motif) {
+			mix(&s.diameter, sizeof s.diameter);
+			mix(&s.colour, sizeof s.colour), mix(&s.alpha, sizeof s.alpha);
+			mix(s.ends.data(), s.ends.size() * sizeof(uint32_t));
+			for (Point q : s.points) mix(&q.x, sizeof q.x), mix(&q.y, sizeof q.y);
+			const uint32_t n = s.points.size();
+			mix(&n, sizeof n);
+		}
+		return h;
+	}
+
+	// Whether 'a' and 'b' look the same, as far as key() goes.
+	static bool same(const Pattern& a, const Pattern& b) {
+		auto point = [](Point p, Point q) { return p.x == q.x && p.y == q.y; };
+		return a.width == b.width && a.height == b.height
+		    && ranges::equal(a.motif, b.motif, [&](const Stroke& s, const Stroke& t) {
+			return s.diameter == t.diameter && s.colour == t.colour && s.alpha == t.alpha
+			    && s.ends == t.ends && ranges::equal(s.points, t.points, point);
+		});
+	}
+
+	// The tile for 'p' at 'zoom'. If it isn't there yet, it's
+	// made with draw(tile), which has to fill in one repeat
+	// (the first w pixels of each row). Null if a repeat is
+	// too big for one, in which case it's better drawn straight
+	// onto the screen.
+	template <typename F>
+	const Tile* get(const Pattern& p, Real zoom, F draw) {
+		const uint64_t k = key(p);
+		for (Tile& t : tiles)
+			if (t.key == k && t.zoom == zoom && same(t.of, p)) {
+				t.used = ++clock;
+				return &t;
+			}
+
+		Tile t {k, zoom, 0, 0, 0};
+		const long w = std::lround(p.width * zoom), h = std::lround(p.height * zoom);
+		if (w > MaxSize || h > MaxSize) return nullptr;
+		t.w = std::max<int>(w, 1), t.h = std::max<int>(h, 1);
+		t.stride = t.w * ((MinRow + t.w - 1) / t.w + 1);
+		const std::size_t size = std::size_t(t.stride) * t.h * sizeof(uint32_t);
+		if (size > MaxBytes) return nullptr;
+
+		while (!tiles.empty() && (tiles.size() == Max || bytes + size > MaxBytes)) {
+			auto oldest = ranges::min_element(tiles, {}, &Tile::used);
+			bytes -= oldest->pixels.size() * sizeof(uint32_t);
+			tiles.erase(oldest);
+		}
+		t.pixels.resize(std::size_t(t.stride) * t.h);
+		t.used = ++clock;
+		t.of = {p.motif, p.width, p.height};
+		bytes += size;
+		draw(t);
+		for (int y=0; y<t.h; y++) {
+			uint32_t* row = &t.pixels[y*t.stride];
+			for (int x=t.w; x<t.stride; x+=t.w)
+				std::memcpy(row+x, row, t.w * sizeof(uint32_t));
+		}
+		return &tiles.emplace_back(std::move(t));
+	}
+
+	void clear() { tiles.clear(), bytes = 0; }
+};
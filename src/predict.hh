@@ -0,0 +1,150 @@
+#pragma once
+#include <span>
+#include <vector>
+#include <optional>
+#include <cmath>
+#include <algorithm>
+#include "types.hh"
+#include "math.hh"
+
+// Guesses where the pen is going to be a few milliseconds
+// from now, so the frame can show a provisional bit of ink
+// ahead of the real stroke and hide some of the latency.
+namespace Predict
+{
+	struct Sample {
+		Real   x, y, pressure;
+		double time; // Seconds
+	};
+
+	// Constant velocity Kalman filter along one axis. The pen
+	// is assumed to accelerate randomly ('q', in (px/s²)²)
+	// and be measured with some noise ('r', in px²).
+	class Axis {
+		double p = 0, v = 0;                  // Position, velocity
+		double P00 = 0, P01 = 0, P11 = 0;     // Covariance
+		double q, r;
+
+		void predict(double dt) {
+			p += v*dt;
+			const double dt2 = dt*dt;
+			P00 += dt*(2*P01 + dt*P11) + q*dt2*dt2/4;
+			P01 += dt*P11              + q*dt2*dt/2;
+			P11 +=                       q*dt2;
+		}
+
+	public:
+		Axis(double q, double r) : q{q}, r{r} {}
+
+		void reset(double z) {
+			p = z, v = 0;
+			P00 = r, P01 = 0, P11 = 1e6; // Velocity unknown
+		}
+
+		void update(double z, double dt) {
+			predict(dt);
+			const double S = P00 + r;
+			const double K0 = P00/S, K1 = P01/S;
+			const double e = z - p;
+			p += K0*e, v += K1*e;
+			P11 -= K1*P01;
+			P01 -= K1*P00;
+			P00 -= K0*P00;
+		}
+
+		double at(double dt) const { return p + v*dt; }
+	};
+
+	class Predictor {
+		Axis   ax, ay;
+		Sample last {};
+		bool   down = false;
+
+	public:
+		// Won't guess further ahead than this, or at all
+		// once the pen's held still for this long.
+		double horizon = 0.05;
+
+		Predictor(double q = 4e7, double r = 0.5) : ax{q, r}, ay{q, r} {}
+
+		void add(Sample s) {
+			if (!down || s.time <= last.time) {
+				ax.reset(s.x), ay.reset(s.y);
+			}
+			else {
+				ax.update(s.x, s.time - last.time);
+				ay.update(s.y, s.time - last.time);
+			}
+			last = s, down = true;
+		}
+
+		void lift() { down = false; }
+		bool active() const { return down; }
+
+		// Where the pen will be at 'time'. Pressure is just
+		// held, guessing it wrong looks worse than lagging.
+		std::optional<Sample> at(double time) const {
+			const double dt = time - last.time;
+			if (!down || dt < 0 || dt > horizon) return {};
+			return Sample {Real(ax.at(dt)), Real(ay.at(dt)), last.pressure, time};
+		}
+	};
+
+	/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+	// How far off predictions were, in pixels. 'baseline' is
+	// the error of not predicting at all, for comparison.
+	struct Error {
+		std::size_t samples = 0;
+		double mean = 0, rms = 0, max = 0;
+		double baseline = 0;
+	};
+
+	// Replays recorded strokes through a predictor, and after
+	// each sample checks the guess 'ahead' seconds later
+	// against where the stroke really was by then.
+	Error evaluate(std::span<const std::vector<Sample>> strokes,
+	               double ahead, Predictor p = {}) {
+		Error e {};
+		for (auto& stroke : strokes) {
+			std::size_t j = 0;
+			for (std::size_t i=0; i<stroke.size(); i++) {
+				p.add(stroke[i]);
+				const double t = stroke[i].time + ahead;
+				while (j+1 < stroke.size() && stroke[j+1].time < t) j++;
+				if (j+1 >= stroke.size()) break; // Past the end
+				auto guess = p.at(t);
+				if (!guess) continue;
+
+				const Sample a = stroke[j], b = stroke[j+1];
+				const double f = (t - a.time) / (b.time - a.time);
+				const double x = a.x + f*(b.x - a.x), y = a.y + f*(b.y - a.y);
+				const double d = std::hypot(guess->x - x, guess->y - y);
+				e.samples++;
+				e.mean += d, e.rms += d*d, e.max = std::max(e.max, d);
+				e.baseline += std::hypot(stroke[i].x - x, stroke[i].y - y);
+			}
+			p.lift();
+		}
+		if (e.samples) {
+			e.mean /= e.samples;
+			e.rms = std::sqrt(e.rms / e.samples);
+			e.baseline /= e.samples;
+		}
+		return e;
+	}
+
+	// Documents don't keep timestamps, so this assumes their
+	// strokes were sampled at a steady 'hz'.
+	template <ranges::input_range Atoms>
+	Error evaluate(const Atoms& atoms, double hz, double ahead, Predictor p = {}) {
+		std::vector<std::vector<Sample>> strokes {};
+		for (const Atom& a : atoms)
+			if (auto* s = std::get_if<Stroke>(&a)) {
+				auto& out = strokes.emplace_back();
+				for (Point q : s->points)
+					out.push_back({Real(q.x), Real(q.y), q.pressure, out.size()/hz});
+			}
+		return evaluate(strokes, ahead, p);
+	}
+};
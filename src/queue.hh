@@ -0,0 +1,52 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <optional>
+#include <utility>
+#include <cstddef>
+
+// Plain emscripten builds have no threads, so anything that
+// would run on a worker falls back to running inline.
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+#	define SKETCH_THREADS 1
+#else
+#	define SKETCH_THREADS 0
+#endif
+
+// Lock-free ring buffer for exactly one producer thread
+// and exactly one consumer thread. Neither side ever
+// waits on the other, push() just fails when it's full.
+template <typename T, std::size_t N>
+class SPSCQueue {
+	static_assert(N && (N & (N-1)) == 0, "N must be a power of 2");
+
+	// Separate cache lines so the two threads don't
+	// fight over the same line on every push/pop.
+	alignas(64) std::atomic<std::size_t> head {0}; // Consumer
+	alignas(64) std::atomic<std::size_t> tail {0}; // Producer
+	std::array<T,N> slots {};
+
+public:
+	bool push(T value) {
+		const auto t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == N)
+			return false;
+		slots[t & (N-1)] = std::move(value);
+		tail.store(t+1, std::memory_order_release);
+		return true;
+	}
+
+	std::optional<T> pop() {
+		const auto h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire))
+			return {};
+		std::optional<T> result {std::move(slots[h & (N-1)])};
+		head.store(h+1, std::memory_order_release);
+		return result;
+	}
+
+	bool empty() const {
+		return head.load(std::memory_order_acquire)
+		    == tail.load(std::memory_order_acquire);
+	}
+};
@@ -0,0 +1,584 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <variant>
+#include <cstring>
+#include <chrono>
+#include "types.hh"
+#include "queue.hh"
+#include "document.hh"
+#include "renderer.hh"
+#include "cold.hh"
+#include "timeline.hh"
+#include "governor.hh"
+#include "tile cache.hh"
+#include "layers.hh"
+#include "predict.hh"
+
+// Seconds on the steady clock, for timing pen samples.
+double sampleTime() {
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// What the main thread tells the render thread about.
+struct InputSample { Point cursor; bool pressed; double time = sampleTime(); };
+struct ViewChange  { Viewport view; bool interacting; };
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+// Rasterizes on its own thread into a canvas, which gets
+// copied into one of two frame buffers when it changes. The
+// main thread only ever copies the newest finished frame out
+// in present(), so polling events never waits on a slow frame.
+//
+// While the view is moving everything is drawn in Draft
+// quality. Once it stops, the canvas is redrawn at Full
+// quality one tile at a time, a few milliseconds' worth
+// per frame, so it sharpens up without ever stalling.
+//
+// Full quality tiles are kept in a cache, and whenever there's
+// nothing else to do the thread guesses where the view is
+// heading from how it's been panning and draws those tiles
+// ahead of time, so a pan mostly just blits.
+//
+// Documents with layers skip the tile cache. Each layer keeps
+// its own surface instead, so an edit only redraws the layer
+// it's in, and Full tiles come from blending those.
+//
+// While the pen is down each frame also gets a provisional
+// tail from the end of the stroke to where the pen should be
+// by the time the frame's on screen. It only goes into the
+// frame, never the canvas, so the next frame replaces it.
+class RenderThread {
+	using Clock = std::chrono::steady_clock;
+	using Key   = TileCache::Key;
+	static constexpr int Tile = TileCache::Tile;
+
+	// Roughly how long a frame takes to reach the screen
+	// after it's handed over, which is how far ahead the
+	// pen gets predicted.
+	static constexpr double FrameLatency = 0.016; // Seconds
+
+	// How far ahead a pan is extrapolated.
+	static constexpr Real Lookahead = 0.25; // Seconds
+
+	unsigned W, H;
+	std::array<std::vector<uint32_t>,2> frames;
+	std::vector<uint32_t> canvas;
+	Renderer painter; // Draws into 'canvas'
+
+	// Only flipped by present() while 'fresh' is set, which is
+	// exactly when the render thread isn't looking at it.
+	unsigned front = 0;
+
+	// Set by the render thread once the back buffer holds
+	// a finished frame, cleared by present() after the swap.
+	std::atomic<bool> fresh {false};
+
+	SPSCQueue<InputSample, 1024> samples;
+	SPSCQueue<ViewChange , 64  > views;
+	SPSCQueue<RenderSettings, 8 > settings;
+	std::atomic<int64_t> rasterMicros {0}; // Since the last rasterTime()
+	std::atomic<std::size_t> playhead {Live};
+	std::atomic<unsigned> pending {0};
+	std::atomic<bool>     running {true};
+
+	// Only ever touched from the render thread.
+	Document::Reader reader;
+	Snapshot         drawn;
+	Timeline         timeline;
+	std::size_t      shown = Live; // Playhead of the last frame
+	Quality          shownQuality = Quality::Draft;
+	InputSample      latest {};
+	Predict::Predictor predictor {};
+	bool             tailDirty = false; // Needs a frame for the tail
+	Viewport         view {};
+	bool             interacting = false;
+	bool             canvasDirty = false; // Not copied to a frame yet
+	bool             redraw = true;
+	bool             reseek = false;
+
+	// Quality of each tile on screen, which are the ones
+	// from 'first' on in the cache's grid.
+	TileCache            cache;
+	TileCache::Offset    offset {0, 0};
+	Key                  first {0, 0};
+	int                  tilesX = 0, tilesY = 0;
+	std::vector<Quality> tiles;
+	std::size_t          unrefined = 0;
+	LayerStack           layers;
+	bool                 layered = false;
+
+	// Pan velocity in pixels per second, and the tiles to
+	// draw ahead of time, nearest to where it's going last.
+	Vec2              velocity {0, 0};
+	Clock::time_point lastMove {};
+	int               zoomDirection = 0;
+	std::vector<Key>  ahead;
+	bool              planned = false;
+
+#	if SKETCH_THREADS
+	std::thread worker;
+#	endif
+
+	Key tileKey(std::size_t t) const {
+		return {first.x + int(t%tilesX), first.y + int(t/tilesX)};
+	}
+
+	// Where a tile is on screen, cut to the screen.
+	Rect tileRect(std::size_t t) const {
+		return cache.rect(tileKey(t)).moved(-offset.x, -offset.y) & painter.bounds();
+	}
+
+	void blit(std::size_t t, const std::vector<uint32_t>& tile) {
+		const Rect r = tileRect(t);
+		const Rect g = r.moved(offset.x, offset.y);
+		const Key  k = tileKey(t);
+		for (int y=r.y0; y<r.y1; y++)
+			std::memcpy(&canvas[y*W + r.x0],
+			            &tile[(g.y0 - k.y*Tile + y-r.y0)*Tile + g.x0 - k.x*Tile],
+			            (r.x1-r.x0)*sizeof(uint32_t));
+	}
+
+	static bool addsLayer(const PVector<Atom>& atoms, std::size_t from) {
+		using It = PVector<Atom>::iterator;
+		for (It it {&atoms, from}; it != atoms.end(); ++it)
+			if (std::holds_alternative<Layer>(*it)) return true;
+		return false;
+	}
+
+	// Whether 'now' only adds to 'old': new atoms on the end,
+	// or more points on the last stroke (or more of the last
+	// eraser). Since blending by min() doesn't care about order
+	// or overdraw, those can just be drawn on top. 'from' is
+	// what needs drawing.
+	static bool onlyAdds(const PVector<Atom>& old, const PVector<Atom>& now,
+	                     std::size_t& from, std::size_t& fromPoint) {
+		from = old.mismatch(now, Cold::Same {}), fromPoint = 0;
+		if (from == old.size()) return true;
+		if (from+1 != old.size() || from >= now.size()) return false;
+		if (auto* a = std::get_if<Eraser>(&old[from]))
+			if (auto* b = std::get_if<Eraser>(&now[from]))
+				return Masks::covers(b->shape, a->shape);
+		auto* a = std::get_if<Stroke>(&old[from]);
+		auto* b = std::get_if<Stroke>(&now[from]);
+		if (!a || !b || a->diameter != b->diameter || !a->ends.empty() || !b->ends.empty()
+		||  a->colour != b->colour || a->alpha != b->alpha
+		||  a->points.size() > b->points.size()) return false;
+		fromPoint = a->points.empty() ? 0 : a->points.size()-1;
+		return std::equal(a->points.begin(), a->points.end(), b->points.begin(),
+			[](Point p, Point q) {
+				return p.x == q.x && p.y == q.y && p.pressure == q.pressure;
+			});
+	}
+
+	// Whether the only change is the last stroke being fitted
+	// to a curve.
+	static bool refitted(const PVector<Atom>& old, const PVector<Atom>& now) {
+		return !old.empty() && old.size() == now.size()
+		    && old.mismatch(now, Cold::Same {}) == old.size()-1
+		    && Curves::refits(old.back(), now.back());
+	}
+
+	// Lays the tile grid over the new view. Tiles the cache
+	// has are blitted, the rest get drawn in Draft for now.
+	void redrawView() {
+		painter.clip = painter.bounds();
+		painter.view = view;
+		offset = cache.setView(view, W, H);
+		first  = TileCache::keyAt(offset.x, offset.y);
+		const Key last = TileCache::keyAt(offset.x+W-1, offset.y+H-1);
+		tilesX = last.x - first.x + 1;
+		tilesY = last.y - first.y + 1;
+		tiles.assign(tilesX*tilesY, Quality::Draft);
+		unrefined = tiles.size();
+		planned = false;
+
+		Rect missing {0, 0, 0, 0};
+		for (std::size_t t=0; t<tiles.size(); t++)
+			if (layered || !cache.find(tileKey(t))) missing = missing | tileRect(t);
+		if (!missing.empty()) {
+			painter.clip = missing;
+			painter.quality = Quality::Draft;
+			painter.clear();
+			painter.display(drawn.atoms);
+			painter.quality = Quality::Full;
+			painter.clip = painter.bounds();
+		}
+		for (std::size_t t=0; t<tiles.size(); t++)
+			if (auto* tile = layered ? nullptr : cache.find(tileKey(t))) {
+				blit(t, *tile);
+				tiles[t] = Quality::Full, unrefined--;
+			}
+	}
+
+	// Redraws Draft tiles at Full quality until the budget's up.
+	void refine() {
+		if (!unrefined) return;
+		const auto deadline = Clock::now() + refineBudget;
+		for (std::size_t t=0; t<tiles.size() && unrefined; t++) {
+			if (tiles[t] == Quality::Full) continue;
+			if (layered) {
+				layers.render(tileRect(t));
+				layers.composite(canvas, tileRect(t));
+			}
+			else {
+				auto* tile = cache.find(tileKey(t));
+				blit(t, tile ? *tile : cache.render(tileKey(t), drawn.atoms));
+			}
+			tiles[t] = Quality::Full, unrefined--;
+			canvasDirty = true;
+			if (Clock::now() >= deadline) break;
+		}
+	}
+
+	// Tracks how fast the view's panning, in screen pixels.
+	void moved(Viewport v) {
+		const auto now = Clock::now();
+		if (v.zoom != view.zoom) {
+			zoomDirection = v.zoom < view.zoom ? -1 : 1;
+			velocity = {0, 0};
+		}
+		else {
+			const Real dt = std::max(Real(1e-3),
+				std::chrono::duration<Real>(now - lastMove).count());
+			// A pan that just started shouldn't inherit
+			// whatever the last one was doing.
+			const Real keep = dt > 0.1f ? 0 : 0.5f;
+			velocity.x = keep*velocity.x + (1-keep)*(view.x - v.x)*v.zoom / -dt;
+			velocity.y = keep*velocity.y + (1-keep)*(view.y - v.y)*v.zoom / -dt;
+		}
+		lastMove = now;
+		view = v;
+	}
+
+	// Works out which tiles to draw ahead of time: a ring
+	// around the screen, wider when zooming out, plus the
+	// screen where the pan would be in 'Lookahead' seconds.
+	void plan() {
+		const bool panning = Clock::now() - lastMove < std::chrono::milliseconds {100};
+		const Vec2 v = panning ? velocity : Vec2 {0, 0};
+		const int margin = zoomDirection < 0 ? 2 : 1;
+		const Rect screen = painter.bounds().moved(offset.x, offset.y);
+		const Rect there  = screen.moved(v.x*Lookahead, v.y*Lookahead);
+
+		ahead.clear();
+		auto add = [&](Rect r, int m) {
+			const Key a = TileCache::keyAt(r.x0 - m*Tile, r.y0 - m*Tile);
+			const Key b = TileCache::keyAt(r.x1-1 + m*Tile, r.y1-1 + m*Tile);
+			for (int y=a.y; y<=b.y; y++)
+			for (int x=a.x; x<=b.x; x++)
+				ahead.push_back({x, y});
+		};
+		add(screen, margin);
+		add(there, 1);
+		const Real cx = (there.x0 + there.x1)/2.f, cy = (there.y0 + there.y1)/2.f;
+		auto distance = [&](Key k) {
+			return dot2({k.x*Tile + Tile/2 - cx, k.y*Tile + Tile/2 - cy});
+		};
+		ranges::sort(ahead, [&](Key a, Key b) { return distance(a) > distance(b); });
+		ahead.erase(std::unique(ahead.begin(), ahead.end()), ahead.end());
+		planned = true;
+	}
+
+	// Draws one tile ahead of time. Returns false when
+	// there's nothing left worth drawing.
+	bool prefetchTile() {
+		if (shown != Live || layered) return false;
+		if (!planned) plan();
+		while (!ahead.empty()) {
+			const Key k = ahead.back();
+			ahead.pop_back();
+			if (cache.find(k)) continue;
+			cache.render(k, drawn.atoms);
+			return true;
+		}
+		return false;
+	}
+
+	// Draws the provisional bit of stroke into a frame: from
+	// the end of the drawn stroke through the newest sample
+	// to wherever the pen is predicted to be.
+	void drawTail(std::span<uint32_t> frame) {
+		if (shown != Live || !latest.pressed) return;
+		if (!drawn.atoms.empty() && std::holds_alternative<Eraser>(drawn.atoms.back())) return;
+		std::vector<Vec2> tail {};
+		if (!drawn.atoms.empty())
+			if (auto* s = std::get_if<Stroke>(&drawn.atoms.back()); s && !s->points.empty())
+				tail.push_back(view.toScreen(s->points.back()));
+		tail.push_back(view.toScreen(latest.cursor));
+		if (auto p = predictor.at(sampleTime() + FrameLatency))
+			tail.push_back(view.toScreen(Vec2 {p->x, p->y}));
+
+		Col3 colour {0, 0, 0};
+		uint8_t alpha = 255;
+		if (!drawn.atoms.empty())
+			if (auto* s = std::get_if<Stroke>(&drawn.atoms.back()))
+				colour = s->colour, alpha = s->alpha;
+
+		painter.retarget(frame);
+		painter.view = view;
+		painter.clip = painter.bounds();
+		painter.drawLines(tail, colour, alpha);
+		painter.retarget(canvas);
+	}
+
+	// Picks up the newest document version, view and input,
+	// updates the canvas, and hands it over as a frame if the
+	// previous frame has already been picked up.
+	void step() {
+		// Charged to rasterMicros on the way out.
+		struct Timer {
+			std::atomic<int64_t>& total;
+			Clock::time_point start;
+			~Timer() {
+				total.fetch_add(std::chrono::duration_cast<std::chrono::microseconds>(
+					Clock::now() - start).count(), std::memory_order_relaxed);
+			}
+		} timer {rasterMicros, Clock::now()};
+
+		while (auto s = settings.pop()) {
+			painter.lodTolerance = s->lodTolerance;
+			refineBudget = s->refineBudget;
+			timeline.setBudget(s->cacheBytes/2);
+			cache.setBudget(s->cacheBytes/2);
+		}
+		while (auto s = samples.pop()) {
+			if (s->pressed) predictor.add({Real(s->cursor.x), Real(s->cursor.y),
+			                               s->cursor.pressure, s->time});
+			else            predictor.lift();
+			tailDirty |= s->pressed || latest.pressed;
+			latest = *s;
+		}
+		while (auto v = views.pop()) {
+			if (v->view != view) moved(v->view), redraw = true;
+			interacting = v->interacting;
+		}
+		Snapshot s = reader.snapshot();
+		const bool changed = s.version != drawn.version;
+		if (std::size_t p = playhead.load(); p != shown) {
+			// Going back to live needs a proper redraw.
+			if (p == Live) redraw = true;
+			else           reseek = true;
+			shown = p;
+		}
+
+		if (shown != Live) {
+			const Quality q = interacting ? Quality::Draft : Quality::Full;
+			if (changed || redraw || reseek || q != shownQuality) {
+				drawn = std::move(s);
+				painter.clip = painter.bounds();
+				painter.view = view;
+				painter.quality = shownQuality = q;
+				timeline.update(drawn.atoms, view);
+				timeline.render(painter, canvas, shown);
+				painter.quality = Quality::Full;
+				redraw = reseek = false;
+				canvasDirty = true;
+			}
+		}
+		else if (changed || redraw) {
+			std::size_t from, fromPoint;
+			if (!redraw && !layered && onlyAdds(drawn.atoms, s.atoms, from, fromPoint)
+			&&  !addsLayer(s.atoms, from)) {
+				// Cached tiles under the new bits are stale.
+				Rect touched {0, 0, 0, 0}, overdrawn {0, 0, 0, 0};
+				using It = PVector<Atom>::iterator;
+				for (It it {&s.atoms, from}; it != s.atoms.end(); ++it)
+					if (auto* stroke = std::get_if<Stroke>(&*it)) {
+						auto points = std::span {stroke->points}
+							.subspan(it.index() == from ? fromPoint : 0);
+						if (it.index() == from && fromPoint)
+							painter.displayPoints(points, stroke->colour, stroke->alpha);
+						else painter.displayStroke(*stroke);
+						touched = touched | painter.screenBounds(points);
+						// A see-through stroke that got longer is
+						// now doubled up where the old end was.
+						if (it.index() == from && from < drawn.atoms.size() && stroke->alpha < 255)
+							overdrawn = painter.screenBounds(points);
+					}
+					else {
+						painter.displayAtom(*it);
+						touched = touched | painter.screenBounds(*it);
+					}
+				cache.invalidate(touched.moved(offset.x, offset.y));
+				for (std::size_t t=0; t<tiles.size(); t++)
+					if (tiles[t] == Quality::Full && tileRect(t).intersects(overdrawn))
+						tiles[t] = Quality::Draft, unrefined++;
+				drawn = std::move(s);
+				planned = false;
+			}
+			else if (!redraw && !layered && refitted(drawn.atoms, s.atoms)) {
+				// Looks the same, so what's on screen can stay
+				// until the tiles get redrawn.
+				const Rect r = painter.screenBounds(drawn.atoms.back()) | painter.screenBounds(s.atoms.back());
+				cache.invalidate(r.moved(offset.x, offset.y));
+				for (std::size_t t=0; t<tiles.size(); t++)
+					if (tiles[t] == Quality::Full && tileRect(t).intersects(r))
+						tiles[t] = Quality::Draft, unrefined++;
+				drawn = std::move(s);
+				planned = false;
+			}
+			else {
+				if (changed) cache.clear();
+				drawn = std::move(s);
+				layers.setView(view);
+				const Rect dirty = layers.sync(drawn.atoms);
+				layered = layers.layered();
+				if (!layered) layers.clear();
+				if (redraw || !layered) redrawView();
+				else {
+					// Only what the edit touched needs blending again.
+					for (std::size_t t=0; t<tiles.size(); t++)
+						if (tiles[t] == Quality::Full && tileRect(t).intersects(dirty))
+							tiles[t] = Quality::Draft, unrefined++;
+				}
+			}
+			redraw = false;
+			canvasDirty = true;
+		}
+		if (shown == Live && !interacting) refine();
+
+		if (!(canvasDirty || tailDirty) || fresh.load(std::memory_order_acquire)) return;
+		std::memcpy(frames[!front].data(), canvas.data(), W*H*sizeof(uint32_t));
+		drawTail(frames[!front]);
+		canvasDirty = tailDirty = false;
+		fresh.store(true, std::memory_order_release);
+#		if SKETCH_THREADS
+		if (onFrame) onFrame();
+#		endif
+	}
+
+	bool hasWork() const {
+		return canvasDirty || tailDirty || (shown == Live && !interacting && unrefined);
+	}
+
+	void loop() {
+		while (running.load(std::memory_order_relaxed)) {
+			const unsigned seen = pending.load(std::memory_order_acquire);
+			step();
+			// A frame still waiting to be presented counts as
+			// work too, since it has to be redrawn afterwards.
+			if (hasWork() && !fresh.load(std::memory_order_acquire)) continue;
+			// Otherwise draw ahead a tile at a time, dropping it
+			// as soon as the main thread hands over anything.
+			while (pending.load(std::memory_order_acquire) == seen && prefetchTile())
+				;
+			pending.wait(seen, std::memory_order_acquire);
+		}
+	}
+
+	void wake() {
+		pending.fetch_add(1, std::memory_order_release);
+		pending.notify_one();
+	}
+
+	// How long refining tiles may take per frame.
+	std::chrono::microseconds refineBudget {4000};
+
+	// Called from the render thread when a frame is ready,
+	// so a main loop that's asleep knows to present it.
+	std::function<void()> onFrame;
+
+public:
+	static constexpr std::size_t Live = SIZE_MAX;
+
+	RenderThread(Document& doc, unsigned W, unsigned H,
+	             std::function<uint32_t(Col3)> map,
+	             std::function<Col3(uint32_t)> get,
+	             std::function<void()> onFrame = {})
+	: W{W}, H{H}
+	, frames{std::vector<uint32_t>(W*H), std::vector<uint32_t>(W*H)}
+	, canvas(W*H)
+	, painter{canvas, W, H, map, get}
+	, reader{doc}
+	, timeline{W, H}
+	, cache{map, get}
+	, layers{W, H, map, get}
+	, onFrame{onFrame} {
+#		if SKETCH_THREADS
+		worker = std::thread {[this]{ loop(); }};
+#		endif
+	}
+
+	~RenderThread() {
+		running.store(false, std::memory_order_relaxed);
+		wake();
+#		if SKETCH_THREADS
+		worker.join();
+#		endif
+	}
+
+	RenderThread(const RenderThread&) = delete;
+	RenderThread& operator=(const RenderThread&) = delete;
+
+	void send(InputSample s) {
+		// Only the newest sample really matters, so
+		// dropping one when the queue is full is fine.
+		samples.push(s);
+		wake();
+	}
+
+	void send(ViewChange v) {
+		while (!views.push(v)) std::this_thread::yield();
+		wake();
+	}
+
+	void send(RenderSettings s) {
+		while (!settings.push(s)) std::this_thread::yield();
+		wake();
+	}
+
+	// Time spent drawing since the last call.
+	std::chrono::microseconds rasterTime() {
+		return std::chrono::microseconds {rasterMicros.exchange(0, std::memory_order_relaxed)};
+	}
+
+	// Show the document as of its first 'n' atoms,
+	// or as it is now if 'n' is Live.
+	void seek(std::size_t n) {
+		playhead.store(n);
+		wake();
+	}
+
+	// Call after publishing a new document version.
+	void documentChanged() { wake(); }
+
+	// Whether present() has (or, without threads, would
+	// make) something new to show.
+	bool busy() const {
+#		if SKETCH_THREADS
+		return fresh.load(std::memory_order_acquire);
+#		else
+		return fresh.load(std::memory_order_acquire) || hasWork();
+#		endif
+	}
+
+	// Without threads there's no one else to draw ahead, so
+	// the main loop lends its idle time. No-op with threads.
+	void idle([[maybe_unused]] std::chrono::microseconds slice) {
+#		if !SKETCH_THREADS
+		const auto deadline = Clock::now() + slice;
+		while (Clock::now() < deadline && prefetchTile())
+			;
+#		endif
+	}
+
+	// Copies the newest finished frame into 'output'.
+	// Returns false if nothing new has been drawn.
+	bool present(std::span<uint32_t> output) {
+#		if !SKETCH_THREADS
+		step();
+#		endif
+		if (!fresh.load(std::memory_order_acquire)) return false;
+		front = !front;
+		std::memcpy(output.data(), frames[front].data(),
+		            W*H*sizeof(uint32_t));
+		fresh.store(false, std::memory_order_release);
+		wake();
+		return true;
+	}
+};
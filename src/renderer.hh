@@ -3,8 +3,29 @@
 #include <algorithm>
 #include "types.hh"
 #include "math.hh"
+#include "simd.hh"
+#include "scanline.hh"
+#include "mask.hh"
+#include "glyphs.hh"
+#include "patterns.hh"
+#include "curves.hh"
+#include "symbols.hh"
+#include "cold.hh"
 
-struct Col3 { uint8_t r, g, b; };
+// Maps document coordinates to the screen:
+// screen = (document - origin) * zoom
+struct Viewport {
+	Real x = 0, y = 0, zoom = 1;
+
+	Vec2 toScreen(Point p) const { return {(p.x-x)*zoom, (p.y-y)*zoom}; }
+	Vec2 toScreen(Vec2  p) const { return {(p.x-x)*zoom, (p.y-y)*zoom}; }
+	Vec2 toDocument(Vec2 s) const { return {s.x/zoom + x, s.y/zoom + y}; }
+	bool operator==(const Viewport&) const = default;
+};
+
+// Draft is for while the view is moving: aliased one pixel
+// lines through fewer points. Full is the real thing.
+enum struct Quality { Draft, Full };
 
 class Renderer {
 	// Possibly an mdspan in the future.
@@ -13,42 +34,114 @@ class Renderer {
 	const unsigned H = 600;
 	std::function<uint32_t(Col3)> MapRGB;
 	std::function<Col3(uint32_t)> GetRGB;
+	uint32_t white;
+
+	// Coverage of the stroke being drawn, for anything that
+	// isn't plain black. Only the span of each row the stroke
+	// touched is valid (and gets composited at the end).
+	std::vector<uint8_t> cover;
+	std::vector<std::pair<int,int>> spans;
+	int coverY0 = 0, coverY1 = 0;
+	std::vector<Vec2> screen;
+	Scanline scanline;
+	GlyphAtlas glyphs;
+	PatternTiles tiles;
+	FlatCurves curves;
+	SymbolTiles symbols;
+	std::vector<uint32_t> oversize; // A symbol or pattern too big for a tile
+	Thawed& thawed = Thawed::shared();
+
+	Rect lineBox(Vec2 a, Vec2 b) const {
+		return Rect {
+			int(std::floor(min(a.x, b.x)))-2, int(std::floor(min(a.y, b.y)))-2,
+			int(std::floor(max(a.x, b.x)))+3, int(std::floor(max(a.y, b.y)))+3
+		} & clip;
+	}
+
+	// Calls plot(x, y, c) for every pixel near the line,
+	// c being 0 on it and 255 away from it.
+	template <typename F>
+	void rasterLine(Vec2 a, Vec2 b, Rect box, F plot) {
+		Vec2 xy;
+		for (int y=box.y0; y<box.y1; y++)
+		for (int x=box.x0; x<box.x1; x++) {
+			xy.x = x + 0.5;
+			xy.y = y + 0.5;
+			plot(x, y, uint8_t(255*clamp(SDFline(xy, a, b) - 1, 0, 1)));
+		}
+	}
+
+	// Makes sure [x0, x1) of row y is part of the coverage,
+	// zeroing whatever wasn't yet.
+	void touchRow(int y, int x0, int x1) {
+		if (cover.empty()) cover.resize(W*H), spans.resize(H);
+		if (coverY0 == coverY1) coverY0 = y, coverY1 = y+1;
+		coverY0 = std::min(coverY0, y), coverY1 = std::max(coverY1, y+1);
+		auto& [s0, s1] = spans[y];
+		uint8_t* row = &cover[y*W];
+		if (s0 == s1) {
+			std::fill(row+x0, row+x1, 0);
+			s0 = x0, s1 = x1;
+			return;
+		}
+		if (x0 < s0) std::fill(row+x0, row+s0, 0), s0 = x0;
+		if (x1 > s1) std::fill(row+s1, row+x1, 0), s1 = x1;
+	}
+
+	// Adds a line to the coverage. Overlapping lines take the
+	// max rather than adding up, same as min() does for black.
+	void coverLine(Vec2 a, Vec2 b) {
+		const Rect box = lineBox(a, b);
+		if (box.empty()) return;
+		for (int y=box.y0; y<box.y1; y++)
+			touchRow(y, box.x0, box.x1);
+		rasterLine(a, b, box, [&](int x, int y, uint8_t c) {
+			uint8_t& k = cover[y*W+x];
+			k = std::max<uint8_t>(k, 255-c);
+		});
+	}
+
+	// Composites the coverage source-over, and starts over.
+	void flushCover(Col3 colour, uint8_t alpha) {
+		const uint32_t ink = MapRGB(colour);
+		for (int y=coverY0; y<coverY1; y++) {
+			auto& [x0, x1] = spans[y];
+			if (x0 == x1) continue;
+			SIMD::over(&pixels[y*W+x0], &cover[y*W+x0], x1-x0, ink, alpha);
+			x0 = x1 = 0;
+		}
+		coverY0 = coverY1 = 0;
+	}
 
 public:
+	Viewport view {};
+	Quality  quality = Quality::Full;
+	Rect     clip;          // Nothing is drawn outside of this
+	Real     lodTolerance = 2; // Pixels, for Draft
+
 	Renderer(std::span<uint32_t> output,
 	         unsigned W, unsigned H,
 	         std::function<uint32_t(Col3)> map,
 	         std::function<Col3(uint32_t)> get)
 	: pixels{output}, W{W}, H{H}
-	, MapRGB{map}, GetRGB{get} {}
+	, MapRGB{map}, GetRGB{get}
+	, white{map({255,255,255})}
+	, clip{0, 0, int(W), int(H)} {}
+
+	// Point at a different buffer of the same size.
+	void retarget(std::span<uint32_t> output) { pixels = output; }
+
+	Rect bounds() const { return {0, 0, int(W), int(H)}; }
 
+	// Only clears inside 'clip'.
 	void clear() {
-		for (std::size_t i=0; i<W*H; i++)
-			pixels[i] = MapRGB({255,255,255});
+		for (int y=clip.y0; y<clip.y1; y++)
+			std::fill(&pixels[y*W+clip.x0], &pixels[y*W+clip.x1], white);
 	}
 
 	// TODO: more efficient line draw function
-	void drawLine(RawPoint a, RawPoint b) {
-		auto [xMin, xMax] = std::minmax(a.x, b.x);
-		auto [yMin, yMax] = std::minmax(a.y, b.y);
-		Real x0 = max(  0, xMin-2);
-		Real y0 = max(  0, yMin-2);
-		Real x1 = min(W-1, xMax+2);
-		Real y1 = min(H-1, yMax+2);
-
-		Vec2 av = {(Real)a.x, (Real)a.y};
-		Vec2 bv = {(Real)b.x, (Real)b.y};
-		Vec2 xy;
-
-		for (Real y=y0; y<=y1; y+=1)
-		for (Real x=x0; x<=x1; x+=1) {
-			xy.x = x + 0.5;
-			xy.y = y + 0.5;
-			uint8_t c = 255*clamp(
-				SDFline(xy, av, bv) - 1,
-				0,
-				1
-			);
+	void drawLine(Vec2 a, Vec2 b) {
+		rasterLine(a, b, lineBox(a, b), [&](int x, int y, uint8_t c) {
 			auto& pixel = pixels[y*W+x];
 			Col3 cOld = GetRGB(pixel);
 			pixel = MapRGB({
@@ -56,17 +149,385 @@ public:
 				(cOld.g < c) ? cOld.g : c,
 				(cOld.b < c) ? cOld.b : c
 			});
+		});
+	}
+
+	// Connected lines in screen space. Plain black is blended
+	// with min(), like it always was. Anything else is covered
+	// first and then composited once, so the joints don't get
+	// drawn over twice.
+	void drawLines(std::span<const Vec2> s, Col3 colour = {0,0,0}, uint8_t alpha = 255) {
+		if (s.empty() || alpha == 0) return;
+		const bool black = colour == Col3 {0,0,0} && alpha == 255;
+		auto line = [&](Vec2 a, Vec2 b) { black ? drawLine(a, b) : coverLine(a, b); };
+		if (s.size() == 1) line(s[0], s[0]);
+		for (std::size_t i=1; i<s.size(); i++)
+			line(s[i-1], s[i]);
+		if (!black) flushCover(colour, alpha);
+	}
+
+	// Bresenham, no anti-aliasing or blending.
+	void drawLineDraft(Vec2 a, Vec2 b, uint32_t ink) {
+		int x0 = std::lround(a.x), y0 = std::lround(a.y);
+		int x1 = std::lround(b.x), y1 = std::lround(b.y);
+		const int dx = std::abs(x1-x0), sx = x0<x1 ? 1 : -1;
+		const int dy =-std::abs(y1-y0), sy = y0<y1 ? 1 : -1;
+		for (int err = dx+dy;;) {
+			if (clip.x0 <= x0 && x0 < clip.x1 && clip.y0 <= y0 && y0 < clip.y1)
+				pixels[y0*W+x0] = ink;
+			if (x0 == x1 && y0 == y1) break;
+			const int e2 = 2*err;
+			if (e2 >= dy) err += dy, x0 += sx;
+			if (e2 <= dx) err += dx, y0 += sy;
 		}
 	}
 
-	void displayRaw(const RawSketch& sketch) {
-		for (RawStroke s : sketch.strokes) {
-			auto& p = s.points;
-			if (p.size() == 1) { drawLine(p[0], p[0]); continue; }
+	void displayStroke(const Stroke& s) {
+		s.pieces([&](std::span<const Point> p) { displayPoints(p, s.colour, s.alpha); });
+	}
+
+	void displayPoints(std::span<const Point> p, Col3 colour = {0,0,0}, uint8_t alpha = 255) {
+		if (p.empty()) return;
+		if (quality == Quality::Draft) {
+			// No blending in Draft, see-through or not.
+			const uint32_t ink = MapRGB(colour);
+			// Skips points that wouldn't move the line by more
+			// than lodTolerance pixels, but keeps the last one.
+			Vec2 prev = view.toScreen(p[0]);
 			for (std::size_t i=1; i<p.size(); i++) {
-				drawLine(p[i-1], p[i]);
+				Vec2 next = view.toScreen(p[i]);
+				if (i+1 < p.size()
+				&&  dot2({next.x-prev.x, next.y-prev.y}) < lodTolerance*lodTolerance)
+					continue;
+				drawLineDraft(prev, next, ink);
+				prev = next;
+			}
+			if (p.size() == 1) drawLineDraft(prev, prev, ink);
+			return;
+		}
+		screen.clear();
+		for (Point q : p) screen.push_back(view.toScreen(q));
+		drawLines(screen, colour, alpha);
+	}
+
+	// Flattened for this zoom (or one near it), and then drawn
+	// like a stroke through those points.
+	void displayCurve(const Curve& c) {
+		if (c.points.empty() || c.alpha == 0 || !screenBounds(c.points).intersects(clip)) return;
+		screen.clear();
+		for (Vec2 q : curves.get(c, view.zoom)) screen.push_back(view.toScreen(q));
+		if (quality == Quality::Draft) {
+			const uint32_t ink = MapRGB(c.colour);
+			for (std::size_t i=1; i<screen.size(); i++) drawLineDraft(screen[i-1], screen[i], ink);
+			if (screen.size() == 1) drawLineDraft(screen[0], screen[0], ink);
+			return;
+		}
+		drawLines(screen, c.colour, c.alpha);
+	}
+
+	void displayFill(const Fill& f) {
+		const Rect box = screenBounds(f.outline) & clip;
+		if (f.outline.size() < 3 || f.alpha == 0 || box.empty()) return;
+		scanline.clear();
+		f.edges([&](Point a, Point b) { scanline.add(view.toScreen(a), view.toScreen(b)); });
+		scanline.render(box, f.rule, [&](int y, int x, int n, uint8_t k) {
+			touchRow(y, x, x+n);
+			std::fill_n(&cover[y*W+x], n, k);
+		});
+		flushCover(f.colour, f.alpha);
+	}
+
+	// One repeat of a pattern's motif, drawn into the tile by
+	// another renderer. It's drawn with its neighbours on every
+	// side too, so whatever goes off one edge comes back on the
+	// other. Up and down can be out by up to half a pixel, the
+	// tile being a whole number of pixels high.
+	void drawMotif(const Pattern& p, PatternTiles::Tile& t) {
+		std::vector<uint32_t> one(t.w * t.h);
+		Renderer r {one, unsigned(t.w), unsigned(t.h), MapRGB, GetRGB};
+		r.clear();
+		const Real zoom = Real(t.w) / p.width;
+		for (int dy=-1; dy<=1; dy++)
+		for (int dx=-1; dx<=1; dx++) {
+			r.view = {Real(-dx*p.width), Real(-dy*p.height), zoom};
+			for (const Stroke& s : p.motif) r.displayStroke(s);
+		}
+		for (int y=0; y<t.h; y++)
+			std::copy_n(&one[y*t.w], t.w, &t.pixels[y*t.stride]);
+	}
+
+	// The region is filled the same as a Fill, except every run
+	// is darkened by the tile rows under it instead of a colour.
+	// The motif is only drawn when there's no tile for it at
+	// this zoom, however many times it repeats.
+	void displayPattern(const Pattern& p) {
+		const Rect box = screenBounds(p.region.outline) & clip;
+		if (p.region.outline.size() < 3 || p.motif.empty() || box.empty()) return;
+		const PatternTiles::Tile* tile = tiles.get(p, view.zoom,
+			[&](PatternTiles::Tile& t) { drawMotif(p, t); });
+		if (!tile) return displayPatternOversize(p, box);
+		const PatternTiles::Tile& t = *tile;
+		// Where repeat 'i' starts on screen. Each one's placed
+		// from where it is in the document, so the tile being a
+		// whole number of pixels doesn't add up across the page.
+		// Repeats come out a pixel longer or shorter here and
+		// there instead, unless the tile's exactly to scale.
+		const Real ox = -view.x * view.zoom, px = p.width  * view.zoom;
+		const Real oy = -view.y * view.zoom, py = p.height * view.zoom;
+		auto start = [](Real o, Real period, long i) { return long(std::lround(o + i*period)); };
+		auto repeat = [&](Real o, Real period, long x) {
+			long i = std::floor((x + Real(0.5) - o) / period);
+			while (x < start(o, period, i)) i--;
+			while (x >= start(o, period, i+1)) i++;
+			return i;
+		};
+		const bool exact = px == t.w;
+		scanline.clear();
+		p.region.edges([&](Point a, Point b) { scanline.add(view.toScreen(a), view.toScreen(b)); });
+		scanline.render(box, p.region.rule, [&](int y, int x, int n, uint8_t k) {
+			const long ty = y - start(oy, py, repeat(oy, py, y));
+			const uint32_t* row = t.row(std::min<long>(ty, t.h-1));
+			// A run carries on from the start of a row at the end
+			// of a repeat. Rows are several repeats long, so an
+			// exact tile gets through a few at a time.
+			while (n > 0) {
+				const long i = repeat(ox, px, x), c = x - start(ox, px, i);
+				const int m = std::min<long>(n, exact ? t.stride - c : start(ox, px, i+1) - x);
+				SIMD::darken(&pixels[y*W+x], row + c, m, k);
+				x += m, n -= m;
 			}
+		});
+	}
+
+	// A repeat too big for a tile: only the few repeats on
+	// screen, with their neighbours for whatever spills over,
+	// get drawn for the runs to darken with.
+	void displayPatternOversize(const Pattern& p, Rect box) {
+		const int w = box.x1-box.x0, h = box.y1-box.y0;
+		oversize.assign(std::size_t(w) * h, white);
+		Renderer r {oversize, unsigned(w), unsigned(h), MapRGB, GetRGB};
+		r.quality = quality;
+		const Vec2 a = view.toDocument({Real(box.x0), Real(box.y0)});
+		const Vec2 b = view.toDocument({Real(box.x1), Real(box.y1)});
+		const long i0 = std::floor(a.x / p.width)  - 1, i1 = std::floor(b.x / p.width)  + 1;
+		const long j0 = std::floor(a.y / p.height) - 1, j1 = std::floor(b.y / p.height) + 1;
+		for (long j=j0; j<=j1; j++)
+		for (long i=i0; i<=i1; i++) {
+			r.view = {a.x - i*p.width, a.y - j*p.height, view.zoom};
+			for (const Stroke& s : p.motif) r.displayStroke(s);
+		}
+		scanline.clear();
+		p.region.edges([&](Point a, Point b) { scanline.add(view.toScreen(a), view.toScreen(b)); });
+		scanline.render(box, p.region.rule, [&](int y, int x, int n, uint8_t k) {
+			SIMD::darken(&pixels[y*W+x], &oversize[(y-box.y0)*w + (x-box.x0)], n, k);
+		});
+	}
+
+	// Whites out every pixel whose centre is in the mask, a
+	// run at a time. Each row only looks at the blocks that
+	// are on screen.
+	void displayEraser(const Eraser& e) {
+		const Rect box = screenBounds(e) & clip;
+		if (box.empty()) return;
+		const Mask& m = e.shape;
+		// The view in the mask's pixels.
+		const Real k = std::max<Real>(e.scale, 1);
+		const Real vx = view.x*k, vy = view.y*k, zoom = view.zoom/k;
+		const int tx0 = Masks::blockOf(std::floor(vx + box.x0/zoom));
+		const int tx1 = Masks::blockOf(std::floor(vx + box.x1/zoom));
+		for (int y=box.y0; y<box.y1; y++) {
+			const int dy = std::floor(vy + (y + Real(0.5))/zoom);
+			const int ty = Masks::blockOf(dy), r = dy - ty*Mask::Tile;
+			auto it = ranges::lower_bound(m.blocks, std::pair {ty, tx0}, {},
+				[](const Mask::Block& b) { return std::pair<int,int> {b.ty, b.tx}; });
+			for (; it != m.blocks.end() && it->ty == ty && it->tx <= tx1; ++it)
+			for (int i=it->rows[r]; i<it->rows[r+1]; i+=2) {
+				const int left = it->tx*Mask::Tile;
+				const int x0 = std::max<int>(box.x0, std::ceil((left + it->runs[i]   - vx)*zoom - Real(0.5)));
+				const int x1 = std::min<int>(box.x1, std::ceil((left + it->runs[i+1] - vx)*zoom - Real(0.5)));
+				if (x0 < x1) std::fill(&pixels[y*W+x0], &pixels[y*W+x1], white);
+			}
+		}
+	}
+
+	// Lettering, a glyph at a time out of the atlas. Too small
+	// to read doesn't get drawn at all.
+	void displayMarker(const Marker& m) {
+		const Real px = m.size * view.zoom;
+		if (px < 2 || m.alpha == 0 || !screenBounds(m).intersects(clip)) return;
+		const uint32_t ink = MapRGB(m.colour);
+		const Real unit = px / Font::CapHeight;
+		Vec2 pen = view.toScreen(m.at);
+		const Real left = pen.x;
+		for (char c : m.text) {
+			if (c == '\n') { pen.x = left, pen.y += Font::LineHeight*unit; continue; }
+			if ((c & 0xc0) == 0x80) continue;
+			const int ix = std::floor(pen.x);
+			const int sub = std::min<int>((pen.x - ix) * GlyphAtlas::Subpixels, GlyphAtlas::Subpixels-1);
+			const char32_t code = uint8_t(c) < 0x80 ? char32_t(c) : U'?';
+			pen.x += Font::Advance*unit;
+			if (code == ' ') continue;
+			const GlyphAtlas::Glyph g = glyphs.get(code, px, sub);
+			const int gx = ix + g.left, gy = int(std::lround(pen.y)) + g.top;
+			const Rect r = Rect {gx, gy, gx + g.w, gy + g.h} & clip;
+			if (r.empty()) continue;
+			for (int y=r.y0; y<r.y1; y++)
+				SIMD::over(&pixels[y*W + r.x0], glyphs.row(g, y-gy) + (r.x0-gx), r.x1-r.x0, ink, m.alpha);
+		}
+	}
+
+	// A symbol's atoms through m (symbol to screen pixels),
+	// drawn by another renderer onto 'out'. Points are whole
+	// numbers, so they're put in 1/scale pixels and drawn at
+	// 1/scale zoom, to be placed finer than that.
+	void drawSymbol(const Symbol& s, Symbols::Transform m, Real scale,
+	                std::span<uint32_t> out, unsigned w, unsigned h, Rect area, Quality q) {
+		for (float& k : m) k *= scale;
+		std::vector<Atom> atoms {};
+		for (const Atom& a : s.atoms) Symbols::transform(a, m, atoms);
+		Renderer r {out, w, h, MapRGB, GetRGB};
+		r.view    = {0, 0, 1/scale};
+		r.clip    = area;
+		r.quality = q;
+		for (const Atom& a : atoms) r.displayAtom(a);
+	}
+
+	// Darkened in from the symbol's tile for how it's turned
+	// and scaled, which is only drawn the first time. Ones too
+	// big for a tile are drawn over white for only what's on
+	// screen, and darkened in the same way.
+	void displayInstance(const Instance& i) {
+		if (!i.symbol || i.symbol->atoms.empty() || !screenBounds(i).intersects(clip)) return;
+		const auto& t = i.transform;
+		const Real z = view.zoom;
+		const Symbols::Transform m {
+			t[0]*z, t[1]*z, (t[2]-view.x)*z,
+			t[3]*z, t[4]*z, (t[5]-view.y)*z
+		};
+		const SymbolTiles::Tile* tile = symbols.get(i.symbol, m, [&](SymbolTiles::Tile& t) {
+			ranges::fill(t.pixels, white);
+			drawSymbol(*i.symbol, t.transform(), 4, t.pixels, t.w, t.h, {0, 0, t.w, t.h}, Quality::Full);
+		});
+		if (!tile) {
+			const Rect r = screenBounds(i) & clip;
+			const int w = r.x1-r.x0, h = r.y1-r.y0;
+			oversize.assign(std::size_t(w) * h, white);
+			Symbols::Transform n = m;
+			n[2] -= r.x0, n[5] -= r.y0;
+			drawSymbol(*i.symbol, n, 1, oversize, w, h, {0, 0, w, h}, quality);
+			for (int y=r.y0; y<r.y1; y++)
+				SIMD::darken(&pixels[y*W + r.x0], &oversize[(y-r.y0)*w], w, 255);
+			return;
 		}
+		const int gx = std::lround(m[2]) + tile->x0, gy = std::lround(m[5]) + tile->y0;
+		const Rect r = Rect {gx, gy, gx + tile->w, gy + tile->h} & clip;
+		if (r.empty()) return;
+		for (int y=r.y0; y<r.y1; y++)
+			SIMD::darken(&pixels[y*W + r.x0], tile->row(y-gy) + (r.x0-gx), r.x1-r.x0, 255);
+	}
+
+	// Only opened up if it's on screen.
+	void displayPacked(const Packed& p) {
+		if (!screenBounds(p).intersects(clip)) return;
+		if (auto a = thawed.get(p)) displayAtom(*a);
+	}
+
+	// Whatever kind of atom it is, if it's one that draws.
+	void displayAtom(const Atom& a) {
+		if      (auto* s = std::get_if<Stroke>(&a)) displayStroke(*s);
+		else if (auto* f = std::get_if<Fill>  (&a)) displayFill(*f);
+		else if (auto* e = std::get_if<Eraser>(&a)) displayEraser(*e);
+		else if (auto* m = std::get_if<Marker>(&a)) displayMarker(*m);
+		else if (auto* p = std::get_if<Pattern>(&a)) displayPattern(*p);
+		else if (auto* c = std::get_if<Curve>(&a)) displayCurve(*c);
+		else if (auto* i = std::get_if<Instance>(&a)) displayInstance(*i);
+		else if (auto* p = std::get_if<Packed>(&a)) displayPacked(*p);
+	}
+
+	// Skips atoms in hidden layers. 'visible' is whether the
+	// layer the range starts in is, for ranges that don't start
+	// at the beginning. Opacity and blending need a LayerStack.
+	template <ranges::input_range Atoms>
+	void display(const Atoms& atoms, bool visible = true) {
+		for (const Atom& a : atoms)
+			if (auto* l = std::get_if<Layer>(&a))
+				visible = l->visible;
+			else if (visible)
+				displayAtom(a);
 	}
+	void display(const Sketch& sketch) { display(sketch.atoms); }
 
-};
\ No newline at end of file
+	void displayRaw(const RawSketch& sketch) {
+		for (const RawStroke& s : sketch.strokes)
+			displayStroke(static_cast<Stroke>(s));
+	}
+
+	// Screen space box an atom can draw into.
+	Rect screenBounds(const Stroke& s) const { return screenBounds(s.points); }
+	Rect screenBounds(const Atom& a) const {
+		if (auto* s = std::get_if<Stroke>(&a)) return screenBounds(s->points);
+		if (auto* f = std::get_if<Fill>  (&a)) return screenBounds(f->outline);
+		if (auto* e = std::get_if<Eraser>(&a)) return screenBounds(*e);
+		if (auto* m = std::get_if<Marker>(&a)) return screenBounds(*m);
+		if (auto* p = std::get_if<Pattern>(&a)) return screenBounds(p->region.outline);
+		// Curves stay inside their control points.
+		if (auto* c = std::get_if<Curve>(&a)) return screenBounds(c->points);
+		if (auto* i = std::get_if<Instance>(&a)) return screenBounds(*i);
+		if (auto* p = std::get_if<Packed>(&a)) return screenBounds(*p);
+		return {0, 0, 0, 0};
+	}
+	// Same as its points', without opening it.
+	Rect screenBounds(const Packed& p) const {
+		if (p.box[0] > p.box[2]) return {0, 0, 0, 0};
+		Vec2 a = view.toScreen(Point {p.box[0], p.box[1], 0});
+		Vec2 b = view.toScreen(Point {p.box[2], p.box[3], 0});
+		return {int(std::floor(a.x))-2, int(std::floor(a.y))-2,
+		        int(std::floor(b.x))+3, int(std::floor(b.y))+3};
+	}
+	// The symbol's box through the transform, padded for lines.
+	Rect screenBounds(const Instance& i) const {
+		if (!i.symbol || i.symbol->atoms.empty()) return {0, 0, 0, 0};
+		const auto& b = i.symbol->box;
+		Real x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+		for (Vec2 p : {Vec2 {b[0], b[1]}, Vec2 {b[2], b[1]}, Vec2 {b[0], b[3]}, Vec2 {b[2], b[3]}}) {
+			p = view.toScreen(Symbols::apply(i.transform, p));
+			x0 = min(x0, p.x), y0 = min(y0, p.y);
+			x1 = max(x1, p.x), y1 = max(y1, p.y);
+		}
+		return {int(std::floor(x0))-3, int(std::floor(y0))-3,
+		        int(std::ceil (x1))+4, int(std::ceil (y1))+4};
+	}
+	Rect screenBounds(const Marker& m) const {
+		if (m.size <= 0) return {0, 0, 0, 0};
+		const auto [cols, rows] = Font::extent(m.text);
+		const Real unit = m.size / Font::CapHeight;
+		const Vec2 a = view.toScreen(m.at);
+		const Vec2 b = view.toScreen(Vec2 {
+			m.at.x + (cols*Font::Advance) * unit,
+			m.at.y + ((rows-1)*Font::LineHeight + Font::CapHeight + Font::Descent) * unit
+		});
+		return {int(std::floor(a.x))-3, int(std::floor(a.y))-3,
+		        int(std::ceil (b.x))+3, int(std::ceil (b.y))+3};
+	}
+	Rect screenBounds(const Eraser& e) const {
+		const Mask& m = e.shape;
+		if (m.x0 == m.x1) return {0, 0, 0, 0};
+		const Real k = std::max<Real>(e.scale, 1);
+		Vec2 a = view.toScreen(Vec2 {m.x0/k, m.y0/k});
+		Vec2 b = view.toScreen(Vec2 {m.x1/k, m.y1/k});
+		return {int(std::floor(a.x)), int(std::floor(a.y)),
+		        int(std::ceil (b.x)), int(std::ceil (b.y))};
+	}
+	Rect screenBounds(std::span<const Point> p) const {
+		if (p.empty()) return {0, 0, 0, 0};
+		Real x0 = p[0].x, x1 = x0, y0 = p[0].y, y1 = y0;
+		for (Point q : p) {
+			x0 = min(x0, q.x), x1 = max(x1, q.x);
+			y0 = min(y0, q.y), y1 = max(y1, q.y);
+		}
+		Vec2 a = view.toScreen(Point {int16_t(x0), int16_t(y0), 0});
+		Vec2 b = view.toScreen(Point {int16_t(x1), int16_t(y1), 0});
+		return {int(std::floor(a.x))-2, int(std::floor(a.y))-2,
+		        int(std::floor(b.x))+3, int(std::floor(b.y))+3};
+	}
+};
@@ -0,0 +1,123 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "types.hh"
+#include "math.hh"
+
+// Polygon filler with an active edge table. Rows are done top
+// to bottom, with only the edges crossing a row looked at for
+// it, and each of those only leaves cells in the pixels it
+// actually passes through. A cell has the signed area the edge
+// covers in its pixel, and how much it moves the coverage for
+// every pixel to its right. Between cells the coverage can't
+// change, so those are handed out as solid runs. That makes it
+// O(edges + pixels edges touch + runs), whatever the area.
+//
+// Coverage is the exact area inside, as long as no two edges
+// go through the same pixel, and close to it when they do.
+class Scanline {
+	struct Edge {
+		Real x, dxdy; // x at y0
+		Real y0, y1;  // y0 < y1
+		int  dir;     // +1 going down, -1 going up
+	};
+	struct Cell { int x; Real cover, area; };
+
+	std::vector<Edge> edges, sorted, active;
+	std::vector<Cell> cells;
+	Real top = 0, bottom = 0;
+
+	// Adds the part of an edge within one row to the cells,
+	// where 'dy' is how much of the row it spans. Columns left
+	// of the clip just move the coverage along, and ones right
+	// of it don't matter.
+	void row(Real xa, Real xb, Real dy, int dir, int left, int right) {
+		Real xl = std::min(xa, xb), xr = std::max(xa, xb);
+		const Real width = xr - xl;
+		if (width < Real(1e-6)) {
+			const int cx = std::floor(xl);
+			if (cx >= right) return;
+			if (cx < left) cells.push_back({left-1, dir*dy, 0});
+			else cells.push_back({cx, dir*dy, dir*dy*(cx+1 - xl)});
+			return;
+		}
+		if (xl < left) {
+			const Real part = dy * (std::min<Real>(xr, left) - xl) / width;
+			cells.push_back({left-1, dir*part, 0});
+			xl = left;
+		}
+		for (int cx = std::floor(xl); cx < right && cx <= xr; cx++) {
+			const Real c0 = std::max<Real>(xl, cx), c1 = std::min<Real>(xr, cx+1);
+			if (c1 <= c0) continue;
+			const Real part = dy * (c1 - c0) / width;
+			cells.push_back({cx, dir*part, dir*part*(cx+1 - (c0+c1)/2)});
+		}
+	}
+
+	static uint8_t alpha(Real v, FillRule rule) {
+		v = std::abs(v);
+		if (rule == FillRule::EvenOdd) {
+			v = std::fmod(v, Real(2));
+			if (v > 1) v = 2 - v;
+		}
+		return std::min(v, Real(1)) * 255 + Real(0.5);
+	}
+
+public:
+	void clear() { edges.clear(); }
+
+	void add(Vec2 a, Vec2 b) {
+		if (a.y == b.y) return; // Flat edges don't change anything
+		const int dir = a.y < b.y ? 1 : -1;
+		if (dir < 0) std::swap(a, b);
+		if (edges.empty()) top = a.y, bottom = b.y;
+		top = std::min(top, a.y), bottom = std::max(bottom, b.y);
+		edges.push_back({a.x, (b.x-a.x) / (b.y-a.y), a.y, b.y, dir});
+	}
+
+	// Calls span(y, x, n, coverage) for each run of pixels in
+	// 'clip' with the same coverage, skipping empty ones.
+	template <typename F>
+	void render(Rect clip, FillRule rule, F span) {
+		if (edges.empty() || clip.empty()) return;
+		const int y0 = std::max<int>(clip.y0, std::floor(top));
+		const int y1 = std::min<int>(clip.y1, std::ceil(bottom));
+		sorted.clear();
+		for (const Edge& e : edges)
+			if (e.y1 > y0 && e.y0 < y1) sorted.push_back(e);
+		ranges::sort(sorted, {}, &Edge::y0);
+
+		active.clear();
+		std::size_t next = 0;
+		for (int y=y0; y<y1; y++) {
+			while (next < sorted.size() && sorted[next].y0 < y+1)
+				active.push_back(sorted[next++]);
+			std::erase_if(active, [&](const Edge& e) { return e.y1 <= y; });
+
+			cells.clear();
+			for (const Edge& e : active) {
+				const Real ya = std::max<Real>(e.y0, y), yb = std::min<Real>(e.y1, y+1);
+				if (yb <= ya) continue;
+				row(e.x + (ya-e.y0)*e.dxdy, e.x + (yb-e.y0)*e.dxdy, yb-ya, e.dir, clip.x0, clip.x1);
+			}
+			ranges::sort(cells, {}, &Cell::x);
+
+			Real acc = 0;
+			for (std::size_t i=0; i<cells.size(); ) {
+				const int x = cells[i].x;
+				Real area = 0, cover = 0;
+				for (; i<cells.size() && cells[i].x == x; i++)
+					area += cells[i].area, cover += cells[i].cover;
+				if (x >= clip.x0)
+					if (const uint8_t k = alpha(acc + area, rule)) span(y, x, 1, k);
+				acc += cover;
+				const int from = std::max(x+1, clip.x0);
+				const int to   = i < cells.size() ? cells[i].x : clip.x1;
+				if (from < to)
+					if (const uint8_t k = alpha(acc, rule)) span(y, from, to-from, k);
+			}
+		}
+	}
+};
@@ -0,0 +1,81 @@
+#pragma once
+#include <map>
+#include <deque>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+
+// Decides when the main loop has anything to do at all. Input
+// and requestFrame() make the next loop iteration a real frame,
+// timers wake it up at a given time, and idle jobs get run in
+// short slices whenever there's no frame to draw. When none of
+// those are waiting the loop just sleeps until the next event.
+class Scheduler {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	// Returns true if it wants to run again later.
+	using IdleJob = std::function<bool()>;
+
+private:
+	std::multimap<Clock::time_point, std::function<void()>> timers;
+	std::deque<IdleJob> idle;
+	bool frame = true; // The first one's always wanted
+
+public:
+	// Longest it'll ever sleep, just in case.
+	static constexpr std::chrono::milliseconds MaxSleep {1000};
+	// How often it wakes up while something's animating.
+	static constexpr std::chrono::milliseconds FramePeriod {16};
+
+	// Set while something on screen moves by itself (timeline
+	// playback), which wants frames whether or not there's input.
+	bool animating = false;
+
+	void requestFrame() { frame = true; }
+
+	void at(Clock::time_point t, std::function<void()> f) { timers.emplace(t, std::move(f)); }
+	void after(Clock::duration d, std::function<void()> f) { at(Clock::now() + d, std::move(f)); }
+
+	// Runs 'f' every 'period' for as long as the scheduler lives.
+	void every(Clock::duration period, std::function<void()> f) {
+		after(period, [this, period, f] { f(); every(period, f); });
+	}
+
+	void whenIdle(IdleJob job) { idle.push_back(std::move(job)); }
+
+	// Runs the timers that are due. Returns whether a frame
+	// was asked for since the last call.
+	bool due() {
+		const auto now = Clock::now();
+		while (!timers.empty() && timers.begin()->first <= now) {
+			auto f = std::move(timers.begin()->second);
+			timers.erase(timers.begin());
+			f();
+		}
+		return std::exchange(frame, false);
+	}
+
+	// Runs idle jobs round robin until 'slice' is used up.
+	// Each one should only do a small piece of work per call.
+	void runIdle(Clock::duration slice) {
+		const auto deadline = Clock::now() + slice;
+		for (std::size_t n = idle.size(); n-- && Clock::now() < deadline; ) {
+			IdleJob job = std::move(idle.front());
+			idle.pop_front();
+			if (job()) idle.push_back(std::move(job));
+		}
+	}
+
+	// How long the loop can sleep if no events come in.
+	std::chrono::milliseconds timeout() const {
+		using namespace std::chrono;
+		if (frame || !idle.empty()) return milliseconds {0};
+		const milliseconds most = animating ? FramePeriod : MaxSleep;
+		if (timers.empty()) return most;
+		return std::clamp(
+			ceil<milliseconds>(timers.begin()->first - Clock::now()),
+			milliseconds {0}, most
+		);
+	}
+};
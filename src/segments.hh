@@ -0,0 +1,327 @@
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include <optional>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "types.hh"
+#include "math.hh"
+#include "document.hh"
+#include "history.hh"
+#include "curves.hh"
+#include "cold.hh"
+
+// Every stroke segment in the document, bucketed by where it
+// is, so the cutting eraser only ever looks at the segments
+// near it. Cutting a stroke swaps it for one with the erased
+// bits taken out (and cut into pieces, see Stroke::ends), so
+// nothing after it in the document has to move, unless there's
+// nothing left of it, when it's deleted. Curves are cut as the
+// stroke they flatten to (pressure and all), and turn into
+// that, or back into a curve if they're still in one piece.
+class SegmentIndex {
+	static constexpr int Cell = 32; // Document pixels
+	static constexpr Real CurveTolerance = 0.25;
+
+	// Points [from, to] of an atom, 'to' being the same as
+	// 'from' for a piece that's only one point. Packed atoms
+	// are indexed by their box, so they needn't be opened until
+	// the cutter gets near, as a single Whole entry per cell.
+	struct Entry { uint32_t atom, from, to; };
+	static constexpr uint32_t Whole = UINT32_MAX;
+
+	std::unordered_map<uint64_t, std::vector<Entry>> cells;
+	PVector<Atom> synced;    // What's in here, and keeps it alive
+	std::size_t   lastPoints = 0; // The last stroke grows in place
+	Real          widest = 0;     // Biggest stroke radius in here
+
+	std::vector<Entry> found; // Scratch for erase()
+	std::vector<Entry> whole; // A packed atom's segments, for erase()
+	Stroke flat {};           // A curve as a stroke
+	Atom   thawed {};         // A packed atom opened up
+
+	// The stroke to index or cut for an atom, if it has one.
+	// The same curve always flattens to the same stroke, so
+	// its entries still line up with it later on.
+	const Stroke* strokeOf(const Atom& a) {
+		if (auto* s = std::get_if<Stroke>(&a)) return s;
+		if (auto* c = std::get_if<Curve>(&a)) return &(flat = Curves::toStroke(*c, CurveTolerance));
+		if (auto* p = std::get_if<Packed>(&a))
+			if (auto b = Cold::unpack(*p)) return strokeOf(thawed = std::move(*b));
+		return nullptr;
+	}
+
+	static int cellOf(Real x) { return std::floor(x / Cell); }
+	static uint64_t key(int cx, int cy) { return uint64_t(uint32_t(cx)) << 32 | uint32_t(cy); }
+
+	template <typename F>
+	static void cellsOf(Point a, Point b, Real reach, F f) {
+		const int x0 = cellOf(std::min(a.x, b.x) - reach), x1 = cellOf(std::max(a.x, b.x) + reach);
+		const int y0 = cellOf(std::min(a.y, b.y) - reach), y1 = cellOf(std::max(a.y, b.y) + reach);
+		for (int cy=y0; cy<=y1; cy++)
+		for (int cx=x0; cx<=x1; cx++)
+			f(key(cx, cy));
+	}
+
+	// Calls f(from, to) for each segment of 'points' starting
+	// at or after 'first'.
+	template <typename F>
+	static void segments(const Stroke& s, std::size_t first, F f) {
+		std::size_t start = 0;
+		s.pieces([&](std::span<const Point> p) {
+			const std::size_t end = start + p.size();
+			if (p.size() == 1 && start >= first) f(start, start);
+			for (std::size_t i=std::max(start, first); i+1<end; i++) f(i, i+1);
+			start = end;
+		});
+	}
+
+	// Calls f(key) for each cell a packed atom's box is in.
+	template <typename F>
+	static void cellsOf(const Packed& p, F f) {
+		if (p.box[0] > p.box[2]) return;
+		cellsOf({p.box[0], p.box[1], 0}, {p.box[2], p.box[3], 0}, 0, f);
+	}
+
+	void add(std::size_t i, const Atom& a, std::size_t first = 0) {
+		if (auto* p = std::get_if<Packed>(&a)) {
+			widest = std::max(widest, p->diameter / Real(2));
+			cellsOf(*p, [&](uint64_t k) { cells[k].push_back({uint32_t(i), Whole, Whole}); });
+			return;
+		}
+		auto* s = strokeOf(a);
+		if (!s) return;
+		widest = std::max(widest, s->diameter / Real(2));
+		segments(*s, first, [&](std::size_t from, std::size_t to) {
+			cellsOf(s->points[from], s->points[to], 0, [&](uint64_t k) {
+				cells[k].push_back({uint32_t(i), uint32_t(from), uint32_t(to)});
+			});
+		});
+	}
+
+	void remove(std::size_t i, const Atom& a) {
+		auto drop = [&](uint64_t k) {
+			auto it = cells.find(k);
+			if (it == cells.end()) return;
+			std::erase_if(it->second, [&](const Entry& e) { return e.atom == i; });
+			if (it->second.empty()) cells.erase(it);
+		};
+		// The box has any segments in it too, if it was packed
+		// after being indexed.
+		if (auto* p = std::get_if<Packed>(&a)) return cellsOf(*p, drop);
+		auto* s = strokeOf(a);
+		if (!s) return;
+		segments(*s, 0, [&](std::size_t from, std::size_t to) {
+			cellsOf(s->points[from], s->points[to], 0, drop);
+		});
+	}
+
+	// Atom 'i' has been deleted, so the ones after it move down.
+	void shift(std::size_t i) {
+		for (auto& [k, entries] : cells)
+			for (Entry& e : entries)
+				if (e.atom > i) e.atom--;
+	}
+
+	void rebuild(const PVector<Atom>& atoms) {
+		cells.clear();
+		widest = 0;
+		std::size_t i = 0;
+		atoms.forEach([&](const Atom& a) { add(i++, a); });
+	}
+
+	// Where along p->q (0 to 1) is within 'r' of the segment
+	// a->b. Empty if t0 > t1.
+	static std::pair<Real,Real> within(Vec2 p, Vec2 q, Vec2 a, Vec2 b, Real r) {
+		Real t0 = INFINITY, t1 = -INFINITY;
+		const Vec2 d {q.x-p.x, q.y-p.y};
+		const Real dd = dot2(d);
+		if (dd == 0) {
+			if (SDFline(p, a, b) <= r) t0 = 0, t1 = 1;
+			return {t0, t1};
+		}
+		// Both round ends...
+		for (Vec2 c : {a, b}) {
+			const Vec2 m {p.x-c.x, p.y-c.y};
+			const Real B = dot(m, d), C = dot2(m) - r*r;
+			const Real disc = B*B - dd*C;
+			if (disc < 0) continue;
+			const Real s = std::sqrt(disc);
+			t0 = std::min(t0, (-B - s) / dd), t1 = std::max(t1, (-B + s) / dd);
+		}
+		// ...and the straight part between them.
+		const Vec2 ab {b.x-a.x, b.y-a.y};
+		if (const Real l = len(ab); l > 0) {
+			const Vec2 u {ab.x/l, ab.y/l}, n {-u.y, u.x};
+			const Vec2 m {p.x-a.x, p.y-a.y};
+			Real lo = -INFINITY, hi = INFINITY;
+			auto slab = [&](Real at, Real speed, Real min, Real max) {
+				if (speed == 0) {
+					if (at < min || at > max) lo = INFINITY, hi = -INFINITY;
+					return;
+				}
+				Real e0 = (min - at) / speed, e1 = (max - at) / speed;
+				if (e0 > e1) std::swap(e0, e1);
+				lo = std::max(lo, e0), hi = std::min(hi, e1);
+			};
+			slab(dot(m, u), dot(d, u), 0, l);
+			slab(dot(m, n), dot(d, n), -r, r);
+			if (lo <= hi) t0 = std::min(t0, lo), t1 = std::max(t1, hi);
+		}
+		return {std::max(t0, Real(0)), std::min(t1, Real(1))};
+	}
+
+	// The stroke with whatever's within 'r' (plus its own
+	// radius) of a->b taken out, if there was anything. Only
+	// the segments in 'near' (sorted) can be, so only they get
+	// looked at.
+	static std::optional<Stroke> cut(const Stroke& s, std::span<const Entry> near, Vec2 a, Vec2 b, Real r) {
+		Stroke out {s.diameter, {}, s.colour, s.alpha};
+		bool hit = false;
+		r += s.diameter / Real(2);
+		std::size_t start = 0; // Of the piece being built in 'out'
+		auto point = [&](Point p) {
+			if (out.points.size() > start) {
+				const Point q = out.points.back();
+				if (q.x == p.x && q.y == p.y) return;
+			}
+			out.points.push_back(p);
+		};
+		// Lone points left over from cutting don't count, only
+		// ones that were a whole piece to begin with.
+		auto close = [&](bool lone = false) {
+			if (out.points.size() == start+1 && !lone) out.points.pop_back();
+			if (out.points.size() > start) {
+				if (start > 0) out.ends.push_back(start);
+				start = out.points.size();
+			}
+		};
+		auto lerp = [](Point p, Point q, Real t) {
+			return Point {
+				int16_t(std::lround(p.x + t*(q.x-p.x))),
+				int16_t(std::lround(p.y + t*(q.y-p.y))),
+				p.pressure + t*(q.pressure-p.pressure)
+			};
+		};
+		auto vec = [](Point p) { return Vec2 {Real(p.x), Real(p.y)}; };
+
+		std::size_t next = 0, first = 0;
+		s.pieces([&](std::span<const Point> piece) {
+			const std::size_t end = first + piece.size();
+			if (piece.size() == 1) {
+				while (next < near.size() && near[next].from < first) next++;
+				if (next < near.size() && near[next].from == first
+				&&  SDFline(vec(piece[0]), a, b) <= r) hit = true;
+				else point(piece[0]), close(true);
+			}
+			bool open = false;
+			for (std::size_t i=first; i+1<end; i++) {
+				const Point p = s.points[i], q = s.points[i+1];
+				while (next < near.size() && near[next].from < i) next++;
+				auto [t0, t1] = next < near.size() && near[next].from == i
+					? within(vec(p), vec(q), a, b, r) : std::pair {Real(1), Real(0)};
+				if (t0 > t1) {
+					if (!open) point(p), open = true;
+					point(q);
+					continue;
+				}
+				hit = true;
+				if (t0 > 0) {
+					if (!open) point(p);
+					point(lerp(p, q, t0));
+				}
+				close(), open = false;
+				if (t1 < 1) point(lerp(p, q, t1)), point(q), open = true;
+			}
+			close();
+			first = end;
+		});
+		if (!hit) return {};
+		return out;
+	}
+
+public:
+	// Catches up with the document. Appending, and replacing
+	// atoms without moving any, only costs what changed.
+	void sync(const PVector<Atom>& atoms) {
+		const std::size_t from = synced.mismatch(atoms, Cold::Same {});
+		const bool moved = atoms.size() != synced.size() && from+1 < synced.size();
+		if (moved) rebuild(atoms);
+		else {
+			// Same item, but the last stroke can get longer in place.
+			if (from == synced.size() && !synced.empty())
+				if (auto* s = std::get_if<Stroke>(&synced.back()); s && s->points.size() > lastPoints)
+					add(synced.size()-1, synced.back(), lastPoints ? lastPoints-1 : 0);
+			using It = PVector<Atom>::iterator;
+			It now {&atoms, from};
+			for (It it {&synced, from}; it != synced.end() && now != atoms.end(); ++it, ++now)
+				if (!Cold::same(&*it, &*now)) {
+					remove(it.index(), *it);
+					add(now.index(), *now);
+				}
+			for (; now != atoms.end(); ++now) add(now.index(), *now);
+			for (std::size_t i=atoms.size(); i<synced.size(); i++)
+				remove(i, synced[i]);
+		}
+		synced = atoms;
+		auto* last = atoms.empty() ? nullptr : std::get_if<Stroke>(&atoms.back());
+		lastPoints = last ? last->points.size() : 0;
+	}
+
+	// Cuts out of every stroke whatever's within 'radius' of
+	// a->b (both in document space), as one edit per stroke
+	// that's actually touched. A drag is lots of these, so it
+	// wants to be between History::begin() and end().
+	void erase(Document& doc, History& history, Point a, Point b, Real radius) {
+		sync(doc.latest().atoms);
+		found.clear();
+		cellsOf(a, b, radius + widest, [&](uint64_t k) {
+			if (auto it = cells.find(k); it != cells.end())
+				found.insert(found.end(), it->second.begin(), it->second.end());
+		});
+		ranges::sort(found, {}, [](const Entry& e) { return std::pair {e.atom, e.from}; });
+		const auto [end, _] = ranges::unique(found, {}, [](const Entry& e) { return std::pair {e.atom, e.from}; });
+		found.erase(end, found.end());
+
+		const Vec2 va {Real(a.x), Real(a.y)}, vb {Real(b.x), Real(b.y)};
+		// Last atom first, so deleting one doesn't move the
+		// ones still to do.
+		for (std::size_t j=found.size(); j>0; ) {
+			std::size_t i = j-1;
+			while (i > 0 && found[i-1].atom == found[j-1].atom) i--;
+			const std::size_t at = found[i].atom;
+			const Stroke* s = strokeOf(synced[at]);
+			if (!s) { j = i; continue; }
+			const bool curve = s == &flat;
+			std::span<const Entry> near = std::span {found}.subspan(i, j-i);
+			// Packed, so it's only been found by its box. Every
+			// segment might be near, now it's open.
+			if (near.back().from == Whole) {
+				whole.clear();
+				segments(*s, 0, [&](std::size_t from, std::size_t to) {
+					whole.push_back({uint32_t(at), uint32_t(from), uint32_t(to)});
+				});
+				near = whole;
+			}
+			if (auto after = cut(*s, near, va, vb, radius)) {
+				remove(at, synced[at]);
+				if (after->points.empty()) {
+					history.apply(doc, Edit::DeleteRange {at, at+1});
+					shift(at);
+					synced = doc.latest().atoms;
+				} else {
+					Atom now = std::move(*after);
+					if (curve)
+						if (auto c = Curves::fit(std::get<Stroke>(now), 1)) now = std::move(*c);
+					history.apply(doc, Edit::ReplaceAtom {at, std::move(now)});
+					synced = doc.latest().atoms;
+					add(at, synced[at]);
+				}
+			}
+			j = i;
+		}
+		auto* last = synced.empty() ? nullptr : std::get_if<Stroke>(&synced.back());
+		lastPoints = last ? last->points.size() : 0;
+	}
+};
@@ -0,0 +1,97 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+// Byte-wise kernels over rows of 32 bit pixels. They're
+// written with GCC/Clang vector extensions, so they turn into
+// SSE/NEON, or wasm SIMD with -msimd128, 16 bytes (4 pixels)
+// at a time, and into plain loops anywhere else.
+//
+// Nothing here cares about channel order. Every byte of a
+// pixel gets the same treatment, so they work on whatever
+// format the window surface happens to be in.
+namespace SIMD
+{
+	using u8x16  = uint8_t  __attribute__((vector_size(16)));
+	using u16x16 = uint16_t __attribute__((vector_size(32)));
+	using u32x4  = uint32_t __attribute__((vector_size(16)));
+
+	inline u8x16 load(const uint32_t* p) { u8x16 v; std::memcpy(&v, p, 16); return v; }
+	inline void  store(uint32_t* p, u8x16 v) { std::memcpy(p, &v, 16); }
+
+	inline u16x16 widen (u8x16  v) { return __builtin_convertvector(v, u16x16); }
+	inline u8x16  narrow(u16x16 v) { return __builtin_convertvector(v, u8x16); }
+
+	// x/255 rounded, exact for anything up to 255*255.
+	inline u16x16 div255(u16x16 x) {
+		x += 128;
+		return (x + (x >> 8)) >> 8;
+	}
+
+	inline u8x16 min(u8x16 a, u8x16 b) {
+		const u8x16 less = (u8x16)(a < b);
+		return b ^ ((a ^ b) & less);
+	}
+
+	// Mixes 'blended' back with 'dst' by 'opacity' (0-255).
+	inline u8x16 mix(u8x16 dst, u8x16 blended, uint8_t opacity) {
+		if (opacity == 255) return blended;
+		const u16x16 o = u16x16 {} + opacity;
+		return narrow(div255(widen(dst)*(255-o) + widen(blended)*o));
+	}
+
+	// Runs 'f' on 4 pixels at a time, then on one pixel at a
+	// time (padded out to a vector) for whatever's left.
+	template <typename F>
+	void rows(uint32_t* dst, const uint32_t* src, std::size_t n, F f) {
+		std::size_t i = 0;
+		for (; i+4 <= n; i+=4)
+			store(dst+i, f(load(dst+i), load(src+i)));
+		for (; i<n; i++) {
+			uint32_t d[4] {dst[i]}, s[4] {src[i]};
+			store(d, f(load(d), load(s)));
+			dst[i] = d[0];
+		}
+	}
+
+	// dst = min(dst, src), mixed in by 'opacity'.
+	void darken(uint32_t* dst, const uint32_t* src, std::size_t n, uint8_t opacity) {
+		rows(dst, src, n, [=](u8x16 d, u8x16 s) { return mix(d, min(d, s), opacity); });
+	}
+
+	// dst = dst*src, mixed in by 'opacity'.
+	void multiply(uint32_t* dst, const uint32_t* src, std::size_t n, uint8_t opacity) {
+		rows(dst, src, n, [=](u8x16 d, u8x16 s) {
+			return mix(d, narrow(div255(widen(d)*widen(s))), opacity);
+		});
+	}
+
+	// Source-over of a solid colour through per pixel coverage.
+	// The colour is premultiplied by 'alpha' once up front, and
+	// each pixel's coverage is spread over its 4 bytes, so it's
+	//   dst = colour*alpha*k + dst*(1 - alpha*k)
+	// with every product rounded back down to 8 bits.
+	void over(uint32_t* dst, const uint8_t* cover, std::size_t n, uint32_t colour, uint8_t alpha) {
+		const u16x16 a   = u16x16 {} + alpha;
+		const u16x16 src = div255(widen((u8x16)(u32x4 {} + colour)) * a);
+		auto blend = [&](u8x16 d, uint32_t k4) {
+			const u8x16 c = (u8x16)(u32x4 {k4});
+			const u16x16 k = widen(__builtin_shufflevector(c, c, 0,0,0,0, 1,1,1,1, 2,2,2,2, 3,3,3,3));
+			const u16x16 ak = div255(k*a);
+			return narrow(div255(src*k) + div255(widen(d)*(255-ak)));
+		};
+		std::size_t i = 0;
+		for (; i+4 <= n; i+=4) {
+			uint32_t k4;
+			std::memcpy(&k4, cover+i, 4);
+			if (k4) store(dst+i, blend(load(dst+i), k4));
+		}
+		for (; i<n; i++) {
+			if (!cover[i]) continue;
+			uint32_t d[4] {dst[i]};
+			store(d, blend(load(d), cover[i]));
+			dst[i] = d[0];
+		}
+	}
+};
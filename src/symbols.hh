@@ -0,0 +1,223 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include "types.hh"
+#include "math.hh"
+#include "glyphs.hh"
+
+// Symbols and their instances. A symbol's atoms are in its own
+// document pixels, and an instance's transform takes them to
+// the page, like an Affine.
+namespace Symbols
+{
+	using Transform = std::array<float,6>;
+	constexpr Transform Identity {1,0,0, 0,1,0};
+
+	Vec2 apply(const Transform& m, Vec2 p) {
+		return {m[0]*p.x + m[1]*p.y + m[2], m[3]*p.x + m[4]*p.y + m[5]};
+	}
+
+	// m after n.
+	Transform compose(const Transform& m, const Transform& n) {
+		return {
+			m[0]*n[0] + m[1]*n[3], m[0]*n[1] + m[1]*n[4], m[0]*n[2] + m[1]*n[5] + m[2],
+			m[3]*n[0] + m[4]*n[3], m[3]*n[1] + m[4]*n[4], m[3]*n[2] + m[4]*n[5] + m[5]
+		};
+	}
+
+	// Whether 'a' can be part of a symbol. Erasers, patterns and
+	// layers are about the page rather than a shape on it.
+	bool allowed(const Atom& a) {
+		return std::holds_alternative<Stroke>(a) || std::holds_alternative<Curve>(a)
+		    || std::holds_alternative<Fill>(a)   || std::holds_alternative<Marker>(a)
+		    || std::holds_alternative<Instance>(a);
+	}
+
+	// Whether drawing 'a' ever draws 's'. A symbol can't be put
+	// in itself, since drawing it would never stop.
+	bool uses(const Atom& a, const Symbol* s) {
+		auto* i = std::get_if<Instance>(&a);
+		if (!i || !i->symbol) return false;
+		return i->symbol.get() == s
+		    || ranges::any_of(i->symbol->atoms, [&](const Atom& b) { return uses(b, s); });
+	}
+
+	// What 'atoms' cover through m, as x0, y0, x1, y1, or x0
+	// past x1 if nothing. Goes all the way down through
+	// instances, rather than trusting their symbols' boxes to
+	// be up to date.
+	std::array<float,4> extent(std::span<const Atom> atoms, const Transform& m = Identity) {
+		constexpr float Inf = std::numeric_limits<float>::infinity();
+		std::array<float,4> box {Inf, Inf, -Inf, -Inf};
+		auto add = [&](Vec2 p) {
+			p = apply(m, p);
+			box[0] = std::min(box[0], p.x), box[1] = std::min(box[1], p.y);
+			box[2] = std::max(box[2], p.x), box[3] = std::max(box[3], p.y);
+		};
+		auto points = [&](std::span<const Point> ps) {
+			for (Point p : ps) add({Real(p.x), Real(p.y)});
+		};
+		for (const Atom& a : atoms) std::visit(Overloaded {
+			[&](const Stroke& s) { points(s.points); },
+			[&](const Curve& c)  { points(c.points); },
+			[&](const Fill& f)   { points(f.outline); },
+			[&](const Marker& k) {
+				if (k.size <= 0) return;
+				const auto [cols, rows] = Font::extent(k.text);
+				const Real unit = k.size / Font::CapHeight;
+				const Real w = cols*Font::Advance * unit;
+				const Real h = ((rows-1)*Font::LineHeight + Font::CapHeight + Font::Descent) * unit;
+				add({Real(k.at.x), Real(k.at.y)}), add({k.at.x + w, Real(k.at.y)});
+				add({Real(k.at.x), k.at.y + h}),   add({k.at.x + w, k.at.y + h});
+			},
+			[&](const Instance& i) {
+				if (!i.symbol) return;
+				const auto b = extent(i.symbol->atoms, compose(m, i.transform));
+				if (b[0] > b[2]) return;
+				// Already through m, so undo add()'s.
+				for (Vec2 p : {Vec2 {b[0], b[1]}, Vec2 {b[2], b[3]}}) {
+					box[0] = std::min(box[0], p.x), box[1] = std::min(box[1], p.y);
+					box[2] = std::max(box[2], p.x), box[3] = std::max(box[3], p.y);
+				}
+			},
+			[](const auto&) {}
+		}, a);
+		return box;
+	}
+
+	// The same, but all 0 if nothing.
+	std::array<float,4> bounds(std::span<const Atom> atoms, const Transform& m = Identity) {
+		const auto box = extent(atoms, m);
+		if (box[0] > box[2]) return {0, 0, 0, 0};
+		return box;
+	}
+
+	// 'a' through m, added to 'out', with instances swapped for
+	// what they draw. Lettering only moves and scales, it
+	// doesn't turn or lean.
+	void transform(const Atom& a, const Transform& m, std::vector<Atom>& out) {
+		auto point = [&](Point p) {
+			const Vec2 q = apply(m, {Real(p.x), Real(p.y)});
+			auto fit = [](Real v) {
+				return int16_t(std::clamp<long>(std::lround(v), INT16_MIN, INT16_MAX));
+			};
+			return Point {fit(q.x), fit(q.y), p.pressure};
+		};
+		std::visit(Overloaded {
+			[&](const Stroke& s) {
+				Stroke t = s;
+				for (Point& p : t.points) p = point(p);
+				out.push_back(std::move(t));
+			},
+			[&](const Curve& c) {
+				Curve t = c;
+				for (Point& p : t.points) p = point(p);
+				out.push_back(std::move(t));
+			},
+			[&](const Fill& f) {
+				Fill t = f;
+				for (Point& p : t.outline) p = point(p);
+				out.push_back(std::move(t));
+			},
+			[&](const Marker& k) {
+				Marker t = k;
+				t.at    = point(k.at);
+				t.size *= std::sqrt(std::abs(m[0]*m[4] - m[1]*m[3]));
+				out.push_back(std::move(t));
+			},
+			[&](const Instance& i) {
+				if (!i.symbol) return;
+				const Transform n = compose(m, i.transform);
+				for (const Atom& b : i.symbol->atoms) transform(b, n, out);
+			},
+			[](const auto&) {}
+		}, a);
+	}
+};
+
+// Symbols drawn out once per look, so an instance is only
+// copying rows. A look is the symbol and how it's turned and
+// scaled on screen (its transform times the zoom, to about a
+// thousandth), not where it is, so instances that are only
+// moved about share one. Where they go is rounded to whole
+// pixels. The one that went longest without being used goes
+// when there's too many or they're too big.
+class SymbolTiles {
+	static constexpr std::size_t Max      = 64;
+	static constexpr std::size_t MaxBytes = 16<<20;
+	static constexpr int         MaxSize  = 2048;
+	static constexpr float       Steps    = 1024; // Per document pixel
+
+public:
+	// The symbol with its origin at (-x0, -y0), drawn over white.
+	struct Tile {
+		std::shared_ptr<const Symbol> symbol;
+		std::array<int32_t,4> linear;
+		int x0, y0, w, h;
+		std::vector<uint32_t> pixels {};
+		uint64_t used = 0;
+
+		const uint32_t* row(int y) const { return &pixels[y*w]; }
+		// The symbol to the tile's pixels.
+		Symbols::Transform transform() const {
+			return {linear[0]/Steps, linear[1]/Steps, Real(-x0),
+			        linear[2]/Steps, linear[3]/Steps, Real(-y0)};
+		}
+	};
+
+private:
+	std::vector<Tile> tiles;
+	std::size_t bytes = 0;
+	uint64_t clock = 0;
+
+public:
+	// The tile for 's' through 'm' (symbol to screen pixels,
+	// only the turning and scaling of which matters). If it
+	// isn't there yet it's made with draw(tile), which has to
+	// draw the symbol through tile.transform() into its pixels.
+	// Null if it would be too big, in which case it's better
+	// drawn straight onto the screen.
+	template <typename F>
+	const Tile* get(const std::shared_ptr<const Symbol>& s, const Symbols::Transform& m, F draw) {
+		const std::array<int32_t,4> linear {
+			int32_t(std::lround(m[0]*Steps)), int32_t(std::lround(m[1]*Steps)),
+			int32_t(std::lround(m[3]*Steps)), int32_t(std::lround(m[4]*Steps))
+		};
+		for (Tile& t : tiles)
+			if (t.symbol == s && t.linear == linear) {
+				t.used = ++clock;
+				return &t;
+			}
+
+		// Where the box's corners end up, padded for line width.
+		Tile t {s, linear, 0, 0, 0, 0};
+		const Symbols::Transform l = t.transform();
+		const auto& b = s->box;
+		Real x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+		for (Vec2 p : {Vec2 {b[0], b[1]}, Vec2 {b[2], b[1]}, Vec2 {b[0], b[3]}, Vec2 {b[2], b[3]}}) {
+			p = Symbols::apply(l, p);
+			x0 = min(x0, p.x), y0 = min(y0, p.y);
+			x1 = max(x1, p.x), y1 = max(y1, p.y);
+		}
+		t.x0 = int(std::floor(x0)) - 3, t.y0 = int(std::floor(y0)) - 3;
+		t.w  = int(std::ceil(x1)) + 4 - t.x0, t.h = int(std::ceil(y1)) + 4 - t.y0;
+		const std::size_t size = std::size_t(t.w) * t.h * sizeof(uint32_t);
+		if (t.w > MaxSize || t.h > MaxSize || size > MaxBytes) return nullptr;
+
+		while (!tiles.empty() && (tiles.size() == Max || bytes + size > MaxBytes)) {
+			auto oldest = ranges::min_element(tiles, {}, &Tile::used);
+			bytes -= oldest->pixels.size() * sizeof(uint32_t);
+			tiles.erase(oldest);
+		}
+		t.pixels.resize(std::size_t(t.w) * t.h);
+		t.used = ++clock;
+		bytes += size;
+		draw(t);
+		return &tiles.emplace_back(std::move(t));
+	}
+
+	void clear() { tiles.clear(), bytes = 0; }
+};
@@ -0,0 +1,14 @@
+#pragma once
+#include <iostream>
+
+// Bare bones checking for the native tests (make checks). A
+// failed check says where it was and carries on, and main()
+// returns how many failed.
+inline int failures = 0;
+
+inline void check(bool ok, const char* what, const char* file, int line) {
+	if (ok) return;
+	std::cerr << file << ":" << line << ": " << what << "\n";
+	failures++;
+}
+#define CHECK(x) check(bool(x), #x, __FILE__, __LINE__)
@@ -0,0 +1,117 @@
+/*
+	make checks
+	Packing atoms away: they have to come back exactly as they
+	were, packing mustn't look like an edit, and the cutter has
+	to find them without opening every one. Also says how much
+	smaller pen strokes get.
+*/
+
+#include <cstdio>
+#include <random>
+#include "../segments.hh"
+#include "check.hh"
+
+std::vector<uint8_t> encode(const Atom& a) {
+	std::vector<uint8_t> out {};
+	Binary::Writer {out}.atom(a);
+	return out;
+}
+
+// A wobbly line at 240 Hz, with varying pressure.
+Stroke pen(std::mt19937& rng, int k, int n) {
+	std::normal_distribution<double> jitter {0, 0.4};
+	const double speed = 100 + 300*(k%7)/6.0, bend = (k%5) * 0.8;
+	double x = 100, y = 100 + 10*k, a = 0.3*k;
+	Stroke s {3, {}};
+	for (int i=0; i<n; i++) {
+		a += bend / 240 * std::sin(i / 40.0);
+		x += speed/240 * std::cos(a), y += speed/240 * std::sin(a);
+		s.points.push_back({int16_t(std::lround(x + jitter(rng))), int16_t(std::lround(y + jitter(rng))),
+		                    float(0.5 + 0.3*std::sin(i / 60.0))});
+	}
+	return s;
+}
+
+int main() {
+	std::mt19937 rng {75};
+
+	// Round trips, for every kind that packs.
+	Stroke red = pen(rng, 1, 200);
+	red.colour = {200, 0, 0}, red.alpha = 100;
+	Stroke cut = pen(rng, 2, 200);
+	cut.ends = {50, 120};
+	std::optional<Curve> curve = Curves::fit(pen(rng, 3, 400), 2);
+	CHECK(curve);
+	for (const Atom& a : {Atom {pen(rng, 0, 200)}, Atom {red}, Atom {cut}, Atom {curve ? *curve : Curve {}}}) {
+		auto p = Cold::pack(std::make_shared<Atom>(a));
+		CHECK(p);
+		if (!p) continue;
+		auto back = Cold::unpack(*p);
+		CHECK(back && encode(*back) == encode(a));
+		CHECK(encode(*p) == encode(a)); // Written as what it was
+	}
+
+	// How much smaller strokes get.
+	std::size_t before = 0, after = 0;
+	for (int k=0; k<40; k++) {
+		const Stroke s = pen(rng, k, 480);
+		auto p = Cold::pack(std::make_shared<Atom>(s));
+		before += s.points.size() * sizeof(Point);
+		after  += p ? p->bytes.size() : s.points.size() * sizeof(Point);
+	}
+	std::printf("Packed 40 pen strokes from %zu bytes to %zu (%.1fx smaller)\n",
+	            before, after, double(before) / after);
+	CHECK(before > 2*after);
+
+	// One that won't open is kept as it is.
+	auto p = Cold::pack(std::make_shared<Atom>(pen(rng, 4, 200)));
+	if (p) {
+		p->bytes.resize(p->bytes.size() / 2);
+		auto bytes = encode(*p);
+		CHECK(bytes[0] == Binary::Sealed);
+		Binary::Reader r {bytes};
+		const Atom a = r.atom();
+		auto* q = std::get_if<Packed>(&a);
+		CHECK(r.ok && r.atEnd() && q && q->bytes == p->bytes && q->box == p->box && q->sum == p->sum);
+	}
+
+	// Packing is neither an edit nor a new version.
+	Document doc {};
+	History history {};
+	for (int k=0; k<200; k++) doc.apply(Edit::AppendAtom {pen(rng, k, 100)});
+	doc.publish();
+	int edits = 0, published = 0;
+	doc.onEdit    = [&](const DocEdit&) { edits++; };
+	doc.onPublish = [&](uint64_t) { published++; };
+	const uint64_t version = doc.published().version;
+	ColdStore cold {};
+	while (cold.step(doc)) {}
+	CHECK(doc.settle());
+	CHECK(!cold.step(doc) && !doc.settle()); // Nothing left to do
+	CHECK(edits == 0 && published == 0);
+	CHECK(doc.published().version == version);
+	std::size_t packed = 0;
+	doc.published().atoms.forEach([&](const Atom& a) { packed += std::holds_alternative<Packed>(a); });
+	CHECK(packed == 200 - 64);
+	doc.onEdit = {}, doc.onPublish = {};
+
+	// The cutter finds packed strokes by their box, and they
+	// come back exactly on undo.
+	std::vector<std::vector<uint8_t>> was {};
+	doc.latest().atoms.forEach([&](const Atom& a) { was.push_back(encode(a)); });
+	SegmentIndex index {};
+	const PVector<Atom>::Item first = doc.latest().atoms.item(0);
+	const Atom opened = *Cold::unpack(std::get<Packed>(*first));
+	const Stroke& s = std::get<Stroke>(opened);
+	const Point at = s.points[s.points.size()/2];
+	history.begin();
+	index.erase(doc, history, at, at, 4);
+	history.end();
+	CHECK(!std::holds_alternative<Packed>(doc.latest().atoms[0]));
+	history.undo(doc);
+	std::size_t i = 0;
+	bool same = true;
+	doc.latest().atoms.forEach([&](const Atom& a) { same &= encode(a) == was[i++]; });
+	CHECK(same);
+	return failures;
+}
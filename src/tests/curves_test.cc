@@ -0,0 +1,98 @@
+/*
+	make checks
+	Fits synthetic pen strokes to curves: how many points it
+	saves, how far the curve strays from what was drawn, and
+	how long drawing them takes either way.
+*/
+
+#include <cstdio>
+#include <chrono>
+#include <random>
+#include "../decimate.hh"
+#include "../renderer.hh"
+#include "check.hh"
+
+// Distance from p to the segment ab.
+Real distance(Vec2 p, Vec2 a, Vec2 b) {
+	const Real dx = b.x - a.x, dy = b.y - a.y;
+	const Real len = dx*dx + dy*dy;
+	const Real t = len ? std::clamp(((p.x - a.x)*dx + (p.y - a.y)*dy) / len, Real(0), Real(1)) : 0;
+	return std::hypot(a.x + t*dx - p.x, a.y + t*dy - p.y);
+}
+
+// A wobbly line or curl at 240 Hz, 'n' samples long, thinned
+// out the way drawing does. 'noise' is how shaky the hand is.
+Stroke pen(std::mt19937& rng, int k, int n, double x, double y, double noise = 0) {
+	std::normal_distribution<double> jitter {0, 1};
+	const double speed = 100 + 300*(k%7)/6.0, bend = (k%5) * 0.8;
+	double a = 0.3*k;
+	Stroke s {3, {}};
+	Decimator d {};
+	for (int i=0; i<n; i++) {
+		a += bend / 240 * std::sin(i / 40.0);
+		x += speed/240 * std::cos(a), y += speed/240 * std::sin(a);
+		const Point p {int16_t(std::lround(x + noise*jitter(rng))), int16_t(std::lround(y + noise*jitter(rng))), 0.5f};
+		if (i == 0) d.begin(p), s.points.push_back(p);
+		else if (auto q = d.add(p)) s.points.push_back(*q);
+	}
+	if (auto q = d.end()) s.points.push_back(*q);
+	return s;
+}
+
+uint32_t map(Col3 c) { return 0xff000000 | c.r << 16 | c.g << 8 | c.b; }
+Col3 get(uint32_t p) { return {uint8_t(p >> 16), uint8_t(p >> 8), uint8_t(p)}; }
+
+int main() {
+	std::mt19937 rng {73};
+
+	// Every kept sample has to be near the curve it's fitted to.
+	// Shaky strokes mostly don't fit in fewer points, and stay
+	// as they are.
+	for (double noise : {0.0, 0.4}) {
+		std::size_t points = 0, controls = 0, fitted = 0;
+		Real worst = 0;
+		for (int k=0; k<40; k++) {
+			const Stroke s = pen(rng, k, 240, 100, 100 + 10*k, noise);
+			auto c = Curves::fit(s, 1);
+			points += s.points.size(), controls += c ? c->points.size() : s.points.size();
+			if (!c) continue;
+			fitted++;
+			std::vector<Vec2> flat {};
+			Curves::flatten(c->points, 0.25, [&](Vec2 v) { flat.push_back(v); });
+			for (Point p : s.points) {
+				Real d = INFINITY;
+				for (std::size_t i=1; i<flat.size(); i++)
+					d = std::min(d, distance(Curves::vec(p), flat[i-1], flat[i]));
+				worst = std::max(worst, d);
+			}
+		}
+		std::printf("Noise %.1f px: %zu of 40 strokes fitted, %zu points down to %zu, none more than %.2f px off\n",
+		            noise, fitted, points, controls, worst);
+		CHECK(worst < 2);
+		if (noise == 0) CHECK(controls < points*3/4);
+	}
+
+	// Drawing the same strokes as strokes and as curves.
+	std::vector<Atom> strokes {}, curves {};
+	for (int k=0; k<2000; k++) {
+		std::uniform_real_distribution<double> at {0, 3000};
+		const Stroke s = pen(rng, k, 240, at(rng), at(rng));
+		strokes.push_back(s);
+		auto c = Curves::fit(s, 1);
+		curves.push_back(c ? Atom {*c} : Atom {s});
+	}
+	constexpr unsigned W = 800, H = 600;
+	std::vector<uint32_t> pixels (W*H);
+	Renderer r {pixels, W, H, map, get};
+	auto time = [&](const std::vector<Atom>& atoms, Real zoom) {
+		r.view = {0, 0, zoom};
+		r.clear(), r.display(atoms); // Flattens the curves for this zoom
+		const auto start = std::chrono::steady_clock::now();
+		r.clear(), r.display(atoms);
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	};
+	for (Real zoom : {0.2, 1.0})
+		std::printf("2000 strokes at zoom %.1f: %.0f ms as strokes, %.0f ms as curves\n",
+		            zoom, time(strokes, zoom), time(curves, zoom));
+	return failures;
+}
@@ -0,0 +1,98 @@
+/*
+	make checks
+	Drags the cutter through a document and undoes it: the
+	drag is one step, strokes with nothing left are gone, and
+	undo and redo get back exactly what was there.
+*/
+
+#include "../segments.hh"
+#include "../binary.hh"
+#include "check.hh"
+
+std::vector<uint8_t> encode(const Document& doc) {
+	std::vector<uint8_t> out {};
+	Binary::Writer w {out};
+	doc.latest().atoms.forEach([&](const Atom& a) { w.atom(a); });
+	return out;
+}
+
+// A horizontal stroke at height y, from x0 to x1.
+Stroke line(int y, int x0, int x1, float pressure = 1) {
+	Stroke s {4, {}};
+	for (int x=x0; x<=x1; x+=5) s.points.push_back({int16_t(x), int16_t(y), pressure});
+	return s;
+}
+
+// Drags the cutter from (x, y0) down to (x, y1) a few pixels
+// per motion event, as one step.
+void drag(Document& doc, History& history, SegmentIndex& index, int x, int y0, int y1, Real radius) {
+	history.begin();
+	Point from {int16_t(x), int16_t(y0), 1};
+	index.erase(doc, history, from, from, radius);
+	for (int y=y0+3; y<=y1; y+=3) {
+		const Point to {int16_t(x), int16_t(y), 1};
+		index.erase(doc, history, from, to, radius);
+		from = to;
+	}
+	history.end();
+}
+
+int main() {
+	Document doc {};
+	History history {};
+	SegmentIndex index {};
+	for (int i=0; i<10; i++) history.apply(doc, Edit::AppendAtom {line(20 + 10*i, 0, 200)});
+	history.apply(doc, Edit::AppendAtom {line(300, 96, 104)}); // Short enough to go entirely
+	history.apply(doc, Edit::AppendAtom {Marker {"after"}});
+	const auto before = encode(doc);
+	const std::size_t atoms = doc.latest().atoms.size();
+
+	// Straight down the middle, then across the short one.
+	drag(doc, history, index, 100, 0, 320, 6);
+	const auto cut = encode(doc);
+	CHECK(cut != before);
+	CHECK(doc.latest().atoms.size() == atoms-1);
+	CHECK(std::holds_alternative<Marker>(doc.latest().atoms.back()));
+	for (std::size_t i=0; i<10; i++) {
+		auto* s = std::get_if<Stroke>(&doc.latest().atoms[i]);
+		CHECK(s && s->ends.size() == 1);
+	}
+
+	history.undo(doc);
+	CHECK(encode(doc) == before);
+	history.redo(doc);
+	CHECK(encode(doc) == cut);
+	history.undo(doc);
+	CHECK(encode(doc) == before);
+
+	// Cutting again after undoing has to see the strokes that
+	// came back, and undoing that on its own leaves the first.
+	history.redo(doc);
+	drag(doc, history, index, 50, 0, 120, 4);
+	CHECK(doc.latest().atoms.size() == atoms-1);
+	history.undo(doc);
+	CHECK(encode(doc) == cut);
+	history.undo(doc);
+	CHECK(encode(doc) == before);
+
+	// Curves keep their pressure, and one that's only trimmed
+	// at an end is still a curve.
+	Curve c {4, {{0,400,0.25f}, {60,380,0.25f}, {140,420,0.75f}, {200,400,0.75f}}};
+	const Stroke flat = Curves::toStroke(c, 0.25);
+	CHECK(flat.points.front().pressure == 0.25f && flat.points.back().pressure == 0.75f);
+	history.apply(doc, Edit::AppendAtom {c});
+	const auto curved = encode(doc);
+	drag(doc, history, index, 100, 360, 440, 3);
+	auto* middle = std::get_if<Stroke>(&doc.latest().atoms.back());
+	CHECK(middle && middle->ends.size() == 1);
+	for (Point p : middle ? middle->points : std::vector<Point> {})
+		CHECK(p.pressure >= 0.25f && p.pressure <= 0.75f);
+	history.undo(doc);
+	CHECK(encode(doc) == curved);
+	drag(doc, history, index, 200, 360, 440, 3);
+	CHECK(std::holds_alternative<Curve>(doc.latest().atoms.back()));
+	history.undo(doc);
+	CHECK(encode(doc) == curved);
+
+	return failures;
+}
@@ -0,0 +1,61 @@
+/*
+	make checks
+	Thins out noisy synthetic pen strokes and checks every
+	dropped sample stays within tolerance of what's kept.
+*/
+
+#include <cstdio>
+#include <random>
+#include "../decimate.hh"
+#include "check.hh"
+
+// Distance from p to the segment ab.
+Real distance(Point p, Point a, Point b) {
+	const Real dx = b.x - a.x, dy = b.y - a.y;
+	const Real len = dx*dx + dy*dy;
+	const Real t = len ? std::clamp(((p.x - a.x)*dx + (p.y - a.y)*dy) / len, Real(0), Real(1)) : 0;
+	return std::hypot(a.x + t*dx - p.x, a.y + t*dy - p.y);
+}
+
+int main() {
+	std::mt19937 rng {62};
+	std::normal_distribution<double> jitter {0, 0.4};
+
+	std::size_t samples = 0, kept = 0;
+	for (int k=0; k<40; k++) {
+		// A wobbly line or curl at 240 Hz, 100 to 400 px/s.
+		std::vector<Point> in {};
+		const double speed = 100 + 300*(k%7)/6.0, bend = (k%5) * 0.8;
+		double x = 100, y = 100 + 10*k, a = 0.3*k;
+		for (int i=0; i<240; i++) {
+			a += bend / 240 * std::sin(i / 40.0);
+			x += speed/240 * std::cos(a), y += speed/240 * std::sin(a);
+			const float pressure = 0.5f + 0.3f*std::sin(i / 60.0);
+			in.push_back({int16_t(std::lround(x + jitter(rng))),
+			              int16_t(std::lround(y + jitter(rng))), pressure});
+		}
+
+		// Which samples got kept, by index.
+		Decimator d {};
+		std::vector<std::size_t> out {0};
+		d.begin(in[0]);
+		for (std::size_t i=1; i<in.size(); i++)
+			if (auto p = d.add(in[i])) {
+				CHECK(p->x == in[i-1].x && p->y == in[i-1].y);
+				out.push_back(i-1);
+			}
+		if (auto p = d.end()) out.push_back(in.size()-1);
+		CHECK(out.back() == in.size()-1);
+
+		for (std::size_t j=1; j<out.size(); j++)
+		for (std::size_t i=out[j-1]+1; i<out[j]; i++) {
+			const Point p = in[i], a = in[out[j-1]], b = in[out[j]];
+			const Real tol = d.tolerance * (Real(0.5) + p.pressure);
+			CHECK(distance(p, a, b) <= tol + Real(1e-3));
+		}
+		samples += in.size(), kept += out.size();
+	}
+	std::printf("Kept %zu of %zu samples (%.0f%%)\n", kept, samples, 100.0*kept/samples);
+	CHECK(kept < samples*3/4);
+	return failures;
+}
@@ -0,0 +1,89 @@
+/*
+	make checks
+	Drives the governor with a made up clock: a run of slow
+	frames should cost one notch of quality per frame, cheapest
+	first, and a run of fast ones should give it all back. Time
+	between frames doesn't count.
+*/
+
+#include "../governor.hh"
+#include "check.hh"
+
+int main() {
+	using std::chrono::microseconds;
+	microseconds t {0};
+	const RenderSettings best {};
+	Governor g {best, [&] { return t; }};
+
+	auto frame = [&](microseconds cost) {
+		g.begin();
+		t += cost;
+		g.lap(Governor::Events);
+		return g.endFrame();
+	};
+	auto notches = [](const RenderSettings& a, const RenderSettings& b) {
+		return (a.cacheBytes != b.cacheBytes) + (a.refineBudget != b.refineBudget)
+		     + (a.lodTolerance != b.lodTolerance);
+	};
+
+	// Twice the target, every frame.
+	for (int i=0; i<60; i++) {
+		const RenderSettings before = g.settings();
+		const bool changed = frame(2*g.target);
+		const RenderSettings& after = g.settings();
+		CHECK(changed == (notches(before, after) > 0));
+		CHECK(notches(before, after) <= 1);
+		// Nothing costlier until the cheaper knobs are used up.
+		if (after.refineBudget != best.refineBudget) CHECK(after.cacheBytes == 4u<<20);
+		if (after.lodTolerance != best.lodTolerance) CHECK(after.refineBudget == microseconds {500});
+	}
+	CHECK(g.settings().cacheBytes   == 4u<<20);
+	CHECK(g.settings().refineBudget == microseconds {500});
+	CHECK(g.settings().lodTolerance == 16);
+	CHECK(!frame(2*g.target));
+
+	// One slow frame among fast ones is smoothed over.
+	Governor h {best, [&] { return t; }};
+	for (int i=0; i<30; i++) {
+		h.begin();
+		t += i == 15 ? 3*h.target : h.target/4;
+		h.lap(Governor::Events);
+		CHECK(!h.endFrame());
+	}
+
+	// Waiting for the browser's next frame in between isn't
+	// part of a frame.
+	Governor web {best, [&] { return t; }};
+	for (int i=0; i<60; i++) {
+		t += microseconds {16667};
+		web.begin();
+		t += web.target/4;
+		web.lap(Governor::Events);
+		CHECK(!web.endFrame());
+	}
+	CHECK(web.counters().overBudget == 0);
+
+	// Nor is sleeping until the next event, after a frame or
+	// after a turn that didn't draw one.
+	Governor idle {best, [&] { return t; }};
+	for (int i=0; i<60; i++) {
+		idle.begin();
+		t += idle.target/4;
+		idle.lap(Governor::Events);
+		if (i%2) idle.skip();
+		else     CHECK(!idle.endFrame());
+		t += std::chrono::milliseconds {1000};
+	}
+	CHECK(idle.counters().overBudget == 0);
+
+	// Plenty of headroom, for long enough, undoes all of it.
+	for (int i=0; i<2000 && g.settings() != best; i++) {
+		const RenderSettings before = g.settings();
+		frame(g.target/4);
+		CHECK(notches(before, g.settings()) <= 1);
+	}
+	CHECK(g.settings() == best);
+	CHECK(g.counters().cacheShrunk == g.counters().cacheGrown);
+	CHECK(g.counters().lodRaised   == g.counters().lodLowered);
+	return failures;
+}
@@ -0,0 +1,125 @@
+/*
+	make checks
+	Autosave round trips: whatever a session journals has to
+	come back the same, crash or no crash.
+*/
+
+#include <filesystem>
+#include <fstream>
+#include "../journal.hh"
+#include "check.hh"
+
+namespace fs = std::filesystem;
+
+// What the document holds, the way the snapshot writes it.
+std::vector<uint8_t> encode(const Document& doc) {
+	std::vector<uint8_t> out {};
+	Binary::Writer w {out};
+	doc.latest().atoms.forEach([&](const Atom& a) { w.atom(a); });
+	return out;
+}
+
+Stroke stroke(int seed) {
+	Stroke s {unsigned(2 + seed%5), {}};
+	for (int i=0; i<20; i++)
+		s.points.push_back({int16_t(seed*7 + i*3), int16_t(seed*5 - i*2), float(i%4) / 4});
+	return s;
+}
+
+int main() {
+	const fs::path dir = fs::temp_directory_path() / "sketch journal test";
+	fs::remove_all(dir);
+	fs::create_directories(dir);
+	const std::string path = dir / "autosave";
+
+	// A session with every kind of edit, compacting often.
+	Document first {};
+	first.publish();
+	{
+		Journal journal {first, path, 4<<10};
+		for (int i=0; i<200; i++) {
+			first.apply(Edit::AppendAtom {stroke(i)});
+			first.apply(Edit::ExtendStroke {{int16_t(i), int16_t(i), 0.5f}});
+			if (i%10 == 3) first.apply(Edit::ReplaceAtom {std::size_t(i/2), stroke(-i)});
+			if (i%25 == 7) first.apply(Edit::DeleteRange {std::size_t(i/3), std::size_t(i/3 + 2)});
+			if (i%30 == 9) first.apply(Edit::Splice {1, 3, {first.latest().atoms.item(0)}});
+			if (i%40 == 11) {
+				Stroke s = stroke(i);
+				s.colour = {200, 40, 20}, s.alpha = 128;
+				first.apply(Edit::AppendAtom {std::move(s)});
+				first.apply(Edit::AppendAtom {Fill {{{0,0,1}, {40,0,1}, {40,40,1}}, {}, FillRule::NonZero, {30,80,190}}});
+				// Erased zoomed in, at four mask pixels to one.
+				first.apply(Edit::AppendAtom {Masks::start(24, {int16_t(i*4), 0, 1}, 4)});
+				first.apply(Edit::ExtendStroke {{int16_t(i*4 + 30), 20, 1}});
+			}
+			first.publish();
+		}
+		first.apply(Edit::AppendAtom {stroke(999)}); // Never published
+	}
+
+	Document second {};
+	CHECK(Journal::recover(second, path));
+	CHECK(encode(second) == encode(first));
+
+	// The next session snapshots what it recovered, but never
+	// gets to swap in its own (empty) journal, as if it had
+	// crashed: a directory's in the way of the new one. That
+	// leaves the old journal next to the new snapshot.
+	second.publish();
+	fs::create_directory(path + ".journal.tmp");
+	{ Journal journal {second, path}; }
+	fs::remove(path + ".journal.tmp");
+	CHECK(fs::file_size(path + ".journal") > 0);
+
+	Document third {};
+	CHECK(Journal::recover(third, path));
+	CHECK(encode(third) == encode(second));
+
+	// A record torn halfway through writing is ignored.
+	std::ofstream {path + ".journal", std::ios::binary | std::ios::app} << std::string("\x40\0\0\0\x12\x34", 6);
+	Document fourth {};
+	CHECK(Journal::recover(fourth, path));
+	CHECK(encode(fourth) == encode(second));
+
+	// Instances replayed from the journal share their symbol,
+	// each edit having it in full.
+	{
+		fs::remove(path + ".snapshot"), fs::remove(path + ".journal");
+		auto icon = std::make_shared<Symbol>("icon", std::vector<Atom> {stroke(1)});
+		icon->box = Symbols::bounds(icon->atoms);
+		Document doc {};
+		doc.publish();
+		{
+			Journal journal {doc, path};
+			for (int i=0; i<3; i++) doc.apply(Edit::AppendAtom {Instance {icon, {1,0,float(i), 0,1,0}}});
+			doc.publish();
+		}
+		Document back {};
+		CHECK(Journal::recover(back, path));
+		CHECK(encode(back) == encode(doc));
+		const PVector<Atom>& atoms = back.latest().atoms;
+		CHECK(atoms.size() == 3);
+		for (std::size_t i=1; i<atoms.size(); i++)
+			CHECK(std::get<Instance>(atoms[i]).symbol == std::get<Instance>(atoms[0]).symbol);
+	}
+
+	// Tags mean what they did when older journals were written.
+	std::vector<uint8_t> tagged {};
+	Binary::Writer w {tagged};
+	Stroke red = stroke(0);
+	red.colour = {255, 0, 0};
+	w.atom(stroke(0));
+	CHECK(tagged[0] == 0);
+	tagged.clear(), w.atom(red);
+	CHECK(tagged[0] == 5);
+	tagged.clear(), w.atom(Masks::start(8, {0, 0, 1}));
+	CHECK(tagged[0] == 2);
+	tagged.clear(), w.atom(Masks::start(8, {0, 0, 1}, 2));
+	Binary::Reader r {tagged};
+	const Atom fine = r.atom();
+	CHECK(tagged[0] == Binary::FineEraser && r.ok);
+	CHECK(std::holds_alternative<Eraser>(fine) && std::get<Eraser>(fine).scale == 2);
+
+	fs::remove_all(dir);
+	return failures;
+}
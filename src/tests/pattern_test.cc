@@ -0,0 +1,78 @@
+/*
+	make checks
+	Patterns have to stay where the document puts them at any
+	zoom, not drift a bit further every repeat.
+*/
+
+#include <cstdio>
+#include "../renderer.hh"
+#include "check.hh"
+
+constexpr unsigned W = 1600, H = 40;
+
+uint32_t map(Col3 c) { return 0xff000000 | c.r << 16 | c.g << 8 | c.b; }
+Col3 get(uint32_t p) { return {uint8_t(p >> 16), uint8_t(p >> 8), uint8_t(p)}; }
+
+int main() {
+	// A thin upright line at the left of every 16 pixel repeat,
+	// over a region far wider than the screen.
+	Pattern p {{Stroke {1, {{4,0,1}, {4,16,1}}}}, 16, 16,
+	           Fill {{{0,0,1}, {20000,0,1}, {20000,200,1}, {0,200,1}}}};
+
+	Real worst = 0;
+	for (Real zoom : {1.0, 1.37, 2.6, 0.73}) {
+		std::vector<uint32_t> pixels (W*H);
+		Renderer r {pixels, W, H, map, get};
+		r.clear();
+		r.view = {Real(3.3), 0, zoom};
+		r.display(std::array<Atom,1> {p});
+
+		// Where each dark run is along a row, against where
+		// the document says the line is. Being out by the same
+		// everywhere is only rounding; it's the spread that's
+		// drift.
+		Real lo = INFINITY, hi = -INFINITY;
+		const int y = H/2;
+		for (unsigned x=0; x<W; ) {
+			if (get(pixels[y*W+x]).r > 128) { x++; continue; }
+			unsigned end = x;
+			while (end < W && get(pixels[y*W+end]).r <= 128) end++;
+			const Real centre = (x + end) / Real(2);
+			const Real doc = r.view.x + centre / zoom;
+			const Real line = std::round((doc - 4.5) / 16) * 16 + 4.5;
+			if (x > 0 && end < W) lo = std::min(lo, (doc - line) * zoom), hi = std::max(hi, (doc - line) * zoom);
+			x = end;
+		}
+		worst = std::max(worst, hi - lo);
+	}
+	std::printf("Most a repeat's line moves from where the others are: %.2f px\n", worst);
+	CHECK(worst < 1.25);
+
+	// A repeat far wider than a tile can be, zoomed right in:
+	// drawn without one, at the end of one repeat and the start
+	// of the next.
+	Pattern wide {{Stroke {1, {{4,0,1}, {4,16,1}}}}, 300, 16,
+	              Fill {{{0,0,1}, {20000,0,1}, {20000,200,1}, {0,200,1}}}};
+	PatternTiles tiles {};
+	CHECK(!tiles.get(wide, 32, [](PatternTiles::Tile&) {}));
+	{
+		std::vector<uint32_t> pixels (W*H);
+		Renderer r {pixels, W, H, map, get};
+		r.clear();
+		r.view = {299, 0, 32};
+		r.display(std::array<Atom,1> {wide});
+		// The next repeat's line is at 304, so 160 here, and
+		// there's nothing else.
+		int dark = 0;
+		for (unsigned x=0; x<W; x++) dark += get(pixels[(H/2)*W+x]).r < 255;
+		CHECK(get(pixels[(H/2)*W + 160]).r < 128);
+		CHECK(dark <= 4);
+	}
+
+	// Tiles are only shared between patterns that look the same.
+	Pattern q = p;
+	q.motif[0].points[1].x = 12;
+	CHECK(PatternTiles::same(p, p));
+	CHECK(!PatternTiles::same(p, q));
+	return failures;
+}
@@ -0,0 +1,48 @@
+/*
+	make checks
+	Replays synthetic pen strokes through the predictor and
+	checks it guesses closer than not predicting at all.
+*/
+
+#include <cstdio>
+#include <numbers>
+#include "../predict.hh"
+#include "check.hh"
+
+int main() {
+	constexpr double Pi = std::numbers::pi, Hz = 240, Ahead = 0.02;
+
+	// Loops, waves and spirals at handwriting speeds (a few
+	// hundred px/s), each a second long.
+	std::vector<std::vector<Predict::Sample>> strokes {};
+	for (int k=0; k<12; k++) {
+		auto& s = strokes.emplace_back();
+		const double speed = 300 + 60*k, turn = 1 + k%4;
+		for (int i=0; i<Hz; i++) {
+			const double t = i/Hz, a = 2*Pi*turn*t;
+			const double r = speed / (2*Pi*turn) * (k%3 == 2 ? 0.5 + t : 1);
+			const double x = k%3 == 1 ? speed*t : r*std::cos(a);
+			const double y = k%3 == 1 ? 40*std::sin(a) : r*std::sin(a);
+			s.push_back({Real(400 + x), Real(300 + y), 0.5f, t});
+		}
+	}
+
+	const auto e = Predict::evaluate(std::span {strokes}, Ahead);
+	std::printf("Predicting %g ms ahead at %g Hz: mean %.2f px, rms %.2f px, max %.2f px"
+	            " (%.2f px not predicting)\n", Ahead*1000, Hz, e.mean, e.rms, e.max, e.baseline);
+	CHECK(e.samples > 0);
+	CHECK(e.baseline > 5);
+	CHECK(e.mean < e.baseline/2);
+
+	// A document's strokes, which only have their points.
+	std::vector<Atom> atoms {};
+	for (auto& s : strokes) {
+		Stroke out {3, {}};
+		for (auto& p : s) out.points.push_back({int16_t(p.x), int16_t(p.y), p.pressure});
+		atoms.push_back(std::move(out));
+	}
+	const auto d = Predict::evaluate(atoms, Hz, Ahead);
+	CHECK(d.samples == e.samples);
+	CHECK(d.mean < d.baseline/2);
+	return failures;
+}
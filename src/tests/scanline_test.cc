@@ -0,0 +1,92 @@
+/*
+	make checks
+	Checks the scanline filler's coverage against 16x16
+	supersampling, and tiled against whole-screen rendering.
+*/
+
+#include <cstdio>
+#include <numbers>
+#include "../scanline.hh"
+#include "check.hh"
+
+constexpr int W = 200, H = 200;
+
+using Polygon = std::vector<Vec2>;
+
+std::vector<uint8_t> fill(const Polygon& p, FillRule rule, Rect clip = {0, 0, W, H}) {
+	Scanline s {};
+	for (std::size_t i=0; i<p.size(); i++) s.add(p[i], p[(i+1) % p.size()]);
+	std::vector<uint8_t> out (W*H);
+	s.render(clip, rule, [&](int y, int x, int n, uint8_t k) {
+		std::fill_n(&out[y*W + x], n, k);
+	});
+	return out;
+}
+
+// Winding number of 'p' around (x, y).
+int winding(const Polygon& p, Real x, Real y) {
+	int w = 0;
+	for (std::size_t i=0; i<p.size(); i++) {
+		const Vec2 a = p[i], b = p[(i+1) % p.size()];
+		if ((a.y <= y) != (b.y <= y)) {
+			const Real cx = a.x + (y - a.y) / (b.y - a.y) * (b.x - a.x);
+			if (cx > x) w += a.y < b.y ? 1 : -1;
+		}
+	}
+	return w;
+}
+
+// Largest difference from 16x16 supersampling, from 0 to 1.
+Real error(const Polygon& p, FillRule rule) {
+	const auto got = fill(p, rule);
+	Real worst = 0;
+	for (int y=0; y<H; y++)
+	for (int x=0; x<W; x++) {
+		int inside = 0;
+		for (int sy=0; sy<16; sy++)
+		for (int sx=0; sx<16; sx++) {
+			const int w = winding(p, x + (sx+Real(0.5))/16, y + (sy+Real(0.5))/16);
+			inside += rule == FillRule::EvenOdd ? w & 1 : w != 0;
+		}
+		worst = std::max(worst, std::abs(got[y*W + x]/Real(255) - inside/Real(256)));
+	}
+	return worst;
+}
+
+int main() {
+	const Real Pi = std::numbers::pi_v<Real>;
+	const Polygon square   {{20.3f, 30.7f}, {150.2f, 30.7f}, {150.2f, 170.5f}, {20.3f, 170.5f}};
+	const Polygon triangle {{100.5f, 10.2f}, {190.1f, 180.9f}, {12.4f, 150.3f}};
+	Polygon star {};
+	for (int i=0; i<5; i++) {
+		const Real a = i * 4*Pi/5 - Pi/2;
+		star.push_back({100 + 90*std::cos(a), 100 + 90*std::sin(a)});
+	}
+
+	const Real es = error(square, FillRule::EvenOdd), et = error(triangle, FillRule::EvenOdd);
+	const Real eo = error(star, FillRule::EvenOdd), en = error(star, FillRule::NonZero);
+	std::printf("Largest error against 16x16 supersampling: square %.3f, triangle %.3f,"
+	            " star %.3f (even-odd) %.3f (non-zero)\n", es, et, eo, en);
+	// Supersampling's own steps are 1/256, plus rounding.
+	CHECK(es < 0.03f);
+	CHECK(et < 0.03f);
+	// Only where the star crosses itself, since that's two
+	// edges sharing pixels.
+	CHECK(eo < 0.35f);
+	CHECK(en < 0.35f);
+
+	// Tile by tile comes out the same as all at once.
+	const auto whole = fill(star, FillRule::EvenOdd);
+	std::vector<uint8_t> tiled (W*H);
+	for (int ty=0; ty<H; ty+=64)
+	for (int tx=0; tx<W; tx+=64) {
+		const auto t = fill(star, FillRule::EvenOdd, Rect {tx, ty, std::min(tx+64, W), std::min(ty+64, H)});
+		for (int y=ty; y<std::min(ty+64, H); y++)
+		for (int x=tx; x<std::min(tx+64, W); x++) tiled[y*W + x] = t[y*W + x];
+	}
+	int worst = 0;
+	for (int i=0; i<W*H; i++) worst = std::max(worst, std::abs(whole[i] - tiled[i]));
+	CHECK(worst <= 1);
+
+	return failures;
+}
@@ -0,0 +1,86 @@
+/*
+	make checks
+	Symbols: how long a file full of instances takes to parse,
+	their boxes, and that drawing one blends the same whether
+	it fits in a tile or not.
+*/
+
+#include <cstdio>
+#include <chrono>
+#include <numbers>
+#include "../parser.hh"
+#include "../renderer.hh"
+#include "check.hh"
+
+constexpr unsigned W = 400, H = 300;
+
+uint32_t map(Col3 c) { return 0xff000000 | c.r << 16 | c.g << 8 | c.b; }
+Col3 get(uint32_t p) { return {uint8_t(p >> 16), uint8_t(p >> 8), uint8_t(p)}; }
+
+std::string base36(int v, int digits) {
+	int n = 1;
+	for (int i=0; i<digits; i++) n *= 36;
+	if (v < 0) v += n;
+	std::string s (digits, '0');
+	for (int i=digits-1; i>=0; i--, v /= 36) s[i] = "0123456789abcdefghijklmnopqrstuvwxyz"[v % 36];
+	return s;
+}
+
+// A symbol with only 'atoms' in it.
+std::shared_ptr<const Symbol> symbol(std::vector<Atom> atoms) {
+	auto s = std::make_shared<Symbol>("s", std::move(atoms));
+	s->box = Symbols::bounds(s->atoms);
+	return s;
+}
+
+int main() {
+	// 5000 turned instances of a 60 point icon.
+	std::string text = "Brush : [ 04 ";
+	for (int i=0; i<60; i++) {
+		const double a = 2*std::numbers::pi * i/60;
+		text += base36(std::lround(20*std::cos(a)), 3) + base36(std::lround(20*std::sin(a)), 3) + "zz'";
+	}
+	text += " ]\n\tSymbol : (icon),\n";
+	for (int i=0; i<5000; i++) {
+		const double a = i * 0.01;
+		char use[160];
+		std::snprintf(use, sizeof use, "Use : (icon)\n\tAffine : [ %+.3f %+.3f %d %+.3f %+.3f %d 0 0 1 ]%c\n",
+		              std::cos(a), -std::sin(a), 40 + i%100 * 30, std::sin(a), std::cos(a), 40 + i/100 * 30,
+		              i+1 < 5000 ? ',' : ';');
+		text += use;
+	}
+	const auto start = std::chrono::steady_clock::now();
+	auto sketch = SketchFormat::parse(SketchFormat::tokenize(text));
+	const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::printf("Parsing 5000 instances of a 60 point symbol took %.0f ms\n", ms);
+	CHECK(sketch && sketch->atoms.size() == 5000);
+	if (sketch) {
+		auto* first = std::get_if<Instance>(&sketch->atoms.front());
+		CHECK(first && first->symbol && first->symbol->atoms.size() == 1);
+		CHECK(ranges::all_of(sketch->atoms, [&](const Atom& a) {
+			auto* i = std::get_if<Instance>(&a);
+			return i && first && i->symbol == first->symbol;
+		}));
+	}
+
+	// A symbol with nothing in it doesn't stretch its parent's
+	// box out to the origin.
+	const std::vector<Atom> parent {
+		Stroke {3, {{100,100,1}, {110,120,1}}},
+		Instance {symbol({})}
+	};
+	CHECK((Symbols::bounds(parent) == std::array<float,4> {100, 100, 110, 120}));
+
+	// Light grey over black stays black, tile or no tile.
+	const auto grey = symbol({Fill {{{0,0,1}, {30,0,1}, {30,30,1}, {0,30,1}}, {}, FillRule::EvenOdd, {200,200,200}}});
+	for (float scale : {2.f, 100.f}) {
+		std::vector<uint32_t> pixels (W*H);
+		Renderer r {pixels, W, H, map, get};
+		r.clear();
+		r.displayAtom(Fill {{{0,0,1}, {W,0,1}, {W,H,1}, {0,H,1}}});
+		// Centred on the screen, the symbol being 30 across.
+		r.displayAtom(Instance {grey, {scale,0,W/2 - 15*scale, 0,scale,H/2 - 15*scale}});
+		CHECK(get(pixels[(H/2)*W + W/2]) == (Col3 {0, 0, 0}));
+	}
+	return failures;
+}
@@ -0,0 +1,146 @@
+#pragma once
+#include <map>
+#include <vector>
+#include <cmath>
+#include <functional>
+#include "types.hh"
+#include "document.hh"
+#include "renderer.hh"
+#include "occlusion.hh"
+
+// Full quality tiles of the document, kept across frames.
+// They sit on a pixel grid fixed to the document, so panning
+// just moves the screen over the same tiles and they can be
+// blitted instead of redrawn. Zooming (or a pan by a fraction
+// of a pixel) lands on a different grid and starts over.
+class TileCache {
+public:
+	static constexpr int Tile = 64;
+
+	struct Key {
+		int x, y;
+		auto operator<=>(const Key&) const = default;
+	};
+
+	// Where the screen is on the grid, in whole pixels.
+	struct Offset { int x, y; };
+
+private:
+	std::vector<uint32_t> buffer;
+	Renderer painter; // Draws into 'buffer'
+
+	// The grid is the zoom plus the fraction of a pixel the
+	// view is offset by, in 256ths so float noise from
+	// panning doesn't count as a different grid.
+	Real zoom = 0;
+	int  fx = -1, fy = -1;
+	Key  centre {0, 0};
+
+	std::map<Key, std::vector<uint32_t>> tiles;
+	std::size_t maxTiles;
+
+	// Grid space bounds of each atom, for skipping the
+	// ones that don't touch a tile.
+	std::vector<Rect> bounds;
+	bool boundsValid = false;
+
+	std::vector<const Atom*> near; // Scratch for render()
+	std::vector<Rect>        nearBounds;
+	std::vector<bool>        hidden;
+
+	static int floorDiv(long long a, int b) { return a/b - (a%b < 0); }
+
+	Viewport tileView(Key k) const {
+		return {(fx/Real(256) + k.x*Tile) / zoom, (fy/Real(256) + k.y*Tile) / zoom, zoom};
+	}
+
+	// Drops whichever tile is furthest from the screen.
+	void evict() {
+		auto far = tiles.begin();
+		long best = -1;
+		for (auto it = tiles.begin(); it != tiles.end(); ++it) {
+			const long dx = it->first.x - centre.x, dy = it->first.y - centre.y;
+			if (dx*dx + dy*dy > best) best = dx*dx + dy*dy, far = it;
+		}
+		tiles.erase(far);
+	}
+
+public:
+	TileCache(std::function<uint32_t(Col3)> map,
+	          std::function<Col3(uint32_t)> get,
+	          std::size_t budgetBytes = 64<<20)
+	: buffer(Tile*Tile)
+	, painter{buffer, Tile, Tile, map, get}
+	, maxTiles{budgetBytes / (Tile*Tile*sizeof(uint32_t))} {}
+
+	// Moves onto the grid for 'v', forgetting every tile if
+	// it's a different one. Returns where the screen is on it.
+	Offset setView(Viewport v, unsigned W, unsigned H) {
+		const long long ox = std::llround(double(v.x) * v.zoom * 256);
+		const long long oy = std::llround(double(v.y) * v.zoom * 256);
+		const Offset o {floorDiv(ox, 256), floorDiv(oy, 256)};
+		const int nfx = ox - o.x*256ll, nfy = oy - o.y*256ll;
+		if (v.zoom != zoom || nfx != fx || nfy != fy) {
+			zoom = v.zoom, fx = nfx, fy = nfy;
+			clear();
+		}
+		centre = {floorDiv(o.x + W/2, Tile), floorDiv(o.y + H/2, Tile)};
+		return o;
+	}
+
+	Rect rect(Key k) const { return {k.x*Tile, k.y*Tile, k.x*Tile+Tile, k.y*Tile+Tile}; }
+
+	// Grid coordinates of the tile holding a grid pixel.
+	static Key keyAt(int x, int y) { return {floorDiv(x, Tile), floorDiv(y, Tile)}; }
+
+	const std::vector<uint32_t>* find(Key k) const {
+		auto it = tiles.find(k);
+		return it == tiles.end() ? nullptr : &it->second;
+	}
+
+	// Draws tile 'k' from scratch and keeps it.
+	const std::vector<uint32_t>& render(Key k, const PVector<Atom>& atoms) {
+		if (!boundsValid) {
+			painter.view = tileView({0, 0});
+			bounds.clear();
+			bool visible = true;
+			atoms.forEach([&](const Atom& a) {
+				if (auto* l = std::get_if<Layer>(&a)) visible = l->visible;
+				bounds.push_back(visible ? painter.screenBounds(a) : Rect {});
+			});
+			boundsValid = true;
+		}
+		painter.view = tileView(k);
+		painter.clear();
+		const Rect r = rect(k);
+		near.clear(), nearBounds.clear();
+		std::size_t i = 0;
+		atoms.forEach([&](const Atom& a) {
+			if (bounds[i].intersects(r)) near.push_back(&a), nearBounds.push_back(bounds[i]);
+			i++;
+		});
+		Occlusion::cull(near, nearBounds, tileView({0, 0}), r, hidden);
+		for (std::size_t j=0; j<near.size(); j++)
+			if (!hidden[j]) painter.displayAtom(*near[j]);
+		if (!tiles.contains(k) && tiles.size() >= maxTiles && !tiles.empty())
+			evict();
+		return tiles[k] = buffer;
+	}
+
+	// Call whenever the atoms change. Only tiles touching
+	// 'r' (in grid space) are thrown away.
+	void invalidate(Rect r) {
+		boundsValid = false;
+		std::erase_if(tiles, [&](auto& t) { return rect(t.first).intersects(r); });
+	}
+
+	void clear() {
+		tiles.clear();
+		boundsValid = false;
+	}
+
+	void setBudget(std::size_t bytes) {
+		maxTiles = std::max<std::size_t>(1, bytes / (Tile*Tile*sizeof(uint32_t)));
+		while (tiles.size() > maxTiles) evict();
+	}
+};
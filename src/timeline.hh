@@ -0,0 +1,107 @@
+#pragma once
+#include <map>
+#include <vector>
+#include <cstring>
+#include "document.hh"
+#include "renderer.hh"
+#include "cold.hh"
+
+// Renders the document as it was after its first N atoms,
+// for scrubbing through how a drawing was made. Every K
+// atoms a finished frame is kept as a keyframe, so seeking
+// only has to draw at most K atoms on top of the nearest
+// one. K doubles whenever the keyframes would go over the
+// memory budget, so any length of document fits.
+//
+// Keyframes are only good for the view they were drawn in,
+// and remember the quality they were drawn at so a Full
+// render never builds on top of a Draft one.
+//
+// Layers only get their visibility here. Keyframes are plain
+// pixels, with nothing to blend with later.
+class Timeline {
+	struct Keyframe {
+		std::vector<uint32_t> pixels;
+		Quality quality;
+	};
+
+	std::size_t budget;
+	std::size_t interval;
+	std::size_t frameBytes;
+	std::map<std::size_t, Keyframe> keyframes;
+	PVector<Atom> atoms;
+	Viewport view;
+	std::map<std::size_t, bool> layers; // Where each Layer atom is, and if it's visible
+
+	bool visibleAt(std::size_t i) const {
+		auto l = layers.upper_bound(i);
+		return l == layers.begin() || (--l)->second;
+	}
+
+	void shrink() {
+		while (keyframes.size()*frameBytes > budget) {
+			interval *= 2;
+			std::erase_if(keyframes, [&](auto& k) { return k.first % interval; });
+		}
+	}
+
+public:
+	Timeline(unsigned W, unsigned H,
+	         std::size_t budgetBytes = 64<<20,
+	         std::size_t keyInterval = 64)
+	: budget{budgetBytes}
+	, interval{keyInterval}
+	, frameBytes{W*H*sizeof(uint32_t)} {}
+
+	std::size_t size() const { return atoms.size(); }
+
+	// Drops keyframes right away if they're over the new budget.
+	void setBudget(std::size_t bytes) {
+		budget = bytes;
+		shrink();
+	}
+
+	// Keyframes up to the first changed atom are still good.
+	void update(const PVector<Atom>& latest, Viewport v) {
+		if (v != view) keyframes.clear(), view = v;
+		const std::size_t same = atoms.mismatch(latest, Cold::Same {});
+		keyframes.erase(keyframes.upper_bound(same), keyframes.end());
+		layers.erase(layers.lower_bound(same), layers.end());
+		using It = PVector<Atom>::iterator;
+		for (It it {&latest, same}; it != latest.end(); ++it)
+			if (auto* l = std::get_if<Layer>(&*it)) layers[it.index()] = l->visible;
+		atoms = latest;
+	}
+
+	// Draws the first 'n' atoms into the renderer's buffer,
+	// at the renderer's quality. Its view has to match the
+	// one given to update().
+	void render(Renderer& r, std::span<uint32_t> out, std::size_t n) {
+		n = std::min(n, atoms.size());
+		std::size_t at = 0;
+		auto k = keyframes.upper_bound(n);
+		while (k != keyframes.begin() && (--k)->second.quality < r.quality)
+			;
+		if (k != keyframes.end() && k->first <= n && k->second.quality >= r.quality) {
+			at = k->first;
+			std::memcpy(out.data(), k->second.pixels.data(), frameBytes);
+		}
+		else r.clear();
+
+		// Keeps keyframes for every multiple of K passed on
+		// the way, so scrubbing forward gets cheaper too.
+		using It = PVector<Atom>::iterator;
+		while (at < n) {
+			std::size_t next = std::min(n, (at/interval + 1) * interval);
+			r.display(ranges::subrange {It {&atoms, at}, It {&atoms, next}}, visibleAt(at));
+			at = next;
+			auto& key = keyframes[at];
+			if (at % interval == 0 && (key.pixels.empty() || key.quality < r.quality)) {
+				key.pixels.assign(out.begin(), out.begin() + frameBytes/sizeof(uint32_t));
+				key.quality = r.quality;
+				shrink();
+			}
+			else if (key.pixels.empty()) keyframes.erase(at);
+		}
+	}
+};
@@ -9,14 +9,81 @@ std::ostream& operator<<(std::ostream& os, const Point& p) {
 
 std::ostream& operator<<(std::ostream& os, const Stroke& s) {
 	os << "width: " << s.diameter << "\n";
+	if (s.colour != Col3 {0,0,0} || s.alpha != 255)
+		os << "colour: " << +s.colour.r << " " << +s.colour.g << " " << +s.colour.b
+		   << " alpha " << +s.alpha << "\n";
+	if (!s.ends.empty()) os << "cut into " << s.ends.size()+1 << " pieces\n";
 	os << "points:";
 	for (Point p : s.points)
 		os << "\t" << p;
 	return os;
 }
 
+std::ostream& operator<<(std::ostream& os, const Curve& c) {
+	os << "curve width: " << c.diameter << "\n";
+	if (c.colour != Col3 {0,0,0} || c.alpha != 255)
+		os << "colour: " << +c.colour.r << " " << +c.colour.g << " " << +c.colour.b
+		   << " alpha " << +c.alpha << "\n";
+	os << "control points:";
+	for (Point p : c.points)
+		os << "\t" << p;
+	return os;
+}
+
 std::ostream& operator<<(std::ostream& os, const Marker& m) {
 	os << "message: " << m.text;
+	if (m.size > 0)
+		os << "\nlettering: at (" << m.at.x << ", " << m.at.y << ") size " << m.size
+		   << " colour: " << +m.colour.r << " " << +m.colour.g << " " << +m.colour.b
+		   << " alpha " << +m.alpha;
+	return os;
+}
+
+std::ostream& operator<<(std::ostream& os, const Layer& l) {
+	os << "layer: " << l.name << " (opacity " << l.opacity
+	   << (l.blend == Blend::Multiply ? ", multiply" : "")
+	   << (l.visible ? "" : ", hidden") << ")";
+	return os;
+}
+
+std::ostream& operator<<(std::ostream& os, const Fill& f) {
+	os << "fill: " << +f.colour.r << " " << +f.colour.g << " " << +f.colour.b
+	   << " alpha " << +f.alpha
+	   << (f.rule == FillRule::NonZero ? " nonzero" : " evenodd") << "\n";
+	os << "outline:";
+	for (Point p : f.outline)
+		os << "\t" << p;
+	return os;
+}
+
+std::ostream& operator<<(std::ostream& os, const Pattern& p) {
+	os << "pattern: " << p.width << "x" << p.height << " tile, "
+	   << p.motif.size() << " strokes"
+	   << (p.region.rule == FillRule::NonZero ? " nonzero" : " evenodd") << "\n";
+	os << "region:";
+	for (Point q : p.region.outline)
+		os << "\t" << q;
+	return os;
+}
+
+std::ostream& operator<<(std::ostream& os, const Instance& i) {
+	const auto& t = i.transform;
+	os << "instance of " << (i.symbol ? i.symbol->name : "nothing")
+	   << ": [" << t[0] << " " << t[1] << " " << t[2]
+	   << " / " << t[3] << " " << t[4] << " " << t[5] << "]";
+	return os;
+}
+
+std::ostream& operator<<(std::ostream& os, const Packed& p) {
+	os << "packed: " << p.bytes.size() << " bytes (" << p.size << " unpacked), box ("
+	   << p.box[0] << ", " << p.box[1] << ")-(" << p.box[2] << ", " << p.box[3] << ")";
+	return os;
+}
+
+std::ostream& operator<<(std::ostream& os, const Eraser& e) {
+	std::size_t runs = 0;
+	e.shape.each([&](int, int, int) { runs++; });
+	os << "eraser: " << runs << " runs, " << e.shape.x1-e.shape.x0 << "x" << e.shape.y1-e.shape.y0;
 	return os;
 }
 
@@ -28,6 +95,20 @@ std::ostream& operator<<(std::ostream& os, const Sketch& s) {
 			os << std::get<Stroke>(*it);
 		else if (std::holds_alternative<Marker>(*it))
 			os << std::get<Marker>(*it);
+		else if (std::holds_alternative<Layer>(*it))
+			os << std::get<Layer>(*it);
+		else if (std::holds_alternative<Fill>(*it))
+			os << std::get<Fill>(*it);
+		else if (std::holds_alternative<Eraser>(*it))
+			os << std::get<Eraser>(*it);
+		else if (std::holds_alternative<Pattern>(*it))
+			os << std::get<Pattern>(*it);
+		else if (std::holds_alternative<Curve>(*it))
+			os << std::get<Curve>(*it);
+		else if (std::holds_alternative<Instance>(*it))
+			os << std::get<Instance>(*it);
+		else if (std::holds_alternative<Packed>(*it))
+			os << std::get<Packed>(*it);
 		/* ... */
 
 		if (std::distance(it, s.atoms.end())) os << "\n";
@@ -1,5 +1,7 @@
 #pragma once
 #include <vector>
+#include <array>
+#include <algorithm>
 #include <ranges>
 #include <span>
 #include <list>
@@ -7,24 +9,189 @@
 #include <string_view>
 #include <variant>
 #include <map>
+#include <memory>
 #include <cassert>
 #include <cstdint>
 namespace ranges = std::ranges;
 namespace views  = std::views;
 using namespace    std::literals;
 
+template <typename... Ts>
+struct Overloaded : Ts... { using Ts::operator()...; };
+
 struct RawPoint;
 struct RawStroke;
 struct RawSketch;
 
 // Editor Data Types:
+struct Col3    { uint8_t r, g, b; bool operator==(const Col3&) const = default; };
 struct Point   { int16_t x, y; float pressure; };
-struct Stroke  { unsigned diameter; std::vector<Point> points; };
-struct Pattern { /* ... */ };
-struct Mask    { /* ... */ };
-struct Eraser  { Mask shape; };
-struct Marker  { std::string text; };
-using  Atom    = std::variant<Stroke, Pattern, Eraser, Marker>;
+struct Stroke  {
+	unsigned diameter;
+	std::vector<Point> points;
+	Col3    colour {0, 0, 0};
+	uint8_t alpha = 255;
+	std::vector<uint32_t> ends {}; // Once it's been cut, where each piece but the last stops
+
+	// Calls f(points) for each piece, which is all of it
+	// unless it's been cut.
+	template <typename F>
+	void pieces(F f) const {
+		std::size_t start = 0;
+		for (uint32_t end : ends) {
+			const std::size_t stop = std::clamp<std::size_t>(end, start, points.size());
+			f(std::span {points}.subspan(start, stop-start));
+			start = stop;
+		}
+		if (start < points.size() || ends.empty()) f(std::span {points}.subspan(start));
+	}
+};
+
+// Where an eraser went, in document pixels: runs of whole
+// pixels along each row. It's cut up into 64 pixel square
+// blocks, so drawing part of the screen only has to look at
+// the blocks there, and no run goes past the edge of one.
+struct Mask    {
+	static constexpr int Tile = 64;
+	struct Block {
+		int16_t tx, ty;                       // In blocks
+		std::array<uint16_t,Tile+1> rows {};  // Where each row's runs start
+		std::vector<uint8_t> runs {};         // x0, x1 pairs, in the block
+	};
+	std::vector<Block> blocks {}; // By row of blocks, then column
+	int16_t x0 = 0, y0 = 0, x1 = 0, y1 = 0; // Bounds, empty if x0 == x1
+
+	// Calls f(y, x0, x1) for each run, block by block.
+	template <typename F>
+	void each(F f) const {
+		for (const Block& b : blocks)
+		for (int r=0; r<Tile; r++)
+		for (int i=b.rows[r]; i<b.rows[r+1]; i+=2)
+			f(b.ty*Tile + r, b.tx*Tile + b.runs[i], b.tx*Tile + b.runs[i+1]);
+	}
+};
+// Erases whatever's under it in its layer (back to white,
+// which is see-through when layers are blended). Nothing under
+// it is changed, it's only a mask drawn over the top. The mask
+// can be finer than the document, 'scale' of its pixels to one
+// of the document's, so erasing zoomed in isn't blocky. The
+// diameter and tip are in its pixels.
+struct Eraser  {
+	unsigned diameter = 16;
+	Mask  shape {};
+	Point tip   {}; // Where it got to, to carry on from
+	uint8_t scale = 1;
+};
+// Text. With no size it's only a label (for the timeline),
+// otherwise it's lettering drawn on the page, 'size' being how
+// tall its capitals are and 'at' the top left of the first one.
+struct Marker  {
+	std::string text;
+	Point   at   {0, 0, 1};
+	float   size = 0;
+	Col3    colour {0, 0, 0};
+	uint8_t alpha = 255;
+};
+
+// One or more closed outlines, filled in. Each one's last
+// point joins back up with its first, and pressure doesn't
+// mean anything. Where outlines overlap or go around more than
+// once, the rule says what's inside.
+enum struct FillRule { EvenOdd, NonZero };
+struct Fill    {
+	std::vector<Point>    outline; // Every contour, one after another
+	std::vector<uint32_t> ends {}; // Where each but the last one stops
+	FillRule rule = FillRule::EvenOdd;
+	Col3     colour {0, 0, 0};
+	uint8_t  alpha = 255;
+
+	// Calls f(a, b) for every edge of every contour.
+	template <typename F>
+	void edges(F f) const {
+		std::size_t start = 0;
+		auto contour = [&](std::size_t end) {
+			for (std::size_t i=start; i<end; i++)
+				f(outline[i], outline[i+1 < end ? i+1 : start]);
+			start = end;
+		};
+		for (uint32_t end : ends) contour(std::clamp<std::size_t>(end, start, outline.size()));
+		if (start < outline.size()) contour(outline.size());
+	}
+};
+
+// A motif repeated over a region, like hatching. The motif is
+// strokes in a 'width' by 'height' tile, in document pixels
+// from its top left, and it wraps around at the tile's edges.
+// Tiles start at the document's origin, so patterns next to
+// each other line up. Only the region's outline and rule are
+// used, not its colour.
+struct Pattern {
+	std::vector<Stroke> motif {};
+	uint16_t width = 16, height = 16;
+	Fill     region {};
+};
+
+// Starts a new layer, which every atom after it is in until
+// the next one. Atoms before the first one are in an unnamed
+// base layer. Layers are drawn on their own, then blended
+// over what's under them, bottom (earliest) first.
+enum struct Blend { Darken, Multiply };
+struct Layer   {
+	std::string name;
+	bool  visible = true;
+	float opacity = 1;
+	Blend blend   = Blend::Darken;
+};
+
+// A smooth stroke, as cubic Béziers end to end: points 0 to 3
+// are the first one, 3 to 6 the next and so on, so there are
+// 3n+1 of them. Finished strokes get fitted to these, being a
+// lot fewer points for the same line.
+struct Curve   {
+	unsigned diameter;
+	std::vector<Point> points;
+	Col3    colour {0, 0, 0};
+	uint8_t alpha = 255;
+};
+
+// One use of a symbol (see below), drawn through 'transform':
+// the top two rows of an Affine, from the symbol's document
+// pixels to the page's. Instances share the symbol, so a
+// thousand of them cost about what one does.
+struct Symbol;
+struct Instance {
+	std::shared_ptr<const Symbol> symbol;
+	std::array<float,6> transform {1,0,0, 0,1,0};
+};
+
+// A stroke or curve nobody's touched in a while, squeezed
+// down (see cold.hh): its binary encoding, compressed. 'box'
+// is what its points cover and 'diameter' its line's, so it
+// can be left shut when it's not on screen or near the cutter.
+// 'was' is where the atom it's a copy of was, and 'sum' a hash
+// of its encoding, to tell it's no different from that one.
+// 'was' might not be there any more, so it's only ever
+// compared.
+struct Packed {
+	std::vector<uint8_t> bytes;
+	uint32_t    size = 0;             // Encoding before compressing
+	std::array<int16_t,4> box {};     // x0, y0, x1, y1
+	unsigned    diameter = 0;
+	const void* was = nullptr;
+	uint64_t    sum = 0;
+};
+
+using  Atom    = std::variant<Stroke, Pattern, Eraser, Marker, Layer, Fill, Curve, Instance, Packed>;
+
+// Something drawn once and used any number of times (stamps,
+// icons). It can be strokes, curves, fills, lettering and
+// instances of other symbols. 'box' is what they cover, in its
+// own document pixels: x0, y0, x1, y1.
+struct Symbol {
+	std::string name;
+	std::vector<Atom> atoms {};
+	std::array<float,4> box {0, 0, 0, 0};
+};
 
 namespace Mod
 {
@@ -36,7 +203,7 @@ using namespace Mod;
 
 using Modifier = std::variant<Affine, Array/*, ... */>;
 
-enum struct ElementType { Data, Pencil, Brush, Fill, Eraser, Lettering };
+enum struct ElementType { Data, Pencil, Brush, Fill, Eraser, Lettering, Pattern, Curve, Use };
 
 // If the type is not found in the map, it
 // means that type doesn't correspond to a
@@ -46,6 +213,11 @@ const std::map<std::string_view,ElementType> elementTypeFromString {
 	{"Pencil", ElementType::Pencil},
 	{"Brush" , ElementType::Brush },
 	{"Fill"  , ElementType::Fill  },
+	{"Erase" , ElementType::Eraser},
+	{"Lettering", ElementType::Lettering},
+	{"Pattern", ElementType::Pattern},
+	{"Curve" , ElementType::Curve },
+	{"Use"   , ElementType::Use   },
 };
 
 struct Element {
@@ -2,6 +2,8 @@
 #include <SDL2/SDL.h>
 #include <span>
 #include <cctype>
+#include <vector>
+#include "math.hh"
 
 class Window {
 	unsigned m_W, m_H;
@@ -55,4 +57,11 @@ public:
 		// TODO: look up the right SDL calls and such
 	}
 	void updatePixels() { SDL_UpdateWindowSurface(sdlWindow); }
+	// Only sends the given parts of the surface to the screen.
+	void updatePixels(std::span<const Rect> rects) {
+		std::vector<SDL_Rect> r {};
+		for (Rect x : rects)
+			if (!x.empty()) r.push_back({x.x0, x.y0, x.x1-x.x0, x.y1-x.y0});
+		if (!r.empty()) SDL_UpdateWindowSurfaceRects(sdlWindow, r.data(), r.size());
+	}
 };
\ No newline at end of file